@@ -0,0 +1,71 @@
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static int __ = 0;
+static int variables = 0;
+static int a = 5;
+static int b = 0;
+static int a_eq_b = 1;
+static int a_eq__b = 0;
+
+int executions = 0;
+
+int step() {
+	if (__) {
+		executions = __;
+		__ -= executions;
+		variables += executions;
+		a += executions;
+		b += executions;
+		return 0;
+	}
+	else if (a && a_eq_b) {
+		executions = a;
+		a -= executions;
+		a_eq_b -= executions;
+		b += executions;
+		a_eq_b += executions;
+		a_eq__b += executions;
+		return 1;
+	}
+	else if (a_eq_b) {
+		executions = a_eq_b;
+		a_eq_b -= executions;
+		return 2;
+	}
+	else if (a_eq__b) {
+		executions = a_eq__b;
+		a_eq__b -= executions;
+		a += executions;
+		return 3;
+	}
+	return -1;
+}
+
+void eval() {
+	int out = 0;
+	while (out != -1) {
+		out = step();
+	}
+}
+
+#ifdef DEBUG
+
+#include <stdio.h>
+
+void printout() {
+	printf("%d,", __);
+	printf("%d,", variables);
+	printf("%d,", a);
+	printf("%d,", b);
+	printf("%d,", a_eq_b);
+	printf("%d,", a_eq__b);
+	printf("\n");
+}
+
+int main() {
+	eval();
+	printout();
+}
+
+#endif
+
@@ -0,0 +1,44 @@
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static int a = 5;
+static int b = 4;
+static int c = 0;
+
+int executions = 0;
+
+int step() {
+	if (a && b) {
+		executions = MIN(a, b);
+		a -= executions;
+		b -= executions;
+		c += executions * 2;
+		return 0;
+	}
+	return -1;
+}
+
+void eval() {
+	int out = 0;
+	while (out != -1) {
+		out = step();
+	}
+}
+
+#ifdef DEBUG
+
+#include <stdio.h>
+
+void printout() {
+	printf("%d,", a);
+	printf("%d,", b);
+	printf("%d,", c);
+	printf("\n");
+}
+
+int main() {
+	eval();
+	printout();
+}
+
+#endif
+
@@ -0,0 +1,70 @@
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static int sugar = 1;
+static int oranges = 1;
+static int apples = 2;
+static int cherries = 1;
+static int flour = 1;
+static int apple_cake = 0;
+static int fruit_salad = 0;
+static int fruit_cake = 0;
+
+int executions = 0;
+
+int step() {
+	if (sugar && apples && flour) {
+		executions = MIN(MIN(sugar, apples), flour);
+		sugar -= executions;
+		apples -= executions;
+		flour -= executions;
+		apple_cake += executions;
+		return 0;
+	}
+	else if (oranges && apples && cherries) {
+		executions = MIN(MIN(oranges, apples), cherries);
+		oranges -= executions;
+		apples -= executions;
+		cherries -= executions;
+		fruit_salad += executions;
+		return 1;
+	}
+	else if (apple_cake && fruit_salad) {
+		executions = MIN(apple_cake, fruit_salad);
+		apple_cake -= executions;
+		fruit_salad -= executions;
+		fruit_cake += executions;
+		return 2;
+	}
+	return -1;
+}
+
+void eval() {
+	int out = 0;
+	while (out != -1) {
+		out = step();
+	}
+}
+
+#ifdef DEBUG
+
+#include <stdio.h>
+
+void printout() {
+	printf("%d,", sugar);
+	printf("%d,", oranges);
+	printf("%d,", apples);
+	printf("%d,", cherries);
+	printf("%d,", flour);
+	printf("%d,", apple_cake);
+	printf("%d,", fruit_salad);
+	printf("%d,", fruit_cake);
+	printf("\n");
+}
+
+int main() {
+	eval();
+	printout();
+}
+
+#endif
+
@@ -0,0 +1,49 @@
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static int __ = 0;
+static int variables = 0;
+static int a = 5;
+static int b = 0;
+static int a_to_b = 1;
+
+int executions = 0;
+
+int step() {
+	if (__) {
+		executions = __;
+		__ -= executions;
+		variables += executions;
+		a += executions;
+		b += executions;
+		return 0;
+	}
+	return -1;
+}
+
+void eval() {
+	int out = 0;
+	while (out != -1) {
+		out = step();
+	}
+}
+
+#ifdef DEBUG
+
+#include <stdio.h>
+
+void printout() {
+	printf("%d,", __);
+	printf("%d,", variables);
+	printf("%d,", a);
+	printf("%d,", b);
+	printf("%d,", a_to_b);
+	printf("\n");
+}
+
+int main() {
+	eval();
+	printout();
+}
+
+#endif
+
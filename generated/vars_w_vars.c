@@ -0,0 +1,62 @@
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+static int __ = 0;
+static int variables = 0;
+static int a = 5;
+static int b = 0;
+static int a_to_b = 1;
+
+int executions = 0;
+
+int step() {
+	if (__) {
+		executions = __;
+		__ -= executions;
+		variables += executions;
+		a += executions;
+		b += executions;
+		return 0;
+	}
+	else if (a && a_to_b) {
+		executions = MIN(a, a_to_b);
+		a -= executions;
+		a_to_b -= executions;
+		b += executions;
+		a_to_b += executions;
+		return 1;
+	}
+	else if (a_to_b) {
+		executions = a_to_b;
+		a_to_b -= executions;
+		return 2;
+	}
+	return -1;
+}
+
+void eval() {
+	int out = 0;
+	while (out != -1) {
+		out = step();
+	}
+}
+
+#ifdef DEBUG
+
+#include <stdio.h>
+
+void printout() {
+	printf("%d,", __);
+	printf("%d,", variables);
+	printf("%d,", a);
+	printf("%d,", b);
+	printf("%d,", a_to_b);
+	printf("\n");
+}
+
+int main() {
+	eval();
+	printout();
+}
+
+#endif
+
@@ -0,0 +1,107 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ARENA_BLOCK_SZ 65536 /* default block size, bigger allocations get their own */
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* get size bytes of zeroed memory from the arena, NULL if out of memory */
+void* arena_alloc(Arena* arena, size_t size) {
+    ArenaBlock* block = arena->head;
+    void* ptr;
+    size = align_up(size);
+    if (!block || block->used + size > block->size) {
+        /* no room left, start a new block. (calloc so everything handed out
+         * is already zeroed) */
+        size_t block_size = size > ARENA_BLOCK_SZ ? size : ARENA_BLOCK_SZ;
+        block = calloc(1, sizeof(ArenaBlock) + block_size);
+        if (!block) return NULL;
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/* grow an allocation from old_size to new_size bytes, returning the (possibly
+ * moved) pointer. The new bytes are zeroed. */
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+    ArenaBlock* block = arena->head;
+    void* moved;
+    if (!ptr) return arena_alloc(arena, new_size);
+    if (new_size <= old_size) return ptr;
+    /* if this was the last allocation and the block has room, just bump */
+    if (block && (char*)ptr + align_up(old_size) == block->data + block->used
+            && block->used - align_up(old_size) + align_up(new_size) <= block->size) {
+        block->used = block->used - align_up(old_size) + align_up(new_size);
+        return ptr;
+    }
+    if (!(moved = arena_alloc(arena, new_size))) return NULL;
+    memcpy(moved, ptr, old_size);
+    return moved;
+}
+
+/* map size bytes of the open file fd into memory as a private (copy on write)
+ * view, with at least one zero byte after the end. Returns NULL if the file
+ * can't be mapped. */
+char* arena_map_file(Arena* arena, int fd, size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t total = (size / page + 1) * page; /* always room for a zero after */
+    ArenaMapping* mapping = arena_alloc(arena, sizeof(ArenaMapping));
+    char* addr;
+    if (!mapping) return NULL;
+    /* reserve zeroed anonymous memory for the whole thing first, then put the
+     * file over the start of it. (mapping just the file would fault on the
+     * byte after the end if the file is an exact number of pages) */
+    addr = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) return NULL;
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(addr, total);
+        return NULL;
+    }
+    /* we only ever walk through source front to back */
+    madvise(addr, size, MADV_SEQUENTIAL);
+    mapping->addr = addr;
+    mapping->size = total;
+    mapping->next = arena->mappings;
+    arena->mappings = mapping;
+    return addr;
+}
+
+/* free everything allocated from (and unmap everything mapped by) the arena,
+ * leaving it empty and reusable */
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    ArenaBlock* next;
+    ArenaMapping* mapping;
+    /* the mapping list lives in the blocks, so unmap before freeing them */
+    for (mapping = arena->mappings; mapping; mapping = mapping->next)
+        munmap(mapping->addr, mapping->size);
+    arena->mappings = NULL;
+    while (block) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
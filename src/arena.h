@@ -0,0 +1,60 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* A simple arena (region) allocator. Everything belonging to a program (source,
+ * symbol names, symbol and rule tables, accumulators) comes out of one arena,
+ * so it can all be thrown away in a single arena_free, and several programs
+ * can live side by side in different arenas. */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next; /* the previously filled block */
+    size_t size; /* bytes available in data */
+    size_t used; /* bytes handed out so far */
+    char data[];
+} ArenaBlock;
+
+/* a file mapped into memory on behalf of the arena */
+typedef struct ArenaMapping {
+    struct ArenaMapping* next;
+    void* addr;
+    size_t size;
+} ArenaMapping;
+
+/* zero initialize (e.g. `static Arena arena;`) for an empty arena */
+typedef struct Arena {
+    ArenaBlock* head; /* block we're currently allocating out of */
+    ArenaMapping* mappings; /* files to unmap when the arena is freed */
+} Arena;
+
+/* get size bytes of zeroed memory from the arena, NULL if out of memory */
+void* arena_alloc(Arena* arena, size_t size);
+
+/* grow an allocation from old_size to new_size bytes, returning the (possibly
+ * moved) pointer. The new bytes are zeroed. This extends in place when ptr was
+ * the last thing allocated, otherwise the old copy is left in the arena. */
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+/* map size bytes of the open file fd into memory as a private (copy on write)
+ * view, so it can be written to without changing the file. There's always at
+ * least one zero byte after the end, so the mapping can be used as a null
+ * terminated string. Returns NULL if the file can't be mapped. */
+char* arena_map_file(Arena* arena, int fd, size_t size);
+
+/* free everything allocated from (and unmap everything mapped by) the arena,
+ * leaving it empty and reusable */
+void arena_free(Arena* arena);
+
+#endif
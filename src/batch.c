@@ -0,0 +1,324 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BATCH_X86
+#include <immintrin.h>
+#endif
+
+/* (so every group of lanes starts on a vector boundary) */
+static void* alloc_lanes(size_t size) {
+    size_t group = BATCH_GROUP * sizeof(int);
+    void* lanes = aligned_alloc(group, (size + group - 1) / group * group);
+    if (lanes) memset(lanes, 0, size);
+    return lanes;
+}
+
+int init_batch(Batch* batch, RuleTable* rules, int lanes) {
+    SparseRules* sparse = sparse_rules(rules);
+    int i, k;
+    memset(batch, 0, sizeof(Batch));
+    if (!sparse || sparse->len < 0) return 0;
+    batch->sparse = sparse;
+    batch->lanes = (lanes + BATCH_GROUP - 1) / BATCH_GROUP * BATCH_GROUP;
+    if (batch->lanes == 0) batch->lanes = BATCH_GROUP;
+    batch->syms_len = rules->syms->len;
+    batch->counts = alloc_lanes((size_t)(batch->syms_len + 1) * batch->lanes * sizeof(int));
+    batch->running = alloc_lanes(batch->lanes * sizeof(int));
+    batch->steps = alloc_lanes(batch->lanes * sizeof(int));
+    batch->limits = malloc(sparse->lhs_start[sparse->len] + 1);
+    batch->limited = calloc(sparse->len + 1, 1);
+    batch->skip = calloc((size_t)(batch->lanes / BATCH_GROUP) * sparse->len + 1, 1);
+    batch->watch_start = calloc(batch->syms_len + 2, sizeof(int));
+    batch->watch = malloc((sparse->lhs_start[sparse->len] + 1) * sizeof(int));
+    if (!batch->counts || !batch->running || !batch->steps || !batch->limits || !batch->limited
+            || !batch->skip || !batch->watch_start || !batch->watch) {
+        free_batch(batch);
+        return 0;
+    }
+    for (i = 0; i < sparse->len; i++) {
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++) {
+            batch->limits[k] = !sparse->transfers || limits_executions(sparse, i, k);
+            batch->limited[i] |= batch->limits[k];
+        }
+    }
+    /* (counted into the slot after each symbol's, then each rule goes in at
+     * its symbol's start, which leaves watch_start[s] where s starts) */
+    for (k = 0; k < sparse->lhs_start[sparse->len]; k++)
+        batch->watch_start[sparse->lhs[k] + 2]++;
+    for (i = 2; i < batch->syms_len + 2; i++)
+        batch->watch_start[i] += batch->watch_start[i - 1];
+    for (i = 0; i < sparse->len; i++)
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            batch->watch[batch->watch_start[sparse->lhs[k] + 1]++] = i;
+    return 1;
+}
+
+void free_batch(Batch* batch) {
+    free(batch->counts);
+    free(batch->running);
+    free(batch->steps);
+    free(batch->limits);
+    free(batch->limited);
+    free(batch->skip);
+    free(batch->watch_start);
+    free(batch->watch);
+    memset(batch, 0, sizeof(Batch));
+}
+
+void clear_batch(Batch* batch) {
+    memset(batch->counts, 0, (size_t)(batch->syms_len + 1) * batch->lanes * sizeof(int));
+    memset(batch->running, 0, batch->lanes * sizeof(int));
+    memset(batch->steps, 0, batch->lanes * sizeof(int));
+    memset(batch->skip, 0, (size_t)(batch->lanes / BATCH_GROUP) * batch->sparse->len);
+}
+
+void batch_set_bag(Batch* batch, int lane, int* accumulator) {
+    int s;
+    for (s = 0; s < batch->syms_len; s++)
+        batch->counts[(size_t)s * batch->lanes + lane] = accumulator[s];
+    batch->running[lane] = -1;
+    batch->steps[lane] = 0;
+    /* (any rule could match the new bag) */
+    memset(&batch->skip[(size_t)(lane / BATCH_GROUP) * batch->sparse->len], 0, batch->sparse->len);
+}
+
+void batch_get_bag(Batch* batch, int lane, int* accumulator) {
+    int s;
+    for (s = 0; s < batch->syms_len; s++)
+        accumulator[s] = batch->counts[(size_t)s * batch->lanes + lane];
+}
+
+/* a rule changed symbol s in a group (whose flags are skip), so the rules
+ * with it on their LHS could match there now */
+static inline void wake_rules(Batch* batch, char* skip, int s) {
+    int k;
+    for (k = batch->watch_start[s]; k < batch->watch_start[s + 1]; k++)
+        skip[batch->watch[k]] = 0;
+}
+
+/* step() for a group of lanes, a lane at a time, which the vector versions
+ * have to agree with: each rule is tried on the lanes that haven't matched
+ * anything yet, and applied to the ones it matches (the rest get 0
+ * executions). A rule that no running lane in the group has every LHS
+ * symbol for is skipped until one of them changes. */
+static void scalar_step(Batch* batch, int group) {
+    SparseRules* sparse = batch->sparse;
+    char* skip = batch->skip + (size_t)group * sparse->len;
+    int* counts = batch->counts + group * BATCH_GROUP;
+    int* running = batch->running + group * BATCH_GROUP;
+    int* steps = batch->steps + group * BATCH_GROUP;
+    size_t stride = batch->lanes;
+    int pending[BATCH_GROUP], enabled[BATCH_GROUP], executions[BATCH_GROUP];
+    int rule, k, lane, count, any = 0, hits, left = 0;
+    for (lane = 0; lane < BATCH_GROUP; lane++) {
+        pending[lane] = running[lane];
+        left += running[lane] != 0;
+        steps[lane] -= running[lane]; /* (running lanes are -1) */
+    }
+    if (!left) return;
+    for (rule = 0; rule < sparse->len; rule++) {
+        if (sparse->lhs_start[rule] == sparse->lhs_start[rule + 1] || skip[rule]) continue;
+        for (lane = 0; lane < BATCH_GROUP; lane++) {
+            enabled[lane] = running[lane] != 0;
+            executions[lane] = batch->limited[rule] ? INT_MAX : 1;
+        }
+        for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+            for (lane = 0, any = 0; lane < BATCH_GROUP; lane++) {
+                if (!enabled[lane]) continue;
+                count = counts[sparse->lhs[k] * stride + lane];
+                enabled[lane] = count != 0;
+                if (batch->limits[k] && count < executions[lane]) executions[lane] = count;
+                any |= enabled[lane];
+            }
+            if (!any) break;
+        }
+        if (!any) {
+            skip[rule] = 1;
+            continue;
+        }
+        for (lane = 0, hits = 0; lane < BATCH_GROUP; lane++) {
+            enabled[lane] = enabled[lane] && pending[lane] && executions[lane] > 0;
+            hits += enabled[lane];
+        }
+        if (!hits) continue;
+        for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++) {
+            for (lane = 0; lane < BATCH_GROUP; lane++)
+                if (enabled[lane])
+                    counts[sparse->delta_syms[k] * stride + lane] += executions[lane] * sparse->deltas[k];
+            wake_rules(batch, skip, sparse->delta_syms[k]);
+        }
+        for (lane = 0; lane < BATCH_GROUP; lane++)
+            if (enabled[lane]) pending[lane] = 0;
+        if (!(left -= hits)) return;
+    }
+    /* whatever's still pending matched nothing and halts */
+    for (lane = 0; lane < BATCH_GROUP; lane++)
+        if (pending[lane]) running[lane] = 0;
+}
+
+#ifdef BATCH_X86
+/* a * b in each 32 bit lane, which SSE2 doesn't have an instruction for */
+static inline __m128i sse2_mullo(__m128i a, __m128i b) {
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline int sse2_any(__m128i v) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_setzero_si128())) != 0xffff;
+}
+
+/* the same as scalar_step, four lanes at a time (each group is two halves,
+ * h) */
+static void sse2_step(Batch* batch, int group) {
+    SparseRules* sparse = batch->sparse;
+    char* skip = batch->skip + (size_t)group * sparse->len;
+    __m128i* counts = (__m128i*)batch->counts + group * 2;
+    __m128i* running = (__m128i*)batch->running + group * 2;
+    __m128i* steps = (__m128i*)batch->steps + group * 2;
+    size_t stride = batch->lanes / 4;
+    __m128i zero = _mm_setzero_si128();
+    __m128i pending[2], enabled[2], executions[2];
+    __m128i count, less;
+    int rule, k, h;
+    for (h = 0; h < 2; h++) {
+        pending[h] = _mm_load_si128(running + h);
+        _mm_store_si128(steps + h, _mm_sub_epi32(_mm_load_si128(steps + h), pending[h]));
+    }
+    if (!sse2_any(_mm_or_si128(pending[0], pending[1]))) return;
+    for (rule = 0; rule < sparse->len; rule++) {
+        if (sparse->lhs_start[rule] == sparse->lhs_start[rule + 1] || skip[rule]) continue;
+        for (h = 0; h < 2; h++) {
+            enabled[h] = _mm_load_si128(running + h);
+            executions[h] = _mm_set1_epi32(batch->limited[rule] ? INT_MAX : 1);
+        }
+        for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+            for (h = 0; h < 2; h++) {
+                count = _mm_load_si128(counts + sparse->lhs[k] * stride + h);
+                enabled[h] = _mm_andnot_si128(_mm_cmpeq_epi32(count, zero), enabled[h]);
+                if (!batch->limits[k]) continue;
+                less = _mm_cmpgt_epi32(executions[h], count);
+                executions[h] = _mm_or_si128(_mm_and_si128(less, count), _mm_andnot_si128(less, executions[h]));
+            }
+            if (!sse2_any(_mm_or_si128(enabled[0], enabled[1]))) break;
+        }
+        if (!sse2_any(_mm_or_si128(enabled[0], enabled[1]))) {
+            skip[rule] = 1;
+            continue;
+        }
+        for (h = 0; h < 2; h++)
+            enabled[h] = _mm_and_si128(_mm_and_si128(enabled[h], pending[h]), _mm_cmpgt_epi32(executions[h], zero));
+        if (!sse2_any(_mm_or_si128(enabled[0], enabled[1]))) continue;
+        for (h = 0; h < 2; h++)
+            executions[h] = _mm_and_si128(executions[h], enabled[h]);
+        for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++) {
+            for (h = 0; h < 2; h++) {
+                count = _mm_load_si128(counts + sparse->delta_syms[k] * stride + h);
+                count = _mm_add_epi32(count, sse2_mullo(executions[h], _mm_set1_epi32(sparse->deltas[k])));
+                _mm_store_si128(counts + sparse->delta_syms[k] * stride + h, count);
+            }
+            wake_rules(batch, skip, sparse->delta_syms[k]);
+        }
+        for (h = 0; h < 2; h++)
+            pending[h] = _mm_andnot_si128(enabled[h], pending[h]);
+        if (!sse2_any(_mm_or_si128(pending[0], pending[1]))) return;
+    }
+    for (h = 0; h < 2; h++)
+        _mm_store_si128(running + h, _mm_andnot_si128(pending[h], _mm_load_si128(running + h)));
+}
+
+/* the same as scalar_step, for a whole group at once */
+__attribute__((target("avx2")))
+static void avx2_step(Batch* batch, int group) {
+    SparseRules* sparse = batch->sparse;
+    char* skip = batch->skip + (size_t)group * sparse->len;
+    __m256i* counts = (__m256i*)batch->counts + group;
+    __m256i* running = (__m256i*)batch->running + group;
+    __m256i* steps = (__m256i*)batch->steps + group;
+    size_t stride = batch->lanes / BATCH_GROUP;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i pending = _mm256_load_si256(running);
+    __m256i executions, enabled, count;
+    int rule, k;
+    if (_mm256_testz_si256(pending, pending)) return;
+    _mm256_store_si256(steps, _mm256_sub_epi32(_mm256_load_si256(steps), pending));
+    for (rule = 0; rule < sparse->len; rule++) {
+        if (sparse->lhs_start[rule] == sparse->lhs_start[rule + 1] || skip[rule]) continue;
+        enabled = _mm256_load_si256(running);
+        executions = _mm256_set1_epi32(batch->limited[rule] ? INT_MAX : 1);
+        for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+            count = _mm256_load_si256(counts + sparse->lhs[k] * stride);
+            enabled = _mm256_andnot_si256(_mm256_cmpeq_epi32(count, zero), enabled);
+            if (_mm256_testz_si256(enabled, enabled)) break;
+            if (batch->limits[k])
+                executions = _mm256_min_epi32(executions, count);
+        }
+        if (_mm256_testz_si256(enabled, enabled)) {
+            skip[rule] = 1;
+            continue;
+        }
+        enabled = _mm256_and_si256(_mm256_and_si256(enabled, pending), _mm256_cmpgt_epi32(executions, zero));
+        if (_mm256_testz_si256(enabled, enabled)) continue;
+        executions = _mm256_and_si256(executions, enabled);
+        for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++) {
+            count = _mm256_load_si256(counts + sparse->delta_syms[k] * stride);
+            count = _mm256_add_epi32(count, _mm256_mullo_epi32(executions, _mm256_set1_epi32(sparse->deltas[k])));
+            _mm256_store_si256(counts + sparse->delta_syms[k] * stride, count);
+            wake_rules(batch, skip, sparse->delta_syms[k]);
+        }
+        pending = _mm256_andnot_si256(enabled, pending);
+        if (_mm256_testz_si256(pending, pending)) return;
+    }
+    _mm256_store_si256(running, _mm256_andnot_si256(pending, _mm256_load_si256(running)));
+}
+#endif
+
+int batch_step(Batch* batch) {
+    int running = 0;
+    int i;
+#ifdef BATCH_X86
+    int level = scan_simd_level();
+#endif
+    for (i = 0; i < batch->lanes / BATCH_GROUP; i++) {
+#ifdef BATCH_X86
+        if (level == 2) {
+            avx2_step(batch, i);
+            continue;
+        }
+        if (level == 1) {
+            sse2_step(batch, i);
+            continue;
+        }
+#endif
+        scalar_step(batch, i);
+    }
+    for (i = 0; i < batch->lanes; i++)
+        running += batch->running[i] != 0;
+    return running;
+}
+
+int batch_eval(Batch* batch, int max_steps) {
+    int steps = 0;
+    while (1) {
+        steps += 1;
+        if (!batch_step(batch)) break;
+        if (max_steps != -1 && steps >= max_steps) break;
+    }
+    return steps;
+}
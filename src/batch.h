@@ -0,0 +1,82 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Running one set of rules against lots of different bags at once. Every bag
+ * (lane) takes the same steps as step() would on it alone, but each rule is
+ * checked and applied for 8 lanes at a time (one AVX2 instruction, or two
+ * SSE2 ones, per symbol), so what-if runs over thousands of starting bags
+ * don't each pay for a pass over the rules. VERA_SIMD caps the version used
+ * the same way as for the scans (see scan.h). */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "parser.h"
+#include "sparse.h"
+
+/* lanes per vector, a batch's lanes are always a multiple of this */
+#define BATCH_GROUP 8
+
+/* ----------------------------------------------
+The accumulators are symbol major: lane l's count of symbol s is
+counts[s * lanes + l], so a rule's symbol for a group of lanes is one load.
+
+limits has a flag for each LHS symbol (same indices as sparse->lhs) that's 1
+when it limits the rule's executions (see limits_executions), and limited a
+flag for each rule with any that do. running is -1 for each lane that hasn't
+halted yet and 0 for each one that has (or was never given a bag), steps is
+how many steps each lane has taken, counted the same as eval.
+
+skip has a flag per group per rule (skip[group * rules + rule]) that's set
+once the rule is found to match none of the group's running lanes, so later
+steps don't look at it again until something changes one of its LHS symbols
+in that group. watch_start/watch list the rules with each symbol on their
+LHS, for clearing those flags.
+---------------------------------------------- */
+typedef struct Batch {
+    SparseRules* sparse;
+    int lanes;
+    int syms_len;
+    int* counts;
+    int* running;
+    int* steps;
+    char* limits;
+    char* limited;
+    char* skip;
+    int* watch_start; /* syms_len + 1 of them */
+    int* watch;
+} Batch;
+
+/* set up a batch of at least lanes lanes (rounded up to a whole group) for
+ * the rules, all of them empty and halted. Returns 0 if out of memory. */
+int init_batch(Batch* batch, RuleTable* rules, int lanes);
+
+/* free everything init_batch allocated */
+void free_batch(Batch* batch);
+
+/* empty and halt every lane, e.g. to give the batch a new set of bags */
+void clear_batch(Batch* batch);
+
+/* copy a bag (syms_len ints) into a lane and start it running */
+void batch_set_bag(Batch* batch, int lane, int* accumulator);
+
+/* copy a lane's bag out into accumulator (syms_len ints) */
+void batch_get_bag(Batch* batch, int lane, int* accumulator);
+
+/* same as step() on every running lane, returns how many are still running
+ * (a lane with nothing to match halts) */
+int batch_step(Batch* batch);
+
+/* same as eval on every lane, until they've all halted or taken max_steps
+ * (-1 for no limit). Returns the most steps any lane took. */
+int batch_eval(Batch* batch, int max_steps);
+
+#endif
@@ -0,0 +1,141 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Times running a generated program from lots of different starting bags,
+ * once as separate eval() calls and once as a Batch, and checks they end up
+ * with the same bags. Pass generator flags (see generator.h) to time just
+ * that one program instead of the defaults. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parser.h"
+#include "interpreter.h"
+#include "batch.h"
+#include "generator.h"
+
+/* how many steps each bag gets (generated programs don't always halt) */
+#define BENCH_STEPS 2000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the program's facts, plus a few random extra symbols per bag */
+static void fill_bags(int* bags, int* facts, int syms_len, int bags_len) {
+    int i, k;
+    unsigned int seed = 1;
+    for (i = 0; i < bags_len; i++) {
+        memcpy(&bags[(size_t)i * syms_len], facts, syms_len * sizeof(int));
+        for (k = 0; k < 4; k++) {
+            seed = seed * 1103515245 + 12345;
+            bags[(size_t)i * syms_len + (seed >> 8) % syms_len] += (seed >> 4) % 5;
+        }
+    }
+}
+
+/* generate a program and time both ways of running it, printing a row */
+static int bench(GeneratorOptions* options, int bags_len) {
+    Arena arena = {0};
+    SymTable syms;
+    RuleTable rules;
+    BagOfFacts bag;
+    Batch batch;
+    char* src = NULL;
+    size_t src_size = 0;
+    FILE* f = open_memstream(&src, &src_size);
+    int* bags = NULL;
+    int* out = NULL;
+    double start, eval_time, batch_time;
+    int ok, i, differ = 0;
+
+    if (!f) return !printf("Out of memory\n");
+    ok = generate_program(f, options) > 0;
+    fclose(f);
+    if (ok) {
+        init_tables(&arena, &syms, &rules);
+        ok = parse(src, &rules, 1);
+    }
+    if (ok) {
+        init_bag(&bag, &syms, &arena);
+        populate_facts(&bag, &rules);
+        bags = malloc((size_t)bags_len * syms.len * sizeof(int));
+        out = malloc((size_t)bags_len * syms.len * sizeof(int));
+        ok = bags && out && init_batch(&batch, &rules, bags_len);
+    }
+    if (!ok) {
+        free(src);
+        free(bags);
+        free(out);
+        arena_free(&arena);
+        return !printf("Couldn't set up program\n");
+    }
+    fill_bags(bags, bag.accumulator, syms.len, bags_len);
+
+    start = now();
+    for (i = 0; i < bags_len; i++) {
+        bag.accumulator = &out[(size_t)i * syms.len];
+        memcpy(bag.accumulator, &bags[(size_t)i * syms.len], syms.len * sizeof(int));
+        eval(&bag, &rules, BENCH_STEPS);
+    }
+    eval_time = now() - start;
+
+    start = now();
+    for (i = 0; i < bags_len; i++)
+        batch_set_bag(&batch, i, &bags[(size_t)i * syms.len]);
+    batch_eval(&batch, BENCH_STEPS);
+    batch_time = now() - start;
+
+    for (i = 0; i < bags_len; i++) {
+        batch_get_bag(&batch, i, &bags[(size_t)i * syms.len]);
+        differ += memcmp(&bags[(size_t)i * syms.len], &out[(size_t)i * syms.len], syms.len * sizeof(int)) != 0;
+    }
+    printf("%8d %8d %6d | %9.2f %9.2f %7.1fx%s\n",
+            options->rules, syms.len, bags_len, eval_time * 1e3, batch_time * 1e3,
+            eval_time / batch_time, differ ? " (bags differ!)" : "");
+    fflush(stdout);
+    free_batch(&batch);
+    free(bags);
+    free(out);
+    free(src);
+    arena_free(&arena);
+    return !differ;
+}
+
+int main(int argc, char* argv[]) {
+    GeneratorOptions options;
+    int ok = 1;
+    int i;
+
+    default_generator_options(&options);
+    printf("   rules  symbols   bags |   eval ms  batch ms speedup\n");
+    if (argc > 1) {
+        if (!generator_options_from_args(&options, argc, argv))
+            return 1;
+        return !bench(&options, 1024);
+    }
+    for (i = 8; i <= 128; i *= 4) {
+        default_generator_options(&options);
+        options.rules = i;
+        options.symbols = i / 2;
+        ok &= bench(&options, 1024);
+    }
+    for (i = 64; i <= 4096; i *= 4) {
+        default_generator_options(&options);
+        options.rules = 32;
+        options.symbols = 16;
+        ok &= bench(&options, i);
+    }
+    return !ok;
+}
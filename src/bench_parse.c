@@ -0,0 +1,141 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Times parse(), run_variables_pass() and populate_facts() on generated
+ * programs of growing size, one dimension at a time, so anything that scales
+ * worse than linearly shows up as the rules/s or MB/s falling off. Pass
+ * generator flags (see generator.h) to time just that one program instead. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "parser.h"
+#include "interpreter.h"
+#include "variables_pass.h"
+#include "generator.h"
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_header(char* title) {
+    printf("\n%s\n", title);
+    printf("   rules  symbols vars name facts%%     MB |  parse ms     MB/s     rules/s |  vars ms |  facts ms\n");
+}
+
+/* generate a program and time each stage on it, printing a row */
+static int bench(GeneratorOptions* options) {
+    Arena arena = {0};
+    SymTable syms;
+    RuleTable rules;
+    BagOfFacts bag;
+    char* src = NULL;
+    size_t src_size = 0;
+    FILE* f = open_memstream(&src, &src_size);
+    double start, parse_time, vars_time, facts_time;
+    int ok;
+
+    if (!f) return !printf("Out of memory\n");
+    ok = generate_program(f, options) > 0;
+    fclose(f);
+    if (!ok) {
+        free(src);
+        return !printf("Couldn't generate program\n");
+    }
+
+    init_tables(&arena, &syms, &rules);
+    start = now();
+    ok = parse(src, &rules, 1);
+    parse_time = now() - start;
+
+    start = now();
+    if (ok) run_variables_pass(&rules, 0, 0);
+    vars_time = now() - start;
+
+    /* (includes building the sparse rules the first time they're needed) */
+    start = now();
+    if (ok) {
+        init_bag(&bag, &syms, &arena);
+        populate_facts(&bag, &rules);
+    }
+    facts_time = now() - start;
+
+    printf("%8d %8d %4d %4d %5d%% %6.2f | %9.2f %8.1f %11.0f | %8.2f | %9.2f%s\n",
+            options->rules, syms.len, options->vars, options->name_length,
+            options->fact_percent, src_size / 1e6,
+            parse_time * 1e3, src_size / 1e6 / parse_time, options->rules / parse_time,
+            vars_time * 1e3, facts_time * 1e3, ok ? "" : " (parse failed)");
+    fflush(stdout);
+    arena_free(&arena);
+    free(src);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    GeneratorOptions options;
+    int ok = 1;
+    int i;
+
+    default_generator_options(&options);
+    if (argc > 1) {
+        if (!generator_options_from_args(&options, argc, argv))
+            return 1;
+        print_header("Generated program");
+        return !bench(&options);
+    }
+
+    /* (sizes are kept small enough that the whole run takes seconds) */
+    print_header("Scaling rules");
+    for (i = 1000; i <= 64000; i *= 2) {
+        default_generator_options(&options);
+        options.rules = i;
+        options.symbols = 256;
+        ok &= bench(&options);
+    }
+
+    print_header("Scaling symbols");
+    for (i = 64; i <= 4096; i *= 2) {
+        default_generator_options(&options);
+        options.rules = 4000;
+        options.symbols = i;
+        ok &= bench(&options);
+    }
+
+    print_header("Scaling symbol name length");
+    for (i = 8; i <= 56; i += 16) {
+        default_generator_options(&options);
+        options.rules = 16000;
+        options.symbols = 256;
+        options.name_length = i;
+        ok &= bench(&options);
+    }
+
+    print_header("Scaling variables");
+    for (i = 0; i <= 8; i += 2) {
+        default_generator_options(&options);
+        options.rules = 4000;
+        options.symbols = 256;
+        options.vars = i;
+        ok &= bench(&options);
+    }
+
+    print_header("Scaling fact density");
+    for (i = 0; i <= 100; i += 50) {
+        default_generator_options(&options);
+        options.rules = 16000;
+        options.symbols = 256;
+        options.fact_percent = i;
+        ok &= bench(&options);
+    }
+    return !ok;
+}
@@ -0,0 +1,151 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "sparse.h"
+
+/* (FNV-1a) */
+static unsigned long long hash_bytes(unsigned long long hash, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+    size_t i;
+    for (i = 0; i < len; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+unsigned long long program_fingerprint(RuleTable* rules) {
+    SparseRules* sparse = sparse_rules(rules);
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    int i;
+    hash = hash_bytes(hash, &rules->syms->len, sizeof(int));
+    for (i = 0; i < rules->syms->len; i++)
+        hash = hash_bytes(hash, rules->syms->table[i], strlen(rules->syms->table[i]) + 1);
+    if (!sparse || sparse->len < 0) return hash;
+    hash = hash_bytes(hash, &sparse->len, sizeof(int));
+    hash = hash_bytes(hash, sparse->lhs_start, (sparse->len + 1) * sizeof(int));
+    hash = hash_bytes(hash, sparse->lhs, sparse->lhs_start[sparse->len] * sizeof(int));
+    hash = hash_bytes(hash, sparse->delta_start, (sparse->len + 1) * sizeof(int));
+    hash = hash_bytes(hash, sparse->delta_syms, sparse->delta_start[sparse->len] * sizeof(int));
+    hash = hash_bytes(hash, sparse->deltas, sparse->delta_start[sparse->len] * sizeof(int));
+    if (sparse->transfers)
+        hash = hash_bytes(hash, sparse->transfers, sparse->len * sizeof(int));
+    return hash;
+}
+
+int write_checkpoint_file(char* path, unsigned long long fingerprint, long long steps, int* accumulator, int syms_len) {
+    char tmp_path[4096];
+    CheckpointHeader header;
+    FILE* f;
+    int ok;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmp_path))
+        return 0;
+    if (!(f = fopen(tmp_path, "wb"))) return 0;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version = CHECKPOINT_VERSION;
+    header.syms_len = syms_len;
+    header.fingerprint = fingerprint;
+    header.steps = steps;
+    ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && (int)fwrite(accumulator, sizeof(int), syms_len, f) == syms_len
+        && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp_path, path) == 0) return 1;
+    remove(tmp_path);
+    return 0;
+}
+
+int read_checkpoint_file(char* path, unsigned long long fingerprint, long long* steps, int* accumulator, int syms_len) {
+    CheckpointHeader header;
+    FILE* f;
+    int ok;
+    if (!(f = fopen(path, "rb"))) return 0;
+    ok = fread(&header, sizeof(header), 1, f) == 1
+        && !memcmp(header.magic, CHECKPOINT_MAGIC, 8)
+        && header.version == CHECKPOINT_VERSION
+        && header.syms_len == syms_len
+        && header.fingerprint == fingerprint
+        && (int)fread(accumulator, sizeof(int), syms_len, f) == syms_len;
+    fclose(f);
+    if (!ok) return -1;
+    *steps = header.steps;
+    return 1;
+}
+
+static void* checkpoint_writer(void* arg) {
+    Checkpointer* checkpointer = arg;
+    int b;
+    pthread_mutex_lock(&checkpointer->lock);
+    while (1) {
+        while (checkpointer->pending == -1 && !checkpointer->stop)
+            pthread_cond_wait(&checkpointer->wake, &checkpointer->lock);
+        if (checkpointer->pending == -1) break; /* (stopping, nothing left) */
+        b = checkpointer->writing = checkpointer->pending;
+        checkpointer->pending = -1;
+        pthread_mutex_unlock(&checkpointer->lock);
+        /* the other buffer is the only one checkpoint() touches meanwhile */
+        if (!write_checkpoint_file(checkpointer->path, checkpointer->fingerprint, checkpointer->steps[b], checkpointer->buffers[b], checkpointer->syms_len))
+            checkpointer->failed++;
+        pthread_mutex_lock(&checkpointer->lock);
+        checkpointer->writing = -1;
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+    return NULL;
+}
+
+int start_checkpointer(Checkpointer* checkpointer, char* path, unsigned long long fingerprint, int syms_len) {
+    checkpointer->path = path;
+    checkpointer->fingerprint = fingerprint;
+    checkpointer->syms_len = syms_len;
+    checkpointer->buffers[0] = malloc((syms_len + 1) * sizeof(int));
+    checkpointer->buffers[1] = malloc((syms_len + 1) * sizeof(int));
+    checkpointer->writing = checkpointer->pending = -1;
+    checkpointer->stop = checkpointer->failed = 0;
+    if (checkpointer->buffers[0] && checkpointer->buffers[1]) {
+        pthread_mutex_init(&checkpointer->lock, NULL);
+        pthread_cond_init(&checkpointer->wake, NULL);
+        if (pthread_create(&checkpointer->thread, NULL, checkpoint_writer, checkpointer) == 0)
+            return 1;
+        pthread_mutex_destroy(&checkpointer->lock);
+        pthread_cond_destroy(&checkpointer->wake);
+    }
+    free(checkpointer->buffers[0]);
+    free(checkpointer->buffers[1]);
+    return 0;
+}
+
+void checkpoint(Checkpointer* checkpointer, int* accumulator, long long steps) {
+    int b;
+    pthread_mutex_lock(&checkpointer->lock);
+    b = checkpointer->writing == 0 ? 1 : 0;
+    memcpy(checkpointer->buffers[b], accumulator, checkpointer->syms_len * sizeof(int));
+    checkpointer->steps[b] = steps;
+    checkpointer->pending = b;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->lock);
+}
+
+int stop_checkpointer(Checkpointer* checkpointer) {
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->stop = 1;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->lock);
+    pthread_join(checkpointer->thread, NULL);
+    pthread_mutex_destroy(&checkpointer->lock);
+    pthread_cond_destroy(&checkpointer->wake);
+    free(checkpointer->buffers[0]);
+    free(checkpointer->buffers[1]);
+    return checkpointer->failed;
+}
@@ -0,0 +1,84 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Checkpoints of a running program's bag, so a long run can pick up where it
+ * left off after being killed. Writing one happens on its own thread, so
+ * taking a checkpoint only costs a copy of the accumulator. */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <pthread.h>
+#include "parser.h"
+
+/* (a leading null like an image's, so it's never mistaken for source) */
+#define CHECKPOINT_MAGIC "\0VERACKP"
+#define CHECKPOINT_VERSION 1
+
+/* ----------------------------------------------
+The checkpoint file is this header followed by the accumulator (syms_len
+ints), in native byte order. The fingerprint is of the program (see
+program_fingerprint), so a checkpoint is never resumed into a different one.
+---------------------------------------------- */
+typedef struct CheckpointHeader {
+    char magic[8];
+    int version;
+    int syms_len;
+    unsigned long long fingerprint;
+    long long steps;
+} CheckpointHeader;
+
+/* hash of the program's symbol names and rules */
+unsigned long long program_fingerprint(RuleTable* rules);
+
+/* write a checkpoint to the file at path, by way of a temporary file that's
+ * flushed to disk and renamed into place, so there's always a whole one
+ * there. Returns 0 on failure. */
+int write_checkpoint_file(char* path, unsigned long long fingerprint, long long steps, int* accumulator, int syms_len);
+
+/* read the checkpoint at path into the accumulator (syms_len ints) and steps.
+ * Returns 1 if it was read, 0 if there's no file there, and -1 if there's
+ * one but it's broken or for a different program. */
+int read_checkpoint_file(char* path, unsigned long long fingerprint, long long* steps, int* accumulator, int syms_len);
+
+/* ----------------------------------------------
+A background writer with two buffers: the one being written (writing) and
+the one the next checkpoint gets copied into (pending, once it's waiting to
+be written). A checkpoint taken before the last one is written just replaces
+the waiting copy, so the caller never waits on the disk.
+---------------------------------------------- */
+typedef struct Checkpointer {
+    char* path;
+    unsigned long long fingerprint;
+    int syms_len;
+    int* buffers[2];
+    long long steps[2];
+    int writing; /* buffer being written, -1 if none */
+    int pending; /* buffer waiting to be written, -1 if none */
+    int stop;
+    int failed; /* number of writes that didn't work */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} Checkpointer;
+
+/* start a writer for checkpoints of syms_len symbols to path. Returns 0 if
+ * out of memory (or threads). */
+int start_checkpointer(Checkpointer* checkpointer, char* path, unsigned long long fingerprint, int syms_len);
+
+/* hand a copy of the accumulator to the writer */
+void checkpoint(Checkpointer* checkpointer, int* accumulator, long long steps);
+
+/* finish writing any checkpoint still waiting and stop the writer. Returns
+ * the number of writes that failed. */
+int stop_checkpointer(Checkpointer* checkpointer);
+
+#endif
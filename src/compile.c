@@ -14,87 +14,92 @@ WITH REGARD TO THIS SOFTWARE.
 #include "parser.h"
 #include "interpreter.h"
 #include "variables_pass.h"
+#include "image.h"
 #include "compiler.h"
 
-#define SRC_SZ 32768 /* maximum size of input vera source code */
-#define C_SRC_SZ 32768 
-#define NAM_SZ 32768 /* maximum combined text size of all symbol names? */
-#define SYM_SZ 256  /* maximum number of unique symbols? */
-#define RUL_SZ 128   /* maximum number of rules we can handle */
+static char* c_src;
+static Arena arena; /* everything for the program is allocated from here */
+static SymTable sym_table;
+static RuleTable rule_table;
 
-
-static char c_src[C_SRC_SZ];
-static char src[SRC_SZ];
-static char names[NAM_SZ];
-static char* syms[SYM_SZ];
-static int rules[RUL_SZ * SYM_SZ * 2];
-static int acc[SYM_SZ];
-
-static SymTable sym_table = {
-    .names = names,
-    .table = syms,
-    .len = 0,
-    .max_len = SYM_SZ,
-    .names_len = 0,
-};
-
-static RuleTable rule_table = {
-    .syms = &sym_table,
-    .table = rules,
-    .len = 0,
-    .max_len = RUL_SZ,
-};
-
-static BagOfFacts bag = {
-    .syms = &sym_table,
-    .accumulator = acc,
-};
+static BagOfFacts bag;
 
 
 int main(int argc, char* argv[]) {
     FILE *f;
+    int parsed;
     int a = 1;
 
     int vars_pass = 0; /* --vars */
+    int transfers = 0; /* --transfers */
     int implicit_constants = 1; /* --no-implicit-constants */
 
+    int parse_threads = 1; /* --parse-threads [NUM] */
+    char* image_out = NULL; /* --write-image [FILE] */
     int filename_argv_index = -1; /* if never set, expect stdin */
 
     /* cli arg parsing */
     while (a < argc) {
         if (strcmp(argv[a], "--vars") == 0)
             vars_pass = 1;
+        else if (strcmp(argv[a], "--transfers") == 0)
+            transfers = 1;
         else if (strcmp(argv[a], "--no-implicit-constants") == 0)
             implicit_constants = 0;
+        else if (strcmp(argv[a], "--parse-threads") == 0) {
+            a++;
+            walk_number(argv[a], &parse_threads);
+        }
+        else if (strcmp(argv[a], "--write-image") == 0) {
+            a++;
+            image_out = argv[a];
+        }
         else
             filename_argv_index = a;
         a++;
     }
 
+    init_tables(&arena, &sym_table, &rule_table);
+
     /* grab source code from correct source */
     if (filename_argv_index > -1) {
         /* open and read in the source file */
         if(!(f = fopen(argv[filename_argv_index], "r")))
             return !printf("Source missing: %s\n", argv[a]);
-        if(!fread(&src, 1, SRC_SZ, f))
+        if (is_image(f)) {
+            if (!(parsed = load_image(f, &rule_table, NULL, 1)))
+                return !printf("Broken image: %s\n", argv[filename_argv_index]);
+        }
+        else if((parsed = parse_file(f, &rule_table, implicit_constants, parse_threads)) == -1)
             return !printf("Source empty: %s\n", argv[a]);
     }
     else {
         /* read source code from stdin */
         /* NOTE: if you aren't piping anything in, you can just enter code and
          * use ctrl+D to term */
-        fread(&src, 1, SRC_SZ, stdin);
+        if (is_image(stdin)) {
+            if (!(parsed = load_image(stdin, &rule_table, NULL, 1)))
+                return !printf("Broken image\n");
+        }
+        else
+            parsed = parse_stream(stdin, &rule_table, implicit_constants);
     }
 
-    if(parse(src, &rule_table, implicit_constants)) {
+    if(parsed) {
         if (vars_pass)
-            run_variables_pass(&rule_table, 0);
+            run_variables_pass(&rule_table, 0, transfers);
+        if (image_out && !write_image_file(image_out, &rule_table, 0))
+            return !printf("Couldn't write image: %s\n", image_out);
+        init_bag(&bag, &sym_table, &arena);
         populate_facts(&bag, &rule_table);
-        compile_to_c(&rule_table, &bag, &c_src[0]);
+        if (!(c_src = arena_alloc(&arena, compile_to_c_size(&rule_table))))
+            return !printf("Out of memory\n");
+        compile_to_c(&rule_table, &bag, c_src);
         puts(c_src);
     }
     else {
         return 1;
     }
+    arena_free(&arena);
     return 0;
 }
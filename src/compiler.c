@@ -11,6 +11,8 @@ WITH REGARD TO THIS SOFTWARE.
 
 #include "compiler.h"
 #include <stdio.h>
+#include <string.h>
+#include "sparse.h"
 
 static char* add_string(char* str, char* cursor) {
     while (*str) {
@@ -43,6 +45,12 @@ static char* add_clean_var_str(char* str, char* cursor) {
             *cursor = 'o';
             str++;
         }
+        /* '=' into 'eq' */
+        else if (*str == '=') {
+            *cursor = 'e';
+            cursor++;
+            *cursor = 'q';
+        }
         /* '#' into '__', at least until we add dead code pass */
         else if (*str == '#') {
             *cursor = '_';
@@ -65,6 +73,35 @@ static char* add_num_to_str(int num, char* cursor) {
     return cursor;
 }
 
+/* upper bound on the number of characters (including the null term)
+ * compile_to_c will write for the passed rules, to size src_out with */
+int compile_to_c_size(RuleTable* rules) {
+    /* a cleaned var name is at most twice as long as the symbol, plus a
+     * prefix, and numbers are at most 11 characters. Each line that mentions
+     * a symbol gets a generous 48 characters for the rest of the line. */
+    int size = 512; /* MIN define, eval, debug and main functions */
+    RuleEntry* entry;
+    int i, j, k;
+    int* var_len = arena_alloc(rules->syms->arena, rules->syms->len * sizeof(int));
+    if (!var_len) return 0;
+    for (j = 0; j < rules->syms->len; j++) {
+        var_len[j] = strlen(rules->syms->table[j]) * 2 + 3;
+        size += 2 * (var_len[j] + 48); /* static int definition and printout */
+    }
+    for (i = 0; i < rules->len; i++) {
+        size += 64; /* if/else, return and closing brace */
+        for (k = rules->starts[i]; k < rules->starts[i + 1]; k++) {
+            entry = &rules->entries[k];
+            /* LHS shows up in the condition, executions MIN, and -= */
+            if (entry->lhs)
+                size += 3 * (var_len[entry->sym] + 48);
+            if (entry->rhs)
+                size += var_len[entry->sym] + 48;
+        }
+    }
+    return size;
+}
+
 /* use bag just so we know what to default assign to vars in their definitions */
 void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out) {
     char* cursor = src_out;
@@ -107,11 +144,13 @@ void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out) {
 
         /* && all the lhs vars */
         /* (first find all lhs symbols) */
-        int lhs_symbol_indices[rules->syms->len]; /* can't have more than every symbol in the lhs of a rule :D */
+        RuleEntry* entries = &rules->entries[rules->starts[i]];
+        int entries_len = rules->starts[i + 1] - rules->starts[i];
+        int lhs_symbol_indices[entries_len + 1]; /* can't have more than every symbol in the rule :D */
         int distinct_lhs_symbol_count = 0; /* we need this to determine num nested MIN calls */
-        for (j = 0; j < rules->syms->len; j++) {
-            if (rules->table[i * rules->syms->max_len * 2 + j]) {
-                lhs_symbol_indices[distinct_lhs_symbol_count] = j;
+        for (j = 0; j < entries_len; j++) {
+            if (entries[j].lhs) {
+                lhs_symbol_indices[distinct_lhs_symbol_count] = entries[j].sym;
                 distinct_lhs_symbol_count++;
             }
         }
@@ -131,22 +170,37 @@ void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out) {
         }
         cursor = add_string(") {\n", cursor);
 
+        /* a native transfer's executions only depend on the symbols it
+         * changes, leave out the ones it puts back (RHS count of 1) */
+        int limit_symbol_indices[entries_len + 1];
+        int limit_count = 0;
+        for (k = 0; k < distinct_lhs_symbol_count; k++) {
+            if (rules->transfers && rules->transfers[i]
+                    && rule_entry(rules, i, lhs_symbol_indices[k])->rhs == 1)
+                continue;
+            limit_symbol_indices[limit_count] = lhs_symbol_indices[k];
+            limit_count++;
+        }
+
         /* compute number of executions via nested MIN */
         cursor = add_string("\t\texecutions = ", cursor);
-        if (distinct_lhs_symbol_count == 1) {
-            cursor = add_clean_var_str(rules->syms->table[lhs_symbol_indices[0]], cursor);
+        if (limit_count == 0) {
+            cursor = add_string("1", cursor);
+        }
+        else if (limit_count == 1) {
+            cursor = add_clean_var_str(rules->syms->table[limit_symbol_indices[0]], cursor);
         }
         else {
             /* one less MIN( than there are conditions */
-            for (k = 0; k < distinct_lhs_symbol_count - 1; k++) {
+            for (k = 0; k < limit_count - 1; k++) {
                 cursor = add_string("MIN(", cursor);
             }
             /* now add first condition symbol */
-            cursor = add_clean_var_str(rules->syms->table[lhs_symbol_indices[0]], cursor);
+            cursor = add_clean_var_str(rules->syms->table[limit_symbol_indices[0]], cursor);
             /* then iterate through the rest adding ", symbol)" */
-            for (k = 1; k < distinct_lhs_symbol_count; k++) {
+            for (k = 1; k < limit_count; k++) {
                 cursor = add_string(", ", cursor);
-                cursor = add_clean_var_str(rules->syms->table[lhs_symbol_indices[k]], cursor);
+                cursor = add_clean_var_str(rules->syms->table[limit_symbol_indices[k]], cursor);
                 cursor = add_string(")", cursor);
             }
         }
@@ -160,15 +214,15 @@ void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out) {
         }
 
         /* for each rhs var, add executions */
-        for (j = 0; j < rules->syms->len; j++) {
-            if (rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len]) {
+        for (j = 0; j < entries_len; j++) {
+            if (entries[j].rhs) {
                 cursor = add_string("\t\t", cursor);
-                cursor = add_clean_var_str(rules->syms->table[j], cursor);
+                cursor = add_clean_var_str(rules->syms->table[entries[j].sym], cursor);
                 cursor = add_string(" += executions", cursor);
                 /* handle multiplicity for a symbol on RHS */
-                if (rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len] > 1) {
+                if (entries[j].rhs > 1) {
                     cursor = add_string(" * ", cursor);
-                    cursor = add_num_to_str(rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len], cursor);
+                    cursor = add_num_to_str(entries[j].rhs, cursor);
                 }
                 cursor = add_string(";\n", cursor);
             }
@@ -212,3 +266,84 @@ void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out) {
     
     cursor = add_string("\n#endif\n", cursor);
 }
+
+int compile_to_c_jit_size(RuleTable* rules) {
+    SparseRules* sparse = sparse_rules(rules);
+    /* an accumulator slot a[N] is at most 13 characters, every one of them
+     * gets 32 for the rest of its condition, MIN or line */
+    int size = 512; /* MIN define, symbol count, eval */
+    int i;
+    if (!sparse) return 0;
+    for (i = 0; i < sparse->len; i++) {
+        size += 64; /* if, executions, return and closing brace */
+        size += 2 * 48 * (sparse->lhs_start[i + 1] - sparse->lhs_start[i]);
+        size += 48 * (sparse->delta_start[i + 1] - sparse->delta_start[i]);
+    }
+    return size;
+}
+
+static char* add_slot(int symbol, char* cursor) {
+    cursor = add_string("a[", cursor);
+    cursor = add_num_to_str(symbol, cursor);
+    return add_string("]", cursor);
+}
+
+/* generated from the sparse rules (the way step runs them) rather than the
+ * rule entries, so rules are numbered the same and facts are skipped */
+void compile_to_c_jit(RuleTable* rules, char* src_out) {
+    SparseRules* sparse = sparse_rules(rules);
+    char* cursor = src_out;
+    int i, k, limits;
+
+    cursor = add_string("#define MIN(x, y) (((x) < (y)) ? (x) : (y))\n\n", cursor);
+    cursor = add_string("int jit_symbols = ", cursor);
+    cursor = add_num_to_str(rules->syms->len, cursor);
+    cursor = add_string(";\n\nint jit_step(int* a) {\n\tint executions;\n", cursor);
+
+    for (i = 0; i < sparse->len; i++) {
+        if (sparse->lhs_start[i] == sparse->lhs_start[i + 1]) continue;
+        /* every LHS symbol has to be there, and executions (the least of
+         * the ones that limit it, or 1 for a transfer that puts them all
+         * back) has to come out positive, which it only doesn't once a count
+         * has overflowed */
+        cursor = add_string("\tif (", cursor);
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++) {
+            cursor = add_slot(sparse->lhs[k], cursor);
+            cursor = add_string(" && ", cursor);
+        }
+        cursor = add_string("(executions = ", cursor);
+        limits = 0;
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            if (limits_executions(sparse, i, k) && limits++)
+                cursor = add_string("MIN(", cursor);
+        if (!limits) cursor = add_string("1", cursor);
+        for (k = sparse->lhs_start[i], limits = 0; k < sparse->lhs_start[i + 1]; k++) {
+            if (!limits_executions(sparse, i, k)) continue;
+            if (limits++) cursor = add_string(", ", cursor);
+            cursor = add_slot(sparse->lhs[k], cursor);
+            if (limits > 1) cursor = add_string(")", cursor);
+        }
+        cursor = add_string(") > 0) {\n", cursor);
+
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++) {
+            cursor = add_string("\t\t", cursor);
+            cursor = add_slot(sparse->delta_syms[k], cursor);
+            cursor = add_string(sparse->deltas[k] < 0 ? " -= executions" : " += executions", cursor);
+            if (sparse->deltas[k] != 1 && sparse->deltas[k] != -1) {
+                cursor = add_string(" * ", cursor);
+                cursor = add_num_to_str(sparse->deltas[k] < 0 ? -sparse->deltas[k] : sparse->deltas[k], cursor);
+            }
+            cursor = add_string(";\n", cursor);
+        }
+        cursor = add_string("\t\treturn ", cursor);
+        cursor = add_num_to_str(i, cursor);
+        cursor = add_string(";\n\t}\n", cursor);
+    }
+    cursor = add_string("\treturn -1;\n}\n", cursor);
+
+    /* (counting the step that finds nothing, like eval) */
+    cursor = add_string("\nint jit_eval(int* a, int max_steps) {\n\tint steps = 0;\n"
+        "\twhile (1) {\n\t\tsteps += 1;\n\t\tif (jit_step(a) == -1) break;\n"
+        "\t\tif (max_steps != -1 && steps >= max_steps) break;\n\t}\n\treturn steps;\n}\n", cursor);
+    *cursor = 0;
+}
@@ -17,6 +17,20 @@ WITH REGARD TO THIS SOFTWARE.
 #include "parser.h"
 #include "interpreter.h"
 
+/* upper bound on the number of characters (including the null term)
+ * compile_to_c will write for the passed rules, to size src_out with */
+int compile_to_c_size(RuleTable* rules);
+
 void compile_to_c(RuleTable* rules, BagOfFacts* bag, char* src_out);
 
+/* upper bound on what compile_to_c_jit writes, same as compile_to_c_size */
+int compile_to_c_jit_size(RuleTable* rules);
+
+/* C for bin/run --jit to build as a shared object: instead of a static int
+ * per symbol, it works on an accumulator passed in, exporting
+ * int jit_step(int* accumulator) and int jit_eval(int* accumulator, int
+ * max_steps), which behave (and number rules and count steps) like step and
+ * eval. jit_symbols is how many symbols the accumulator has. */
+void compile_to_c_jit(RuleTable* rules, char* src_out);
+
 #endif
@@ -0,0 +1,339 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "explore.h"
+#include "interpreter.h"
+#include "sparse.h"
+
+#define CHUNK_SIZE (1 << 20) /* bytes of codes a thread allocates at a time */
+#define MAX_CODE(syms_len) ((size_t)(syms_len) * 10 + 1) /* (two varints per symbol) */
+
+/* (the state hash's finalizer, see statehash.c) */
+static unsigned long long mix(unsigned long long x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static unsigned long long hash_code(unsigned char* code, int len) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    int i;
+    for (i = 0; i < len; i++)
+        hash = (hash ^ code[i]) * 0x100000001b3ULL;
+    return mix(hash);
+}
+
+static unsigned char* put_varint(unsigned char* out, unsigned int value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static unsigned char* get_varint(unsigned char* in, unsigned int* value) {
+    int shift = 0;
+    *value = 0;
+    do {
+        *value |= (unsigned int)(*in & 0x7f) << shift;
+        shift += 7;
+    } while (*in++ & 0x80);
+    return in;
+}
+
+/* a bag's nonzero counts, each as a varint of how many symbols on from the
+ * last one it is, then a (zigzagged, counts can go negative) varint of the
+ * count. Returns the length. */
+static int encode(int* accumulator, int syms_len, unsigned char* out) {
+    unsigned char* start = out;
+    int i, last = -1;
+    for (i = 0; i < syms_len; i++) {
+        if (!accumulator[i]) continue;
+        out = put_varint(out, i - last);
+        out = put_varint(out, ((unsigned int)accumulator[i] << 1) ^ (unsigned int)(accumulator[i] >> 31));
+        last = i;
+    }
+    return out - start;
+}
+
+static void decode(unsigned char* code, int len, int* accumulator, int syms_len) {
+    unsigned char* end = code + len;
+    unsigned int gap, count;
+    int i = -1;
+    memset(accumulator, 0, syms_len * sizeof(int));
+    while (code < end) {
+        code = get_varint(code, &gap);
+        code = get_varint(code, &count);
+        i += gap;
+        accumulator[i] = (int)(count >> 1) ^ -(int)(count & 1);
+    }
+}
+
+/* the state with the passed ID, allocating its block if it's the first of
+ * them (and allocate is set). NULL if out of memory. */
+static ExploreState* state_at(Explorer* explorer, int id, int allocate) {
+    ExploreState* _Atomic* slot = &explorer->blocks[id / EXPLORE_BLOCK];
+    ExploreState* block = atomic_load(slot);
+    ExploreState* expected = NULL;
+    if (!block && allocate) {
+        if (!(block = calloc(EXPLORE_BLOCK, sizeof(ExploreState)))) return NULL;
+        /* (another thread might have got there first) */
+        if (!atomic_compare_exchange_strong(slot, &expected, block)) {
+            free(block);
+            block = expected;
+        }
+    }
+    return block ? &block[id % EXPLORE_BLOCK] : NULL;
+}
+
+/* copy a code into the thread's chunks */
+static unsigned char* keep_code(ExploreThread* thread, unsigned char* code, int len) {
+    unsigned char** chunks;
+    unsigned char* kept;
+    if (thread->chunk_used + len > thread->chunk_size) {
+        if (thread->chunks_len == thread->max_chunks) {
+            thread->max_chunks = thread->max_chunks ? thread->max_chunks * 2 : 16;
+            if (!(chunks = realloc(thread->chunks, thread->max_chunks * sizeof(unsigned char*)))) return NULL;
+            thread->chunks = chunks;
+        }
+        thread->chunk_size = len > CHUNK_SIZE ? len : CHUNK_SIZE;
+        if (!(thread->chunk = malloc(thread->chunk_size))) return NULL;
+        thread->chunks[thread->chunks_len++] = thread->chunk;
+        thread->chunk_used = 0;
+    }
+    kept = thread->chunk + thread->chunk_used;
+    memcpy(kept, code, len);
+    thread->chunk_used += len;
+    return kept;
+}
+
+/* add the state encoded in the thread's buffer if it hasn't been seen
+ * before. Returns 0 if it had (or there's no room for it). */
+static int add_state(Explorer* explorer, ExploreThread* thread, int len, int parent, int port) {
+    unsigned long long hash = hash_code(thread->buffer, len);
+    unsigned long long slot, tag = hash >> 32 << 32;
+    unsigned long long i = hash & explorer->mask;
+    ExploreState* state = NULL;
+    ExploreState* other;
+    int id = -1;
+    while (1) {
+        slot = atomic_load(&explorer->table[i]);
+        if (!slot) {
+            /* claim an ID and fill in the state before anyone can find it */
+            if (!state) {
+                id = atomic_fetch_add(&explorer->next, 1);
+                if (id >= explorer->max_states || !(state = state_at(explorer, id, 1))
+                        || !(state->code = keep_code(thread, thread->buffer, len))) {
+                    if (state) state->parent = -2;
+                    atomic_store(&explorer->full, 1);
+                    return 0;
+                }
+                state->len = len;
+                state->port = port;
+                state->parent = parent;
+            }
+            if (atomic_compare_exchange_strong(&explorer->table[i], &slot, tag | (unsigned int)(id + 1))) {
+                atomic_fetch_add(&explorer->states, 1);
+                return 1;
+            }
+        }
+        /* (slot is whatever's there now, which may be the same state
+         * another thread just added) */
+        if ((slot & ~0xffffffffULL) == tag) {
+            other = state_at(explorer, (int)(slot & 0xffffffffu) - 1, 0);
+            if (other->len == len && !memcmp(other->code, thread->buffer, len)) {
+                if (state) state->parent = -2;
+                return 0;
+            }
+        }
+        i = (i + 1) & explorer->mask;
+    }
+}
+
+static int is_bad(Explorer* explorer, int* accumulator) {
+    int i;
+    for (i = 0; i < explorer->bad_len; i++)
+        if (accumulator[explorer->bad_ids[i]] < explorer->bad_counts[i])
+            return 0;
+    return 1;
+}
+
+/* run the bag until it halts. Returns 1 once it has, 0 if it goes through
+ * a bad bag (and stops there), and -1 if it takes more than max_run steps. */
+static int settle(Explorer* explorer, int* accumulator) {
+    BagOfFacts bag;
+    int steps;
+    bag.syms = explorer->rules->syms;
+    bag.accumulator = accumulator;
+    for (steps = 0; steps <= explorer->max_run; steps++) {
+        if (is_bad(explorer, accumulator)) return 0;
+        if (step(&bag, explorer->rules) == -1) return 1;
+    }
+    return -1;
+}
+
+/* keep the first bad bag found (in this level, so any of them is as few
+ * inputs in as another) */
+static void found_bad(Explorer* explorer, int parent, int port, int* accumulator) {
+    if (atomic_exchange(&explorer->reached, 1)) return;
+    explorer->found = parent;
+    explorer->found_port = port;
+    memcpy(explorer->found_bag, accumulator, explorer->syms_len * sizeof(int));
+}
+
+/* try every input on a state of the current level */
+static void expand_state(void* context, int job, int t) {
+    Explorer* explorer = context;
+    ExploreThread* thread = &explorer->threads[t];
+    int id = explorer->level_start + job;
+    ExploreState* state = state_at(explorer, id, 0);
+    int p, port, settled;
+    if (state->parent == -2 || atomic_load(&explorer->reached)) return;
+    decode(state->code, state->len, thread->accumulator, explorer->syms_len);
+    for (p = 0; p < explorer->ports_len; p++) {
+        port = explorer->ports[p];
+        if (thread->accumulator[port]) continue; /* (the last input's still waiting) */
+        memcpy(thread->work, thread->accumulator, explorer->syms_len * sizeof(int));
+        thread->work[port] = 1;
+        settled = settle(explorer, thread->work);
+        if (settled == 0) {
+            found_bad(explorer, id, port, thread->work);
+            return;
+        }
+        if (settled == -1) {
+            atomic_fetch_add(&explorer->unsettled, 1);
+            continue;
+        }
+        add_state(explorer, thread, encode(thread->work, explorer->syms_len, thread->buffer), id, port);
+    }
+}
+
+int init_explorer(Explorer* explorer, RuleTable* rules, int* bad_ids, int* bad_counts, int bad_len, int max_depth, int max_states, int max_run, int threads) {
+    SparseRules* sparse = sparse_rules(rules);
+    char* is_port;
+    unsigned long long table_len = 2;
+    int i, k, ok;
+    memset(explorer, 0, sizeof(Explorer));
+    if (!sparse || sparse->len < 0) return 0;
+    if (threads < 1) threads = 1;
+    if (max_states < 1) max_states = 1;
+    explorer->rules = rules;
+    explorer->syms_len = rules->syms->len;
+    explorer->bad_ids = bad_ids;
+    explorer->bad_counts = bad_counts;
+    explorer->bad_len = bad_len;
+    explorer->max_depth = max_depth;
+    explorer->max_states = max_states;
+    explorer->max_run = max_run;
+    atomic_init(&explorer->next, 0);
+    atomic_init(&explorer->reached, 0);
+    atomic_init(&explorer->unsettled, 0);
+    atomic_init(&explorer->full, 0);
+    atomic_init(&explorer->states, 0);
+    while (table_len < (unsigned long long)max_states * 2) table_len *= 2;
+    explorer->mask = table_len - 1;
+    explorer->table = calloc(table_len, sizeof(*explorer->table));
+    explorer->blocks = calloc(max_states / EXPLORE_BLOCK + 1, sizeof(*explorer->blocks));
+    explorer->found_bag = malloc((explorer->syms_len + 1) * sizeof(int));
+    explorer->ports = malloc((explorer->syms_len + 1) * sizeof(int));
+    explorer->threads = calloc(threads, sizeof(ExploreThread));
+    is_port = calloc(explorer->syms_len + 1, 1);
+    ok = explorer->table && explorer->blocks && explorer->found_bag && explorer->ports && explorer->threads && is_port;
+
+    /* the inputs are the '>' symbols the rules take */
+    for (i = 0; ok && i < sparse->len; i++)
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            is_port[sparse->lhs[k]] |= rules->syms->table[sparse->lhs[k]][0] == '>';
+    for (i = 0; ok && i < explorer->syms_len; i++)
+        if (is_port[i]) explorer->ports[explorer->ports_len++] = i;
+    free(is_port);
+
+    for (i = 0; ok && i < threads; i++) {
+        explorer->threads[i].accumulator = malloc((explorer->syms_len + 1) * sizeof(int));
+        explorer->threads[i].work = malloc((explorer->syms_len + 1) * sizeof(int));
+        explorer->threads[i].buffer = malloc(MAX_CODE(explorer->syms_len));
+        explorer->threads_len++;
+        ok = explorer->threads[i].accumulator && explorer->threads[i].work && explorer->threads[i].buffer;
+    }
+    ok = ok && (explorer->pool_started = start_job_pool(&explorer->pool, threads, expand_state, explorer));
+    if (!ok) free_explorer(explorer);
+    return ok;
+}
+
+void free_explorer(Explorer* explorer) {
+    int i, k;
+    if (explorer->pool_started) stop_job_pool(&explorer->pool);
+    for (i = 0; explorer->blocks && i <= explorer->max_states / EXPLORE_BLOCK; i++)
+        free(atomic_load(&explorer->blocks[i]));
+    for (i = 0; i < explorer->threads_len; i++) {
+        free(explorer->threads[i].accumulator);
+        free(explorer->threads[i].work);
+        free(explorer->threads[i].buffer);
+        for (k = 0; k < explorer->threads[i].chunks_len; k++)
+            free(explorer->threads[i].chunks[k]);
+        free(explorer->threads[i].chunks);
+    }
+    free(explorer->threads);
+    free((void*)explorer->blocks);
+    free((void*)explorer->table);
+    free(explorer->found_bag);
+    free(explorer->ports);
+    memset(explorer, 0, sizeof(Explorer));
+}
+
+int explore(Explorer* explorer, int* facts) {
+    ExploreThread* thread = &explorer->threads[0];
+    int level_end;
+    memcpy(thread->work, facts, explorer->syms_len * sizeof(int));
+    switch (settle(explorer, thread->work)) {
+    case 0:
+        found_bad(explorer, -1, -1, thread->work);
+        return 1;
+    case -1:
+        atomic_fetch_add(&explorer->unsettled, 1);
+        return 0;
+    }
+    add_state(explorer, thread, encode(thread->work, explorer->syms_len, thread->buffer), -1, -1);
+    while (1) {
+        level_end = atomic_load(&explorer->next);
+        if (level_end > explorer->max_states) level_end = explorer->max_states;
+        if (level_end == explorer->level_start || atomic_load(&explorer->reached)) break;
+        if (explorer->max_depth != -1 && explorer->depth >= explorer->max_depth) break;
+        run_jobs(&explorer->pool, level_end - explorer->level_start);
+        explorer->level_start = level_end;
+        explorer->depth++;
+    }
+    return atomic_load(&explorer->reached);
+}
+
+int explore_trace(Explorer* explorer, int* ports) {
+    ExploreState* state;
+    int len = 0;
+    int i, swap;
+    int id = explorer->found;
+    if (explorer->found_port != -1)
+        ports[len++] = explorer->found_port;
+    while (id != -1) {
+        state = state_at(explorer, id, 0);
+        if (state->parent != -1) ports[len++] = state->port;
+        id = state->parent;
+    }
+    for (i = 0; i < len / 2; i++) {
+        swap = ports[i];
+        ports[i] = ports[len - 1 - i];
+        ports[len - 1 - i] = swap;
+    }
+    return len;
+}
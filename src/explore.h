@@ -0,0 +1,113 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Searching every way a program's inputs could arrive for one that reaches
+ * a bad bag. Input ports are the symbols starting with '>' that some rule
+ * takes. The program runs with step() until it halts, which is when a host
+ * would look at the ports: any input port that's empty then could be set
+ * (to 1, the way a host answers one), and each choice is run until it halts
+ * again. The halted bags are searched breadth first, a level (one more
+ * input) at a time, on a JobPool, with the bags seen so far kept in a lock
+ * free hash set, so the first bad bag found is after as few inputs as it
+ * can be. Every bag along the way is checked, not just the halted ones. */
+
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include <stdatomic.h>
+#include "parser.h"
+#include "jobs.h"
+
+/* states are allocated this many at a time */
+#define EXPLORE_BLOCK 65536
+
+/* ----------------------------------------------
+A halted bag, encoded as its nonzero counts (see explore.c). parent is the
+state it was reached from by setting port, -1 for the program's own first
+halt, and -2 for a state that turned out to have already been seen (whose ID
+then goes unused).
+---------------------------------------------- */
+typedef struct ExploreState {
+    int parent;
+    int port;
+    int len;
+    unsigned char* code;
+} ExploreState;
+
+/* each thread's scratch space, and the chunks its states' codes live in */
+typedef struct ExploreThread {
+    int* accumulator;
+    int* work;
+    unsigned char* buffer;
+    unsigned char* chunk;
+    size_t chunk_used;
+    size_t chunk_size;
+    unsigned char** chunks;
+    int chunks_len;
+    int max_chunks;
+} ExploreThread;
+
+/* ----------------------------------------------
+bad_ids/bad_counts are a bag (bad_len symbols) that a state is bad if it has
+at least all of. States are numbered in the order they're found, so each
+level is a range of IDs, and table is the hash set of them: each slot is
+the top half of a state's hash above its ID + 1, 0 for an empty slot.
+reached is set once a bad bag is, found is the state it was reached from by
+setting found_port (both -1 if the program gets there before any input),
+and found_bag is the bad bag itself.
+---------------------------------------------- */
+typedef struct Explorer {
+    RuleTable* rules;
+    int syms_len;
+    int* bad_ids;
+    int* bad_counts;
+    int bad_len;
+    int max_depth; /* most inputs to try in a row, -1 for no limit */
+    int max_states;
+    int max_run; /* most steps the program can take between inputs */
+    int* ports;
+    int ports_len;
+    ExploreState* _Atomic* blocks;
+    _Atomic unsigned long long* table;
+    unsigned long long mask;
+    atomic_int next; /* ID for the next new state */
+    atomic_int reached;
+    int found;
+    int found_port;
+    int* found_bag;
+    atomic_int unsettled; /* runs that didn't halt within max_run steps */
+    atomic_int full; /* whether we ran out of states (or memory) */
+    int level_start;
+    int depth; /* inputs deep the search got */
+    atomic_int states; /* states seen */
+    ExploreThread* threads;
+    int threads_len;
+    JobPool pool;
+    int pool_started;
+} Explorer;
+
+/* set up to search from the bag facts (not kept) for one with at least
+ * bad_len symbols' bad_counts, on threads threads. Returns 0 if out of
+ * memory. */
+int init_explorer(Explorer* explorer, RuleTable* rules, int* bad_ids, int* bad_counts, int bad_len, int max_depth, int max_states, int max_run, int threads);
+
+/* free everything init_explorer allocated */
+void free_explorer(Explorer* explorer);
+
+/* search from facts until a bad bag is found or there's nothing new left
+ * within the limits. Returns 1 if one was found. */
+int explore(Explorer* explorer, int* facts);
+
+/* fill ports with the inputs (symbol IDs) that lead to the bad bag, in the
+ * order they're set, returning how many there are (at most depth + 1) */
+int explore_trace(Explorer* explorer, int* ports);
+
+#endif
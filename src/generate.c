@@ -0,0 +1,24 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* write a synthetic vera program to stdout, e.g.
+ * bin/generate --rules 100000 --symbols 500 --vars 4 > big.vera */
+
+#include <stdio.h>
+#include "generator.h"
+
+int main(int argc, char* argv[]) {
+    GeneratorOptions options;
+    default_generator_options(&options);
+    if (!generator_options_from_args(&options, argc, argv))
+        return 1;
+    return !generate_program(stdout, &options);
+}
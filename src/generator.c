@@ -0,0 +1,159 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generator.h"
+
+/* where a program is going, and how much of it has gone there */
+typedef struct Output {
+    FILE* f;
+    size_t written;
+    int failed;
+} Output;
+
+static void emit(Output* out, const char* format, ...) {
+    va_list args;
+    int n;
+    va_start(args, format);
+    n = vfprintf(out->f, format, args);
+    va_end(args);
+    if (n < 0) out->failed = 1;
+    else out->written += n;
+}
+
+void default_generator_options(GeneratorOptions* options) {
+    options->rules = 1000;
+    options->symbols = 100;
+    options->name_length = 12;
+    options->max_count = 3;
+    options->vars = 0;
+    options->fact_percent = 10;
+    options->seed = 1;
+}
+
+int generator_options_from_args(GeneratorOptions* options, int argc, char* argv[]) {
+    int a = 1;
+    while (a + 1 < argc) {
+        if (strcmp(argv[a], "--rules") == 0)
+            options->rules = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--symbols") == 0)
+            options->symbols = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--name-length") == 0)
+            options->name_length = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--max-count") == 0)
+            options->max_count = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--vars") == 0)
+            options->vars = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--facts") == 0)
+            options->fact_percent = atoi(argv[a + 1]);
+        else if (strcmp(argv[a], "--seed") == 0)
+            options->seed = strtoull(argv[a + 1], NULL, 10);
+        else
+            return !printf("Unknown option: %s\n", argv[a]);
+        a += 2;
+    }
+    if (a < argc)
+        return !printf("Missing number for: %s\n", argv[a]);
+    return 1;
+}
+
+/* xorshift64, so programs come out the same everywhere for a given seed */
+static unsigned long long next_random(unsigned long long* state) {
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* random number from 0 up to (not including) n */
+static int random_below(unsigned long long* state, int n) {
+    return n > 0 ? (int)(next_random(state) % (unsigned long long)n) : 0;
+}
+
+/* write symbol id's name: its number, padded out to name_length with letters
+ * (and a space every so often, since real names have them) */
+static void write_name(Output* out, int id, int name_length) {
+    char name[64];
+    int len = snprintf(name, sizeof(name), "s%d", id);
+    int i;
+    if (name_length > (int)sizeof(name) - 1) name_length = sizeof(name) - 1;
+    for (i = len; i < name_length; i++)
+        /* never start or end on a space */
+        name[i] = (i % 7 == 0 && i != name_length - 1) ? ' ' : 'a' + (id * 7 + i * 13) % 26;
+    name[i] = 0;
+    emit(out, "%s", name);
+}
+
+/* write a random symbol with a random multiplicity. With variables, every so
+ * often it's a variable or a movement between two of them instead */
+static void write_symbol(Output* out, GeneratorOptions* options, unsigned long long* state, int id) {
+    int count = 1 + random_below(state, options->max_count);
+    if (id < 0 && options->vars > 0 && random_below(state, 8) == 0) {
+        if (random_below(state, 2))
+            emit(out, "v%d", random_below(state, options->vars));
+        else
+            emit(out, "v%d -> v%d", random_below(state, options->vars), random_below(state, options->vars));
+    }
+    else
+        write_name(out, id < 0 ? random_below(state, options->symbols) : id, options->name_length);
+    if (count > 1)
+        emit(out, ":%d", count);
+}
+
+size_t generate_program(FILE* f, GeneratorOptions* options) {
+    unsigned long long state = options->seed ? options->seed : 1;
+    Output out = {f, 0, 0};
+    int i, j, lhs, rhs;
+    if (options->symbols < 1) options->symbols = 1;
+    if (options->max_count < 1) options->max_count = 1;
+
+    if (options->vars > 0) {
+        emit(&out, "|#| variables");
+        for (i = 0; i < options->vars; i++)
+            emit(&out, ", v%d", i);
+        emit(&out, "\n");
+    }
+    for (i = 0; i < options->rules; i++) {
+        /* the first symbol of each rule goes through every symbol in turn, so
+         * they all get used */
+        if (random_below(&state, 100) < options->fact_percent) {
+            emit(&out, "||");
+            write_symbol(&out, options, &state, i % options->symbols);
+            rhs = random_below(&state, 3);
+            for (j = 0; j < rhs; j++) {
+                emit(&out, ", ");
+                write_symbol(&out, options, &state, -1);
+            }
+            emit(&out, "\n");
+            continue;
+        }
+        emit(&out, "|");
+        write_symbol(&out, options, &state, i % options->symbols);
+        lhs = random_below(&state, 3);
+        for (j = 0; j < lhs; j++) {
+            emit(&out, ", ");
+            write_symbol(&out, options, &state, -1);
+        }
+        emit(&out, "|\n    ");
+        rhs = 1 + random_below(&state, 3);
+        for (j = 0; j < rhs; j++) {
+            if (j) emit(&out, ",\n    ");
+            write_symbol(&out, options, &state, -1);
+        }
+        emit(&out, "\n");
+    }
+    if (fflush(f) != 0 || out.failed) return 0;
+    return out.written;
+}
@@ -0,0 +1,44 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Writes synthetic vera programs of whatever size and shape, for seeing how
+ * the parser and passes scale (see bin/generate and bin/bench-parse). */
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stdio.h>
+
+typedef struct GeneratorOptions {
+    int rules; /* how many rules (including facts) to write */
+    int symbols; /* how many distinct symbols they use (at least 1) */
+    int name_length; /* characters per symbol name, including inner spaces */
+    int max_count; /* multiplicities are picked from 1 up to this */
+    /* how many variables to list in a '|#| variables' annotation (none if 0),
+     * some rules will use them and their 'a -> b' movement symbols */
+    int vars;
+    int fact_percent; /* roughly what percent of the rules are facts */
+    unsigned long long seed; /* the same options and seed give the same program */
+} GeneratorOptions;
+
+/* fill in the defaults: 1000 rules, 100 symbols of 12 characters, counts up
+ * to 3, no variables, 10% facts, seed 1 */
+void default_generator_options(GeneratorOptions* options);
+
+/* set options from command line flags (--rules, --symbols, --name-length,
+ * --max-count, --vars, --facts and --seed, each followed by a number) in
+ * argv[1] onwards. Returns 0 and prints why if there's a bad flag. */
+int generator_options_from_args(GeneratorOptions* options, int argc, char* argv[]);
+
+/* write a program to f, returning the number of bytes written (0 on failure) */
+size_t generate_program(FILE* f, GeneratorOptions* options);
+
+#endif
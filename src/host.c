@@ -0,0 +1,125 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* An example of hosting lots of vera instances in one process with libvera:
+ * the program is parsed once, then every thread runs its share of the
+ * instances (each a bag of its own) against it. Prints the first instance's
+ * final bag and how many others ended up the same.
+ *
+ * With --echo every output port `<x` gets a callback that takes the output
+ * back out and answers it by setting the input `>x` (if there is one). */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vera.h"
+
+static VeraProgram* program;
+static VeraBag** bags;
+static int instances = 1000; /* --instances [NUM] */
+static int threads = 4; /* --threads [NUM] */
+static int max_steps = -1; /* --steps [NUM] */
+static int stepped = 0; /* --step */
+static int echo = 0; /* --echo */
+static int* answers; /* the input that answers each output, -1 if none */
+static atomic_int callbacks;
+
+static void echo_output(VeraBag* bag, int port, int count, void* context) {
+    (void)context;
+    atomic_fetch_add(&callbacks, 1);
+    vera_add(bag, port, -count);
+    if (answers[port] != -1)
+        vera_inject(bag, answers[port], 1);
+}
+
+/* run every threads'th instance starting from the passed one */
+static void* run_instances(void* arg) {
+    int i, s, steps;
+    for (i = (int)(size_t)arg; i < instances; i += threads) {
+        if (!(bags[i] = vera_new_bag(program))) continue;
+        for (s = 0; echo && s < vera_symbols(program); s++)
+            vera_on_output(bags[i], s, echo_output, NULL);
+        if (!stepped) {
+            vera_eval(bags[i], max_steps);
+            continue;
+        }
+        /* (one step at a time, the way a host handling ports would) */
+        for (steps = 0; max_steps == -1 || steps < max_steps; steps++)
+            if (vera_step(bags[i]) == -1) break;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    FILE* f = stdin;
+    pthread_t* workers;
+    char* name;
+    int a, i, s, same = 0;
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--instances") == 0 && a + 1 < argc)
+            instances = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
+            threads = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--steps") == 0 && a + 1 < argc)
+            max_steps = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--step") == 0)
+            stepped = 1;
+        else if (strcmp(argv[a], "--echo") == 0)
+            echo = 1;
+        else if (!(f = fopen(argv[a], "r")))
+            return !printf("Source missing: %s\n", argv[a]);
+    }
+    if (instances < 1) instances = 1;
+    if (threads < 1) threads = 1;
+    if (!(program = vera_parse_file(f, 0)))
+        return 1;
+    bags = calloc(instances, sizeof(VeraBag*));
+    workers = calloc(threads, sizeof(pthread_t));
+    answers = malloc((vera_symbols(program) + 1) * sizeof(int));
+    if (!bags || !workers || !answers) return !printf("Out of memory\n");
+    for (s = 0; s < vera_symbols(program); s++) {
+        answers[s] = -1;
+        if (vera_symbol_name(program, s)[0] == '<' && (name = strdup(vera_symbol_name(program, s)))) {
+            name[0] = '>';
+            answers[s] = vera_symbol(program, name);
+            free(name);
+        }
+    }
+    for (i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, run_instances, (void*)(size_t)i);
+    for (i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    if (!bags[0]) return !printf("Out of memory\n");
+
+    for (s = 0; s < vera_symbols(program); s++) {
+        if (vera_count(bags[0], s) == 1)
+            printf("%s\n", vera_symbol_name(program, s));
+        else if (vera_count(bags[0], s) > 1)
+            printf("%s:%d\n", vera_symbol_name(program, s), vera_count(bags[0], s));
+    }
+    for (i = 0; i < instances; i++) {
+        for (s = 0; bags[i] && s < vera_symbols(program); s++)
+            if (vera_count(bags[i], s) != vera_count(bags[0], s)) break;
+        same += bags[i] && s == vera_symbols(program);
+    }
+    printf("%d of %d instances the same\n", same, instances);
+    if (echo)
+        printf("%d outputs answered\n", atomic_load(&callbacks));
+    for (i = 0; i < instances; i++)
+        vera_free_bag(bags[i]);
+    free(bags);
+    free(workers);
+    free(answers);
+    vera_free_program(program);
+    return 0;
+}
@@ -0,0 +1,322 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "image.h"
+
+/* every section of an image starts on an 8 byte boundary */
+#define PAD8(n) (((size_t)(n) + 7) & ~(size_t)7)
+
+/* size of each int section, in file order */
+static void section_lens(ImageHeader* header, size_t* lens) {
+    lens[0] = header->syms_len; /* name_offsets */
+    lens[1] = header->syms_len; /* hashes */
+    lens[2] = header->buckets_len;
+    lens[3] = header->syms_len; /* facts */
+    lens[4] = (size_t)header->rules_len + 1; /* lhs_start */
+    lens[5] = header->lhs_len; /* lhs */
+    lens[6] = header->lhs_len; /* lhs_counts */
+    lens[7] = (size_t)header->rules_len + 1; /* delta_start */
+    lens[8] = header->delta_len; /* delta_syms */
+    lens[9] = header->delta_len; /* deltas */
+    lens[10] = header->transfers_len;
+}
+#define SECTIONS 11
+
+/* write size bytes and pad them out to the next section */
+static int write_section(FILE* f, void* data, size_t size) {
+    static char zeros[8];
+    if (size && fwrite(data, 1, size, f) != size) return 0;
+    return fwrite(zeros, 1, PAD8(size) - size, f) == PAD8(size) - size;
+}
+
+int is_image(FILE* f) {
+    int c = getc(f);
+    if (c == EOF) return 0;
+    ungetc(c, f);
+    return c == IMAGE_MAGIC[0];
+}
+
+int write_image(FILE* f, RuleTable* rules, unsigned long long source_hash) {
+    SymTable* syms = rules->syms;
+    SparseRules* sparse = sparse_rules(rules);
+    ImageHeader header;
+    int* offsets;
+    int* facts;
+    int i, k, ok;
+    size_t names_size = 0;
+
+    if (!sparse || sparse->len < 0) return 0;
+    offsets = calloc(syms->len + 1, sizeof(int));
+    facts = calloc(syms->len + 1, sizeof(int));
+    if (!offsets || !facts) {
+        free(offsets);
+        free(facts);
+        return 0;
+    }
+    for (i = 0; i < syms->len; i++) {
+        offsets[i] = names_size;
+        names_size += strlen(syms->table[i]) + 1;
+    }
+    /* (same as populate_facts) */
+    for (i = 0; i < sparse->len; i++) {
+        if (sparse->lhs_start[i] != sparse->lhs_start[i + 1]) continue;
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            facts[sparse->delta_syms[k]] += sparse->deltas[k];
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.delim = syms->delim;
+    header.parse_constants = syms->parse_constants;
+    header.syms_len = syms->len;
+    header.buckets_len = syms->buckets_len;
+    header.rules_len = sparse->len;
+    header.lhs_len = sparse->lhs_start[sparse->len];
+    header.delta_len = sparse->delta_start[sparse->len];
+    header.names_size = names_size;
+    header.transfers_len = sparse->transfers ? sparse->len : 0;
+    header.source_hash = source_hash;
+
+    ok = write_section(f, &header, sizeof(header))
+        && write_section(f, offsets, syms->len * sizeof(int))
+        && write_section(f, syms->hashes, syms->len * sizeof(int))
+        && write_section(f, syms->buckets, syms->buckets_len * sizeof(int))
+        && write_section(f, facts, syms->len * sizeof(int))
+        && write_section(f, sparse->lhs_start, (sparse->len + 1) * sizeof(int))
+        && write_section(f, sparse->lhs, header.lhs_len * sizeof(int))
+        && write_section(f, sparse->lhs_counts, header.lhs_len * sizeof(int))
+        && write_section(f, sparse->delta_start, (sparse->len + 1) * sizeof(int))
+        && write_section(f, sparse->delta_syms, header.delta_len * sizeof(int))
+        && write_section(f, sparse->deltas, header.delta_len * sizeof(int))
+        && write_section(f, sparse->transfers, header.transfers_len * sizeof(int));
+    for (i = 0; ok && i < syms->len; i++)
+        ok = fwrite(syms->table[i], 1, strlen(syms->table[i]) + 1, f) > 0;
+    free(offsets);
+    free(facts);
+    return ok && fflush(f) == 0;
+}
+
+int write_image_file(char* path, RuleTable* rules, unsigned long long source_hash) {
+    char tmp_path[4096];
+    FILE* f;
+    int ok;
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmp_path))
+        return 0;
+    if (!(f = fopen(tmp_path, "wb"))) return 0;
+    ok = write_image(f, rules, source_hash);
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp_path, path) == 0) return 1;
+    remove(tmp_path);
+    return 0;
+}
+
+/* read all of a (non mappable) f into the arena */
+static char* read_image(FILE* f, Arena* arena, size_t* size) {
+    size_t max_size = 65536;
+    size_t n;
+    char* image = arena_alloc(arena, max_size);
+    *size = 0;
+    while (image && (n = fread(image + *size, 1, max_size - *size, f)) > 0) {
+        *size += n;
+        if (*size == max_size) {
+            image = arena_grow(arena, image, max_size, max_size * 2);
+            max_size *= 2;
+        }
+    }
+    return image;
+}
+
+/* check that starts (len + 1 of them) go up from 0 to end, and that every
+ * symbol ID in ids (end of them) is in the table */
+static int valid_csr(int* starts, int len, int* ids, int end, int syms_len) {
+    int i;
+    if (starts[0] != 0 || starts[len] != end) return 0;
+    for (i = 0; i < len; i++)
+        if (starts[i + 1] < starts[i]) return 0;
+    for (i = 0; i < end; i++)
+        if (ids[i] < 0 || ids[i] >= syms_len) return 0;
+    return 1;
+}
+
+/* check that every one of len LHS counts is positive, a rule can't need none
+ * (or less) of a symbol */
+static int valid_counts(int* counts, int len) {
+    int i;
+    for (i = 0; i < len; i++)
+        if (counts[i] <= 0) return 0;
+    return 1;
+}
+
+/* check that every one of len flags is 0 or 1 */
+static int valid_flags(int* flags, int len) {
+    int i;
+    for (i = 0; i < len; i++)
+        if (flags[i] != 0 && flags[i] != 1) return 0;
+    return 1;
+}
+
+/* check that the buckets only hold symbol IDs + 1 (or 0), and leave at least
+ * one empty so a lookup always ends */
+static int valid_buckets(int* buckets, int buckets_len, int syms_len) {
+    int i, used = 0;
+    for (i = 0; i < buckets_len; i++) {
+        if (buckets[i] < 0 || buckets[i] > syms_len) return 0;
+        used += buckets[i] != 0;
+    }
+    return used < buckets_len;
+}
+
+int load_image(FILE* f, RuleTable* rules, int** facts, int entries) {
+    SymTable* syms = rules->syms;
+    SparseRules* sparse;
+    ImageHeader* header;
+    struct stat st;
+    char* image = NULL;
+    char* names;
+    char** table;
+    int* sections[SECTIONS];
+    size_t lens[SECTIONS];
+    size_t size = 0, pos;
+    int i;
+
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        image = arena_map_file(syms->arena, fileno(f), size);
+    }
+    if (!image && !(image = read_image(f, syms->arena, &size)))
+        return 0;
+
+    /* make sure everything the header claims is actually there before
+     * trusting any of it */
+    header = (ImageHeader*)image;
+    if (size < sizeof(ImageHeader)
+        || memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != IMAGE_VERSION
+        || header->syms_len < 0 || header->rules_len < 0
+        || header->lhs_len < 0 || header->delta_len < 0
+        || header->names_size < 0
+        || (header->transfers_len != 0 && header->transfers_len != header->rules_len)
+        || header->buckets_len <= header->syms_len
+        || (header->buckets_len & (header->buckets_len - 1)) != 0)
+        return 0;
+    section_lens(header, lens);
+    pos = PAD8(sizeof(ImageHeader));
+    for (i = 0; i < SECTIONS; i++) {
+        sections[i] = (int*)(image + pos);
+        pos += PAD8(lens[i] * sizeof(int));
+    }
+    names = image + pos;
+    if (pos + header->names_size > size
+        || (header->names_size > 0 && names[header->names_size - 1] != 0)
+        || !valid_csr(sections[4], header->rules_len, sections[5], header->lhs_len, header->syms_len)
+        || !valid_counts(sections[6], header->lhs_len)
+        || !valid_csr(sections[7], header->rules_len, sections[8], header->delta_len, header->syms_len)
+        || !valid_flags(sections[10], header->transfers_len)
+        || !valid_buckets(sections[2], header->buckets_len, header->syms_len))
+        return 0;
+    for (i = 0; i < header->syms_len; i++)
+        if (sections[0][i] < 0 || sections[0][i] >= header->names_size)
+            return 0;
+
+    syms->delim = header->delim;
+    syms->parse_constants = header->parse_constants;
+    if (header->syms_len > 0) {
+        /* (an empty table keeps what init_tables gave it, so it can grow) */
+        if (!(table = arena_alloc(syms->arena, header->syms_len * sizeof(char*))))
+            return 0;
+        for (i = 0; i < header->syms_len; i++)
+            table[i] = names + sections[0][i];
+        syms->table = table;
+        syms->hashes = (unsigned int*)sections[1];
+        syms->buckets = sections[2];
+        syms->buckets_len = header->buckets_len;
+        syms->len = syms->max_len = header->syms_len;
+    }
+
+    if (!(sparse = arena_alloc(syms->arena, sizeof(SparseRules))))
+        return 0;
+    sparse->len = header->rules_len;
+    sparse->lhs_start = sections[4];
+    sparse->lhs = sections[5];
+    sparse->lhs_counts = sections[6];
+    sparse->delta_start = sections[7];
+    sparse->delta_syms = sections[8];
+    sparse->deltas = sections[9];
+    sparse->transfers = header->transfers_len ? sections[10] : NULL;
+    rules->sparse = sparse;
+    if (entries) {
+        /* passes change the rule entries, so let the sparse rules be rebuilt
+         * from them like they would be for parsed source */
+        if (!build_rule_entries(rules)) return 0;
+        rules->sparse = NULL;
+    }
+    else {
+        /* nothing can add rules without entries to add them to */
+        rules->entries = NULL;
+        rules->starts = NULL;
+        rules->len = rules->max_len = header->rules_len;
+    }
+    if (facts) *facts = sections[3];
+    return 1;
+}
+
+unsigned long long hash_source(FILE* f) {
+    unsigned long long hash = 14695981039346656037ULL; /* 64 bit FNV-1a */
+    unsigned char buffer[65536];
+    size_t n, i;
+    rewind(f);
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        for (i = 0; i < n; i++) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    rewind(f);
+    return hash;
+}
+
+/* mkdir -p */
+static int make_dirs(char* dir) {
+    char path[4096];
+    char* p;
+    if (strlen(dir) >= sizeof(path)) return 0;
+    strcpy(path, dir);
+    for (p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        mkdir(path, 0755);
+        *p = '/';
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+int image_cache_path(char* path, int path_size, char* dir, unsigned long long key) {
+    return cache_file_path(path, path_size, dir, key, ".img");
+}
+
+int cache_file_path(char* path, int path_size, char* dir, unsigned long long key, char* extension) {
+    char default_dir[4096];
+    char* home;
+    if (!dir) dir = getenv("VERA_CACHE_DIR");
+    if (!dir || !dir[0]) {
+        if (!(home = getenv("HOME"))) return 0;
+        if (snprintf(default_dir, sizeof(default_dir), "%s/.cache/vera", home) >= (int)sizeof(default_dir))
+            return 0;
+        dir = default_dir;
+    }
+    if (!make_dirs(dir)) return 0;
+    return snprintf(path, path_size, "%s/%016llx%s", dir, key, extension) < path_size;
+}
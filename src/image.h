@@ -0,0 +1,91 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* A binary "image" of a parsed program, so tools can hand programs to each
+ * other (and bin/run can cache them) without printing and re-parsing vera
+ * source. Loading an image from a file is just a mapping of it, the symbol
+ * index and sparse rules are used straight out of the mapped pages. */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdio.h>
+#include "parser.h"
+#include "sparse.h"
+
+/* the first byte is a null so an image can never be mistaken for source (the
+ * first character of source is its delimiter) */
+#define IMAGE_MAGIC "\0VERAIMG"
+#define IMAGE_VERSION 2
+
+/* ----------------------------------------------
+The image file is this header, followed by these int arrays (each starting on
+an 8 byte boundary), in native byte order:
+
+name_offsets[syms_len] - where each symbol's name starts in names
+hashes[syms_len]       - SymTable.hashes
+buckets[buckets_len]   - SymTable.buckets
+facts[syms_len]        - the accumulator after populate_facts
+lhs_start[rules_len + 1], lhs[lhs_len], lhs_counts[lhs_len],
+delta_start[rules_len + 1], delta_syms[delta_len], deltas[delta_len],
+transfers[transfers_len]
+                       - the SparseRules arrays
+names[names_size]      - the null terminated symbol names (chars)
+---------------------------------------------- */
+typedef struct ImageHeader {
+    char magic[8];
+    int version;
+    int delim; /* the SymTable options the program was parsed with */
+    int parse_constants;
+    int syms_len;
+    int buckets_len;
+    int rules_len;
+    int lhs_len;
+    int delta_len;
+    int names_size;
+    int transfers_len; /* rules_len if there are native transfers, else 0 */
+    /* hash of the source the image was made from, see hash_source */
+    unsigned long long source_hash;
+} ImageHeader;
+
+/* check if the (just opened, not yet read from) f holds an image rather than
+ * vera source, without consuming anything */
+int is_image(FILE* f);
+
+/* write the rules (and their symbols) to f as an image. Returns 0 on failure */
+int write_image(FILE* f, RuleTable* rules, unsigned long long source_hash);
+
+/* write an image to the file at path, by way of a temporary file that's
+ * renamed into place, so a reader never sees half of one */
+int write_image_file(char* path, RuleTable* rules, unsigned long long source_hash);
+
+/* load an image from f into (initialized, empty) tables, mapping it if f is a
+ * regular file and reading it otherwise. Only the sparse rules are loaded
+ * unless entries is set, anything that uses rules->entries (passes, printing
+ * rules, the compiler) needs them. If facts isn't NULL it's pointed at the image's
+ * initial accumulator (syms_len ints), which can be copied into a bag instead
+ * of calling populate_facts. Returns 0 if f isn't a usable image. */
+int load_image(FILE* f, RuleTable* rules, int** facts, int entries);
+
+/* hash the contents of f (from the start, leaving it rewound), for keying
+ * cached images */
+unsigned long long hash_source(FILE* f);
+
+/* fill path (of path_size) with where the cached image for a source hash goes
+ * in dir (or in $VERA_CACHE_DIR, or ~/.cache/vera if dir is NULL), creating
+ * the directory if needed. Returns 0 if there's nowhere to cache. */
+int image_cache_path(char* path, int path_size, char* dir, unsigned long long key);
+
+/* same as image_cache_path, for any other file cached by key (extension
+ * includes its dot, e.g. ".so") */
+int cache_file_path(char* path, int path_size, char* dir, unsigned long long key, char* extension);
+
+#endif
@@ -10,34 +10,42 @@ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
 WITH REGARD TO THIS SOFTWARE.
 ==================================================================== */
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "interpreter.h"
+#include "matcher.h"
+#include "memo.h"
+#include "partition.h"
+#include "presence.h"
+#include "statehash.h"
+
+/* allocate a zeroed accumulator with room for every symbol the symbols table
+ * can currently hold. */
+void init_bag(BagOfFacts* bag, SymTable* syms, Arena* arena) {
+    bag->syms = syms;
+    bag->accumulator = arena_alloc(arena, syms->max_len * sizeof(int));
+}
 
 /* Find all of the facts in the rules table, rules with no LHS */
 void populate_facts(BagOfFacts* bag, RuleTable* rules) {
-    int i, j;
-    for (i = 0; i < rules->len; i++) {
-        /* if any symbols on this side of the rule are nonzero, it's not a fact. */
-        int empty_lhs = 1;
-        for (j = 0; j < bag->syms->len; j++) {
-            if (rules->table[i * rules->syms->max_len * 2 + j]) { /* found non-zero */
-                empty_lhs = 0;
-                break;
-            }
-        }
-        if (empty_lhs) {
-            /* if this is a fact, add all rhs symbols to the accumulator */
-            /* NOTE: seems like here we do care about multiplicity? */
-            for (j = 0; j < rules->syms->len; j++) {
-                if (rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len])
-                    bag->accumulator[j] += rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len];
-            }
-        }
+    SparseRules* sparse = sparse_rules(rules);
+    int i, k;
+    for (i = 0; i < sparse->len; i++) {
+        /* if there are any symbols on this side of the rule, it's not a fact. */
+        if (sparse->lhs_start[i] != sparse->lhs_start[i + 1]) continue;
+        /* if this is a fact, add all rhs symbols to the accumulator */
+        /* NOTE: seems like here we do care about multiplicity? */
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            bag->accumulator[sparse->delta_syms[k]] += sparse->deltas[k];
     }
 }
 
 
-/* Check if the bag has sufficient facts to trigger on the passed row */
+/* Check if the bag has sufficient facts to trigger on the passed rule */
 /* NOTE: multiplicity of symbols in the condition of a rule doesn't matter? */
 /* returns the number of times this rule could execute */
 /* EXAMPLE:
@@ -45,67 +53,727 @@ void populate_facts(BagOfFacts* bag, RuleTable* rules) {
  * ||y:4  (any rule taking just y could run 4 times)
  * |x,y|z (limited by y, so should end up with z:4 and x:1)
  */
-static int check_rule_against_accumulator(int* rule_row, BagOfFacts* bag) {
-    int i;
+static int check_rule_against_accumulator(SparseRules* sparse, int rule, int* accumulator) {
+    int k;
     /* we check the left hand side of the rule - any rule symbol requirements
      * not in the bag means this rule isn't a match. */
-    /* NOTE: we don't need to use max_len since any space between len/max_len
-     * isn't used by definition */
-    int lhs_sum = 0;
+    /* NOTE: we don't need to look at symbols that aren't in the rule at all,
+     * the sparse layout only lists the ones that are */
     int executions = -1; /* number of times this rule could execute, based on smallest
                            matching quantity within accumulator */
-    for (i = 0; i < bag->syms->len; i++) {
-        if (rule_row[i]) {
-            /* if symbol i is > 0 in rule LHS and 0 in the accumulator, this is
-             * not a match. */
-            if (!bag->accumulator[i])
-                return 0;
-            /* we get a lhs sum because we don't want to match a "fact" here, there
-             * needs to be _some_ condition. */
-            lhs_sum += rule_row[i];
-            /* does this accumulator value limit the number of times we can run? */
-            if (executions == -1 || bag->accumulator[i] < executions)
-                executions = bag->accumulator[i];
-        }
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+        /* if symbol is in rule LHS and 0 in the accumulator, this is
+         * not a match. */
+        if (!accumulator[sparse->lhs[k]])
+            return 0;
+        /* does this accumulator value limit the number of times we can run?
+         * (a native transfer isn't held back by what it puts back) */
+        if (sparse->transfers && !limits_executions(sparse, rule, k))
+            continue;
+        if (executions == -1 || accumulator[sparse->lhs[k]] < executions)
+            executions = accumulator[sparse->lhs[k]];
     }
-    if (lhs_sum == 0) return 0;
+    /* we don't want to match a "fact" here, there needs to be _some_
+     * condition. */
+    if (executions == -1) return sparse->lhs_start[rule] != sparse->lhs_start[rule + 1];
     return executions;
 }
 
 /* Find the next rule and applies it, returns the index of the rule matched or
  * -1 if no matches were found */
 int step(BagOfFacts* bag, RuleTable* rules) {
-    int i, j;
+    SparseRules* sparse = sparse_rules(rules);
+    int i, k;
     int executions; /* BEHOLD THE LORD HIGH EXECUTIONER */
-    for (i = 0; i < rules->len; i++) {
-        executions = check_rule_against_accumulator(&(rules->table[i * rules->syms->max_len * 2]), bag);
+    for (i = 0; i < sparse->len; i++) {
+        executions = check_rule_against_accumulator(sparse, i, bag->accumulator);
         if (executions > 0) {
-            for (j = 0; j < rules->syms->len; j++) {
-                /* Remove LHS facts from the accumulator */
-                if (rules->table[i * rules->syms->max_len * 2 + j])
-                    bag->accumulator[j] -= executions;
-                /* Add any RHS facts to the accumulator */
-                if (rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len])
-                    /* the executions*table because in |x|x:2, we only execute
-                     * once but we add two x's. */
-                    bag->accumulator[j] += executions * rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len];
-            }
+            /* Remove LHS facts from and add RHS facts to the accumulator, the
+             * executions*delta because in |x|x:2, we only execute once but
+             * we add two x's. */
+            for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+                bag->accumulator[sparse->delta_syms[k]] += executions * sparse->deltas[k];
             return i;
         }
     }
     return -1;
 }
 
+/* How many more times in a row the rule that just fired will fire, if its
+ * executions are held at the same number each time by a catalyst: an LHS
+ * symbol the rule puts back (a delta of 0), as in
+ * |a -> b, a| a -> b, b
+ * where a -> b is 1, so a is moved one at a time. Only call this when the
+ * rule is still the first match. Then it stays the first match until it runs
+ * out: a rule before it can only become enabled by one of its symbols going
+ * from 0 to something, and the rule only adds to symbols that are already
+ * nonzero (it just added to them), so the rest of its executions are all the
+ * same and can be done in one go. Returns 0 if there's no catalyst holding
+ * the executions down (e.g. |x, y| y, z where they shrink), or if the rule
+ * would never run out, otherwise the number of repeats (up to limit, unless
+ * that's -1) and their executions. */
+static int catalyst_repeats(SparseRules* sparse, int rule, int* accumulator, int limit, int* executions) {
+    int repeats = limit;
+    int catalyst = 0;
+    int k, d, count, delta;
+    /* (a native transfer has already done all it can) */
+    if (sparse->transfers && sparse->transfers[rule]) return 0;
+    *executions = check_rule_against_accumulator(sparse, rule, accumulator);
+    if (*executions <= 0) return 0;
+    /* the LHS symbols and the delta symbols are both in order, so walk them
+     * together to get each LHS symbol's delta */
+    d = sparse->delta_start[rule];
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+        while (d < sparse->delta_start[rule + 1] && sparse->delta_syms[d] < sparse->lhs[k]) d++;
+        delta = d < sparse->delta_start[rule + 1] && sparse->delta_syms[d] == sparse->lhs[k] ? sparse->deltas[d] : 0;
+        count = accumulator[sparse->lhs[k]];
+        if (delta == 0 && count == *executions)
+            catalyst = 1;
+        /* (an LHS symbol's delta is at least -1, so this is all that runs out,
+         * and it only limits the executions once it's down under them) */
+        else if (delta < 0 && (repeats == -1 || count / *executions < repeats))
+            repeats = count / *executions;
+    }
+    if (!catalyst || repeats == -1) return 0;
+    /* anything the rule adds to has to already be there */
+    for (d = sparse->delta_start[rule]; d < sparse->delta_start[rule + 1]; d++)
+        if (sparse->deltas[d] > 0 && accumulator[sparse->delta_syms[d]] <= 0)
+            return 0;
+    return repeats;
+}
+
+/* make the hook's call (it's due), returning the step the next one's due */
+static int call_hook(EvalHook* hook, int steps) {
+    hook->call(hook, steps);
+    return steps + hook->every;
+}
+
 /* Pass max_steps of -1 to run until halt (no more rules matched). Returns the
  * number of steps taken. */
 /* TODO: it would be neat to count number of times each rule is matched, could
  * allow visualizing a sort of heatmap */
 int eval(BagOfFacts* bag, RuleTable* rules, int max_steps) {
+    return hooked_eval(bag, rules, max_steps, NULL);
+}
+
+int hooked_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook) {
+    Matcher matcher;
+    int steps = 0;
+    int hook_due = hook ? hook->every : 0;
+    int last_rule_match = 0;
+    SparseRules* sparse = sparse_rules(rules);
+    int repeats, executions, k;
+    /* steps only look at the rules the last one affected with a matcher,
+     * without one (out of memory) every step looks at every rule */
+    int incremental = init_matcher(&matcher, rules, bag->accumulator);
+    while (last_rule_match != -1) {
+        steps += 1;
+        last_rule_match = incremental ? matcher_step(&matcher) : step(bag, rules);
+        if (max_steps != -1 && steps >= max_steps) break;
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+        /* a catalyst loop runs all of its steps at once */
+        if (!incremental || last_rule_match == -1 || matcher_first(&matcher) != last_rule_match) continue;
+        repeats = catalyst_repeats(sparse, last_rule_match, bag->accumulator, max_steps == -1 ? -1 : max_steps - steps, &executions);
+        for (k = sparse->delta_start[last_rule_match]; repeats && k < sparse->delta_start[last_rule_match + 1]; k++)
+            matcher_add(&matcher, sparse->delta_syms[k], repeats * executions * sparse->deltas[k]);
+        steps += repeats;
+        if (max_steps != -1 && steps >= max_steps) break;
+    }
+    if (incremental) free_matcher(&matcher);
+    return steps;
+}
+
+/* Same as eval, but each step fires every rule that can go at once (see
+ * matcher_step_all) */
+int parallel_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook) {
+    Matcher matcher;
+    int steps = 0;
+    int hook_due = hook ? hook->every : 0;
+    int fired = 1;
+    /* (without memory for a matcher, at least still run the program) */
+    if (!init_matcher(&matcher, rules, bag->accumulator))
+        return hooked_eval(bag, rules, max_steps, hook);
+    while (fired) {
+        steps += 1;
+        fired = matcher_step_all(&matcher);
+        if (max_steps != -1 && steps >= max_steps) break;
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+    }
+    free_matcher(&matcher);
+    return steps;
+}
+
+/* Same as eval, but finding matches with presence bits */
+int presence_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook) {
+    Presence presence;
+    SparseRules* sparse = sparse_rules(rules);
+    int steps = 0;
+    int hook_due = hook ? hook->every : 0;
+    int last_rule_match = 0;
+    int repeats, executions, k;
+    if (!init_presence(&presence, rules, bag->accumulator))
+        return hooked_eval(bag, rules, max_steps, hook);
+    while (last_rule_match != -1) {
+        steps += 1;
+        last_rule_match = presence_step(&presence);
+        if (max_steps != -1 && steps >= max_steps) break;
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+        if (last_rule_match == -1 || presence_first(&presence) != last_rule_match) continue;
+        repeats = catalyst_repeats(sparse, last_rule_match, bag->accumulator, max_steps == -1 ? -1 : max_steps - steps, &executions);
+        for (k = sparse->delta_start[last_rule_match]; repeats && k < sparse->delta_start[last_rule_match + 1]; k++)
+            presence_add(&presence, sparse->delta_syms[k], repeats * executions * sparse->deltas[k]);
+        steps += repeats;
+        if (max_steps != -1 && steps >= max_steps) break;
+    }
+    free_presence(&presence);
+    return steps;
+}
+
+/* ----------------------------------------------
+A first-match search split over threads: each thread looks for the first
+enabled rule in its own contiguous range of rules (a range ahead of it in
+priority never has to wait on one behind it), and the lowest one found wins,
+so it's exactly the rule step() would find. The worker threads stay up
+between steps, spinning on the generation counter rather than taking a lock,
+so a step only costs the search. A worker that's spun for a while without a
+new search parks on a condition variable instead (e.g. while the caller
+prints out each step), so an idle pool doesn't keep its CPUs busy.
+---------------------------------------------- */
+struct MatchPool {
+    SparseRules* sparse;
+    int* accumulator;
+    int ranges;
+    int threads; /* including the calling thread, which searches range 0 */
+    int* range_start; /* ranges + 1 of them */
+    pthread_t* workers;
+    atomic_uint generation; /* bumped to start a search (wrapping around) */
+    atomic_int stopping; /* set to stop the workers */
+    atomic_uint* done; /* the generation each worker last finished */
+    atomic_int best; /* lowest enabled rule found so far this search */
+    pthread_mutex_t lock; /* (only for parking) */
+    pthread_cond_t wake; /* broadcast when there's a new search or stopping */
+    atomic_int parked; /* workers waiting (or about to wait) on wake */
+};
+
+/* how many times to check for a new search (or finished workers) before
+ * giving the CPU up between checks, and how many before a worker parks */
+#define POOL_SPINS 1024
+#define POOL_PARK_SPINS (1 << 16)
+
+/* look for the first enabled rule in range i, giving up as soon as some
+ * other range has found one ahead of where we are */
+static void search_range(MatchPool* pool, int i) {
+    int rule = pool->range_start[i];
+    int best;
+    for (; rule < pool->range_start[i + 1]; rule++) {
+        if (rule >= atomic_load_explicit(&pool->best, memory_order_relaxed)) return;
+        if (check_rule_against_accumulator(pool->sparse, rule, pool->accumulator) > 0) break;
+    }
+    if (rule == pool->range_start[i + 1]) return;
+    /* (atomic min) */
+    best = atomic_load(&pool->best);
+    while (rule < best && !atomic_compare_exchange_weak(&pool->best, &best, rule));
+}
+
+/* spin (then yield, then park) until the generation isn't seen, returning the new one
+ * in generation, or 0 if the pool is stopping instead */
+static int wait_generation(MatchPool* pool, unsigned int* generation) {
+    unsigned int seen = *generation;
+    int spins = 0;
+    while ((*generation = atomic_load_explicit(&pool->generation, memory_order_acquire)) == seen) {
+        if (atomic_load_explicit(&pool->stopping, memory_order_acquire)) return 0;
+        if (++spins <= POOL_SPINS) continue;
+        if (spins <= POOL_PARK_SPINS) {
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        /* (counted before the generation is looked at again, so a search
+         * started after that look always sees it and wakes us, see
+         * pool_first) */
+        atomic_fetch_add(&pool->parked, 1);
+        while (atomic_load(&pool->generation) == seen && !atomic_load(&pool->stopping))
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        atomic_fetch_sub(&pool->parked, 1);
+        pthread_mutex_unlock(&pool->lock);
+        spins = 0;
+    }
+    return 1;
+}
+
+/* wake any parked workers, after a new generation or stopping was stored */
+static void wake_workers(MatchPool* pool) {
+    if (!atomic_load(&pool->parked)) return;
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* match_worker(void* arg) {
+    MatchPool* pool = ((void**)arg)[0];
+    int i = (int)(size_t)((void**)arg)[1];
+    unsigned int generation = 0;
+    free(arg);
+    while (wait_generation(pool, &generation)) {
+        search_range(pool, i);
+        atomic_store_explicit(&pool->done[i], generation, memory_order_release);
+    }
+    return NULL;
+}
+
+MatchPool* start_match_pool(RuleTable* rules, int* accumulator, int threads) {
+    SparseRules* sparse = sparse_rules(rules);
+    MatchPool* pool;
+    void** arg;
+    int i, k;
+    if (!sparse || sparse->len < 0 || threads < 1) return NULL;
+    /* (no point in ranges of only a few rules) */
+    if (threads > sparse->len / 64 + 1) threads = sparse->len / 64 + 1;
+    if (!(pool = calloc(1, sizeof(MatchPool)))) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    atomic_init(&pool->parked, 0);
+    pool->sparse = sparse;
+    pool->accumulator = accumulator;
+    pool->range_start = malloc((threads + 1) * sizeof(int));
+    pool->workers = calloc(threads, sizeof(pthread_t));
+    pool->done = calloc(threads, sizeof(atomic_uint));
+    if (!pool->range_start || !pool->workers || !pool->done) {
+        stop_match_pool(pool);
+        return NULL;
+    }
+    /* split by LHS symbols rather than rules, since that's the work */
+    pool->range_start[0] = 0;
+    for (i = 1, k = 0; i < threads; i++) {
+        while (k < sparse->len && sparse->lhs_start[k] < (long long)sparse->lhs_start[sparse->len] * i / threads) k++;
+        pool->range_start[i] = k;
+    }
+    pool->range_start[threads] = sparse->len;
+    pool->ranges = threads;
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->stopping, 0);
+    for (pool->threads = 1; pool->threads < threads; pool->threads++) {
+        if (!(arg = malloc(2 * sizeof(void*)))) break;
+        arg[0] = pool;
+        arg[1] = (void*)(size_t)pool->threads;
+        atomic_init(&pool->done[pool->threads], 0);
+        if (pthread_create(&pool->workers[pool->threads], NULL, match_worker, arg) != 0) {
+            free(arg);
+            break;
+        }
+    }
+    /* (if not every thread started, the caller searches the ranges that
+     * would have been theirs, see pool_first) */
+    return pool;
+}
+
+void stop_match_pool(MatchPool* pool) {
+    int i;
+    if (!pool) return;
+    atomic_store(&pool->stopping, 1);
+    wake_workers(pool);
+    for (i = 1; i < pool->threads; i++)
+        pthread_join(pool->workers[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->range_start);
+    free(pool->workers);
+    free(pool->done);
+    free(pool);
+}
+
+/* index of the first enabled rule, -1 if there aren't any */
+static int pool_first(MatchPool* pool) {
+    unsigned int generation = atomic_load(&pool->generation) + 1;
+    int i, best, spins;
+    atomic_store(&pool->best, pool->sparse->len);
+    /* (sequentially consistent, so either a parking worker sees the new
+     * generation or wake_workers sees it parked) */
+    atomic_store(&pool->generation, generation);
+    wake_workers(pool);
+    search_range(pool, 0);
+    /* (and any ranges whose threads couldn't be started) */
+    for (i = pool->threads; i < pool->ranges; i++)
+        search_range(pool, i);
+    /* every worker has to be finished before the accumulator changes, the
+     * ones behind the best rule so far stop almost straight away */
+    for (i = 1; i < pool->threads; i++)
+        for (spins = 0; atomic_load_explicit(&pool->done[i], memory_order_acquire) != generation;)
+            if (++spins > POOL_SPINS) sched_yield();
+    best = atomic_load(&pool->best);
+    return best < pool->sparse->len ? best : -1;
+}
+
+/* add times the rule's deltas to the accumulator */
+static void pool_apply(MatchPool* pool, int rule, int times) {
+    SparseRules* sparse = pool->sparse;
+    int k;
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++)
+        pool->accumulator[sparse->delta_syms[k]] += times * sparse->deltas[k];
+}
+
+int pool_step(MatchPool* pool) {
+    int rule = pool_first(pool);
+    if (rule == -1) return -1;
+    pool_apply(pool, rule, check_rule_against_accumulator(pool->sparse, rule, pool->accumulator));
+    return rule;
+}
+
+/* Same as eval, but with the first-match search done by a MatchPool */
+int threaded_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, int threads, EvalHook* hook) {
+    MatchPool* pool = start_match_pool(rules, bag->accumulator, threads);
+    int steps = 0;
+    int hook_due = hook ? hook->every : 0;
+    int rule, next, repeats, executions;
+    if (!pool) return hooked_eval(bag, rules, max_steps, hook);
+    rule = pool_first(pool);
+    while (1) {
+        steps += 1;
+        if (rule == -1) break;
+        pool_apply(pool, rule, check_rule_against_accumulator(pool->sparse, rule, bag->accumulator));
+        if (max_steps != -1 && steps >= max_steps) break;
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+        next = pool_first(pool);
+        /* a catalyst loop runs all of its steps at once, as in eval */
+        if (next == rule && (repeats = catalyst_repeats(pool->sparse, rule, bag->accumulator, max_steps == -1 ? -1 : max_steps - steps, &executions))) {
+            pool_apply(pool, rule, repeats * executions);
+            steps += repeats;
+            if (max_steps != -1 && steps >= max_steps) break;
+            next = pool_first(pool);
+        }
+        rule = next;
+    }
+    stop_match_pool(pool);
+    return steps;
+}
+
+/* the partitions and how far through them the threads are. Each one goes
+ * back into the bag as soon as it's finished (under lock, along with the
+ * hook's call), steps counts the rules fired by the finished ones */
+typedef struct PartitionRun {
+    Partitions* partitions;
+    BagOfFacts* bag;
+    EvalHook* hook;
+    pthread_mutex_t lock;
+    atomic_int next;
+    int steps;
+} PartitionRun;
+
+/* eval partitions until there are none left */
+static void* partition_worker(void* arg) {
+    PartitionRun* run = arg;
+    BagOfFacts part_bag;
+    Partition* part;
+    int p, steps;
+    while ((p = atomic_fetch_add(&run->next, 1)) < run->partitions->len) {
+        part = &run->partitions->parts[p];
+        part_bag.syms = &part->syms;
+        part_bag.accumulator = part->accumulator;
+        /* (every partition's eval counts the step that found nothing) */
+        steps = eval(&part_bag, &part->rules, -1) - 1;
+        pthread_mutex_lock(&run->lock);
+        partition_store(part, run->bag->accumulator);
+        run->steps += steps;
+        if (run->hook) run->hook->call(run->hook, run->steps);
+        pthread_mutex_unlock(&run->lock);
+    }
+    return NULL;
+}
+
+/* Same as eval until halt, but each set of rules that shares no symbols with
+ * the rest (see partition.h) runs on its own, on up to the passed number of
+ * threads. */
+int partitioned_eval(BagOfFacts* bag, RuleTable* rules, int threads, EvalHook* hook) {
+    Partitions partitions;
+    PartitionRun run;
+    pthread_t* workers;
+    int started = 0;
+    int p;
+    if (!init_partitions(&partitions, rules)) return hooked_eval(bag, rules, -1, hook);
+    if (partitions.len < 2) {
+        free_partitions(&partitions);
+        return hooked_eval(bag, rules, -1, hook);
+    }
+    for (p = 0; p < partitions.len; p++)
+        partition_load(&partitions.parts[p], bag->accumulator);
+    run.partitions = &partitions;
+    run.bag = bag;
+    run.hook = hook;
+    run.steps = 0;
+    pthread_mutex_init(&run.lock, NULL);
+    atomic_init(&run.next, 0);
+    if (threads > partitions.len) threads = partitions.len;
+    /* (the calling thread is one of them) */
+    if ((workers = malloc((threads + 1) * sizeof(pthread_t))))
+        for (; started < threads - 1; started++)
+            if (pthread_create(&workers[started], NULL, partition_worker, &run) != 0) break;
+    partition_worker(&run);
+    for (p = 0; p < started; p++)
+        pthread_join(workers[p], NULL);
+    free(workers);
+    pthread_mutex_destroy(&run.lock);
+    free_partitions(&partitions);
+    /* (eval counts the one step that found nothing) */
+    return run.steps + 1;
+}
+
+/* how many recent states cycle_eval remembers */
+#define CYCLE_SLOTS (1 << 16)
+
+/* same as matcher_step, keeping the hash of the bag up to date */
+static int hashed_step(Matcher* matcher, StateTable* table, unsigned long long* hash) {
+    SparseRules* sparse = matcher->sparse;
+    int rule = matcher_first(matcher);
+    int executions, k, delta;
+    if (rule == -1) return -1;
+    executions = check_rule_against_accumulator(sparse, rule, matcher->accumulator);
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++) {
+        delta = executions * sparse->deltas[k];
+        matcher_add(matcher, sparse->delta_syms[k], delta);
+        *hash += STATE_HASH_DELTA(table, sparse->delta_syms[k], delta);
+    }
+    return rule;
+}
+
+/* Rerun from the initial bag to check a suspected cycle: find the first step
+ * (up to limit) after which the bag is exactly the same as period steps later,
+ * and narrow period down to the cycle's length (it can be a multiple of it).
+ * Returns -1 if there's no such step, i.e. two states' hashes matched by
+ * chance (or out of memory). */
+static int cycle_entry(RuleTable* rules, int* initial, StateTable* table, int limit, int* period) {
+    int len = rules->syms->len;
+    size_t size = (len + 1) * sizeof(int);
+    int* ahead = malloc(size);
+    int* behind = malloc(size);
+    Matcher ahead_matcher, behind_matcher;
+    unsigned long long ahead_hash, behind_hash;
+    int entry = -1;
+    int i;
+    if (!ahead || !behind) goto no_memory;
+    memcpy(ahead, initial, size);
+    memcpy(behind, initial, size);
+    if (!init_matcher(&ahead_matcher, rules, ahead)) goto no_memory;
+    if (!init_matcher(&behind_matcher, rules, behind)) {
+        free_matcher(&ahead_matcher);
+        goto no_memory;
+    }
+    ahead_hash = behind_hash = state_hash(table, initial, len);
+    for (i = 0; i < *period; i++)
+        if (hashed_step(&ahead_matcher, table, &ahead_hash) == -1) limit = -1; /* (it halts) */
+    for (i = 0; i <= limit; i++) {
+        if (ahead_hash == behind_hash && !memcmp(ahead, behind, len * sizeof(int))) {
+            entry = i;
+            break;
+        }
+        hashed_step(&ahead_matcher, table, &ahead_hash);
+        hashed_step(&behind_matcher, table, &behind_hash);
+    }
+    /* ahead is now one of the cycle's states, go around until it's back */
+    if (entry != -1) {
+        for (i = 1; i < *period; i++) {
+            hashed_step(&ahead_matcher, table, &ahead_hash);
+            if (ahead_hash == behind_hash && !memcmp(ahead, behind, len * sizeof(int))) break;
+        }
+        *period = i;
+    }
+    free_matcher(&ahead_matcher);
+    free_matcher(&behind_matcher);
+no_memory:
+    free(ahead);
+    free(behind);
+    return entry;
+}
+
+/* Same as eval, but watching for the bag coming back to a state it's been in
+ * before (see statehash.h): once it has, the program will go around the same
+ * cycle forever. Without a max_steps it stops there, otherwise it skips over
+ * as many whole cycles as fit in the steps left. The cycle's length and the
+ * step it starts after go in cycle (length 0 if there wasn't one). */
+int cycle_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, Cycle* cycle, EvalHook* hook) {
+    Matcher matcher;
+    StateTable table;
+    int len = rules->syms->len;
+    int* initial = malloc((len + 1) * sizeof(int));
+    unsigned long long hash;
+    int steps = 0;
+    int hook_due = hook ? hook->every : 0;
+    int last_rule_match = 0;
+    int seen, period, entry;
+    cycle->length = cycle->entry = 0;
+    if (!initial || !init_state_table(&table, len, CYCLE_SLOTS)) {
+        free(initial);
+        return hooked_eval(bag, rules, max_steps, hook);
+    }
+    if (!init_matcher(&matcher, rules, bag->accumulator)) {
+        free(initial);
+        free_state_table(&table);
+        return hooked_eval(bag, rules, max_steps, hook);
+    }
+    memcpy(initial, bag->accumulator, len * sizeof(int));
+    hash = state_hash(&table, bag->accumulator, len);
+    state_seen(&table, hash, 0);
+    while (last_rule_match != -1) {
+        steps += 1;
+        last_rule_match = hashed_step(&matcher, &table, &hash);
+        if (max_steps != -1 && steps >= max_steps) break;
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+        if (last_rule_match == -1 || cycle->length) continue;
+        if ((seen = state_seen(&table, hash, steps)) == -1) continue;
+        period = steps - seen;
+        if ((entry = cycle_entry(rules, initial, &table, seen, &period)) == -1) continue;
+        cycle->entry = entry;
+        cycle->length = period;
+        if (max_steps == -1) break;
+        /* the bag is the same after any number of whole cycles */
+        steps += (max_steps - steps) / period * period;
+        if (steps >= max_steps) break;
+    }
+    free_matcher(&matcher);
+    free_state_table(&table);
+    free(initial);
+    return steps;
+}
+
+/* how many runs of the memoized rules memo_eval remembers */
+#define MEMO_ENTRIES 4096
+
+/* Same as eval, but remembering what the first prefix rules do. Whenever one
+ * of them is the first match, they run until none of them are (nothing after
+ * them can go first in the meantime), and how that goes depends only on the
+ * counts of the symbols on their LHSs. So the first time, that run's change to
+ * the symbols they write to and its number of steps go in a Memo under those
+ * counts, and any later run from the same counts is just the one change.
+ * Returns the number of steps, the same as eval, with the memo's hits and
+ * misses in the passed ints. */
+int memo_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, int prefix, int* hits, int* misses, EvalHook* hook) {
+    Matcher matcher;
+    Memo memo;
+    SparseRules* sparse = sparse_rules(rules);
+    int len = rules->syms->len;
+    int* accumulator = bag->accumulator;
+    char* used = calloc(len + 1, 1); /* 1 for inputs, 2 for outputs */
+    int* inputs = malloc((len + 1) * sizeof(int));
+    int* outputs = malloc((len + 1) * sizeof(int));
+    int* key = malloc((len + 1) * sizeof(int));
+    int* change = malloc((len + 1) * sizeof(int));
+    int inputs_len = 0, outputs_len = 0;
+    int steps = 0, taken = 0;
+    int hook_due = hook ? hook->every : 0;
+    int rule, entry, i, k;
+    *hits = *misses = 0;
+    if (max_steps == 0) max_steps = 1; /* (eval always takes the one step) */
+    if (!used || !inputs || !outputs || !key || !change) goto no_memory;
+    if (prefix > sparse->len) prefix = sparse->len;
+    for (i = 0; i < prefix; i++) {
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            used[sparse->lhs[k]] |= 1;
+        /* (facts are never run) */
+        for (k = sparse->delta_start[i]; sparse->lhs_start[i] != sparse->lhs_start[i + 1] && k < sparse->delta_start[i + 1]; k++)
+            used[sparse->delta_syms[k]] |= 2;
+    }
+    for (i = 0; i < len; i++) {
+        if (used[i] & 1) inputs[inputs_len++] = i;
+        if (used[i] & 2) outputs[outputs_len++] = i;
+    }
+    if (!init_memo(&memo, inputs_len, outputs_len, MEMO_ENTRIES)) goto no_memory;
+    if (!init_matcher(&matcher, rules, accumulator)) {
+        free_memo(&memo);
+        goto no_memory;
+    }
+
+    while (max_steps == -1 || steps < max_steps) {
+        if (hook && steps >= hook_due) hook_due = call_hook(hook, steps);
+        rule = matcher_first(&matcher);
+        if (rule == -1 || rule >= prefix) {
+            steps += 1;
+            if (rule == -1) break;
+            matcher_step(&matcher);
+            continue;
+        }
+        for (i = 0; i < inputs_len; i++)
+            key[i] = accumulator[inputs[i]];
+        entry = memo_find(&memo, key);
+        if (entry != -1 && (max_steps == -1 || steps + memo.steps[entry] <= max_steps)) {
+            for (i = 0; i < outputs_len; i++)
+                matcher_add(&matcher, outputs[i], MEMO_VALUE(&memo, entry)[i]);
+            steps += memo.steps[entry];
+            continue;
+        }
+        for (i = 0; i < outputs_len; i++)
+            change[i] = accumulator[outputs[i]];
+        for (taken = 0; (rule = matcher_first(&matcher)) != -1 && rule < prefix; taken++, steps++) {
+            if (max_steps != -1 && steps >= max_steps) break;
+            matcher_step(&matcher);
+        }
+        /* (a run cut short by max_steps isn't a whole one) */
+        if (rule != -1 && rule < prefix) break;
+        for (i = 0; i < outputs_len; i++)
+            change[i] = accumulator[outputs[i]] - change[i];
+        memo_insert(&memo, key, change, taken);
+    }
+    *hits = memo.hits;
+    *misses = memo.misses;
+    free_matcher(&matcher);
+    free_memo(&memo);
+    free(used);
+    free(inputs);
+    free(outputs);
+    free(key);
+    free(change);
+    return steps;
+
+no_memory:
+    free(used);
+    free(inputs);
+    free(outputs);
+    free(key);
+    free(change);
+    return hooked_eval(bag, rules, max_steps, hook);
+}
+
+/* Same as populate_facts, but for a sparse accumulator */
+void populate_sparse_facts(SparseBag* bag, RuleTable* rules) {
+    SparseRules* sparse = sparse_rules(rules);
+    int i, k;
+    for (i = 0; i < sparse->len; i++) {
+        if (sparse->lhs_start[i] != sparse->lhs_start[i + 1]) continue;
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            sparse_bag_add(bag, sparse->delta_syms[k], sparse->deltas[k]);
+    }
+}
+
+/* Same as step, but for a sparse accumulator */
+int sparse_step(SparseBag* bag, RuleTable* rules) {
+    SparseRules* sparse = sparse_rules(rules);
+    int i, k, count;
+    int executions;
+    for (i = 0; i < sparse->len; i++) {
+        executions = -1;
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++) {
+            count = sparse_bag_count(bag, sparse->lhs[k]);
+            if (!count) break;
+            if (sparse->transfers && !limits_executions(sparse, i, k))
+                continue;
+            if (executions == -1 || count < executions)
+                executions = count;
+        }
+        /* didn't make it through the LHS (or there wasn't one) */
+        if (k < sparse->lhs_start[i + 1] || sparse->lhs_start[i] == k) continue;
+        if (executions == -1) executions = 1; /* (nothing limited it) */
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            sparse_bag_add(bag, sparse->delta_syms[k], executions * sparse->deltas[k]);
+        return i;
+    }
+    return -1;
+}
+
+/* Same as eval, but for a sparse accumulator */
+int sparse_eval(SparseBag* bag, RuleTable* rules, int max_steps) {
     int steps = 0;
     int last_rule_match = 0;
     while (last_rule_match != -1) {
         steps += 1;
-        last_rule_match = step(bag, rules);
+        last_rule_match = sparse_step(bag, rules);
         if (max_steps != -1 && steps >= max_steps) break;
     }
     return steps;
@@ -17,6 +17,7 @@ WITH REGARD TO THIS SOFTWARE.
 #define INTERPRETER_H
 
 #include "parser.h"
+#include "sparse.h"
 
 typedef struct BagOfFacts {
     SymTable* syms;
@@ -25,17 +26,107 @@ typedef struct BagOfFacts {
     int* accumulator;
 } BagOfFacts;
 
+/* allocate a zeroed accumulator with room for every symbol the symbols table
+ * can currently hold. (So set the bag up after any passes that add symbols) */
+void init_bag(BagOfFacts* bag, SymTable* syms, Arena* arena);
+
 /* Find all of the facts in the rules table, rules with no LHS */
 void populate_facts(BagOfFacts* bag, RuleTable* rules);
 
+/* ----------------------------------------------
+A call the eval loops make every so often while running, so a long run can
+be looked at (e.g. checkpointed) without being stopped and started again.
+call gets the hook back and the steps taken so far (counted the same as the
+eval's return value), between steps, so the bag is one the program really
+passes through. It can read the bag but mustn't change it. It's called
+once every steps have been taken, give or take a catalyst loop or memoized
+run that goes past, and never at all for a run shorter than that.
+---------------------------------------------- */
+typedef struct EvalHook {
+    void (*call)(struct EvalHook* hook, int steps);
+    int every;
+    void* context;
+} EvalHook;
+
 /* Find the next rule and applies it, returns the index of the rule matched or
- * -1 if no matches were found */
+ * -1 if no matches were found. This checks every rule, to take a lot of steps
+ * use eval or a Matcher (see matcher.h) */
 int step(BagOfFacts* bag, RuleTable* rules);
 
 /* Pass max_steps of -1 to run until halt (no more rules matched). Returns the
- * number of steps taken */
+ * number of steps taken. Steps go through a Matcher, so each one costs only
+ * as much as what it changes */
 /* TODO: it would be neat to count number of times each rule is matched, could
  * allow visualizing a sort of heatmap */
 int eval(BagOfFacts* bag, RuleTable* rules, int max_steps);
 
+/* Same as eval, calling hook (if it isn't NULL) as it goes. The evals below
+ * all take one the same way */
+int hooked_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook);
+
+/* Same as eval, but in maximal parallel steps: each step fires every enabled
+ * rule that doesn't share an LHS symbol with an enabled rule ahead of it, all
+ * against the accumulator as it was when the step started. This isn't the
+ * same program as eval runs (rules can fire in a different order), it's for
+ * programs made of independent parts that would otherwise take turns */
+int parallel_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook);
+
+/* Same as eval, but finding matches with presence bits (see presence.h)
+ * rather than a Matcher, which is quicker for programs with few symbols where
+ * the rules that run are near the top */
+int presence_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, EvalHook* hook);
+
+/* a first-match search split over persistent threads, see interpreter.c */
+typedef struct MatchPool MatchPool;
+
+/* start up to threads - 1 worker threads (the caller is the other one)
+ * searching the rules against the accumulator. Large rule tables are split
+ * into as many ranges as threads, small ones into fewer. Returns NULL if out
+ * of memory. */
+MatchPool* start_match_pool(RuleTable* rules, int* accumulator, int threads);
+
+/* same as step(), with the pool doing the search */
+int pool_step(MatchPool* pool);
+
+/* stop the pool's threads and free it */
+void stop_match_pool(MatchPool* pool);
+
+/* Same as eval, but scanning for the first match on the passed number of
+ * threads rather than keeping a Matcher, for rule tables big enough that
+ * splitting up the scan beats everything else */
+int threaded_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, int threads, EvalHook* hook);
+
+/* Same as eval until halt (there's no max_steps), but running each part of
+ * the program that shares no symbols with the rest on its own, up to the
+ * passed number of parts at a time on separate threads. Leaves the same bag
+ * as eval, see partition.h. The hook is called as each part finishes rather
+ * than every so many steps, with the bag holding the finished parts as they
+ * ended and the rest as they started (which runs on to the same halt). */
+int partitioned_eval(BagOfFacts* bag, RuleTable* rules, int threads, EvalHook* hook);
+
+/* a cycle cycle_eval ran into: the bag after step entry is the same as after
+ * step entry + length, and every length steps after that */
+typedef struct Cycle {
+    int entry;
+    int length;
+} Cycle;
+
+/* Same as eval, but stopping once the bag comes back around to a state it's
+ * already been in, or with a max_steps, skipping ahead by whole cycles. Fills
+ * in cycle (a length of 0 if there wasn't one) */
+int cycle_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, Cycle* cycle, EvalHook* hook);
+
+/* Same as eval, but treating the first prefix rules as a subsystem that runs
+ * until it's done whenever it gets going, and remembering (in a bounded
+ * cache) what each of those runs did given the counts going into it, so a
+ * repeat is a single change to the bag. The cache's hits and misses go in the
+ * passed ints. */
+int memo_eval(BagOfFacts* bag, RuleTable* rules, int max_steps, int prefix, int* hits, int* misses, EvalHook* hook);
+
+/* Versions of the above for a sparse accumulator (see sparse.h), for bags where
+ * most symbols are zero */
+void populate_sparse_facts(SparseBag* bag, RuleTable* rules);
+int sparse_step(SparseBag* bag, RuleTable* rules);
+int sparse_eval(SparseBag* bag, RuleTable* rules, int max_steps);
+
 #endif
@@ -0,0 +1,292 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "io.h"
+#include "matcher.h"
+#include "sparse.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define IO_READ 4096 /* bytes of stdin read at a time */
+#define IO_MAX_TICKS 64
+#define IO_NAME 4096 /* longest port name looked up for a line */
+
+/* ----------------------------------------------
+The ports the program has (-1 for each it doesn't). prints are the <print
+symbols, watched has a flag for each rule that changes any of them (or
+<exit), so outputs are only looked at after steps that could have made
+some. ticks are the >tick symbols, each with its timerfd. line holds the
+part of a line read so far, and input what's been read from stdin but not
+given to the program yet (which gets it a line or key at a time, running
+until it halts in between).
+---------------------------------------------- */
+typedef struct IoPorts {
+    RuleTable* rules;
+    Matcher* matcher;
+    int line_port;
+    int eof_port;
+    int exit_port;
+    int uses_stdin;
+    int uses_keys;
+    int* prints;
+    int prints_len;
+    char* watched;
+    int ticks[IO_MAX_TICKS];
+    int tick_fds[IO_MAX_TICKS];
+    int ticks_len;
+    char line[IO_NAME];
+    int line_len;
+    char input[IO_READ];
+    int input_at;
+    int input_len;
+} IoPorts;
+
+/* the terminal's settings from before it was put in raw mode, which are put
+ * back however the program ends (raw mode leaves ISIG on, so Ctrl-C still
+ * kills it, and would otherwise leave the shell without echo) */
+static struct termios saved_termios;
+static volatile sig_atomic_t raw_mode = 0;
+
+static void restore_terminal() {
+    if (raw_mode) tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    raw_mode = 0;
+}
+
+/* put the terminal back, then die of the signal the way we would have */
+static void restore_and_raise(int sig) {
+    restore_terminal();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int starts_with(char* s, char* prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* add one of the port named prefix + text (if the program has one) */
+static void inject_named(IoPorts* ports, char* prefix, char* text, int len) {
+    char name[IO_NAME + 16];
+    int symbol;
+    if (len > IO_NAME) return;
+    snprintf(name, sizeof(name), "%s%.*s", prefix, len, text);
+    if ((symbol = index_of_symbol(name, ports->rules->syms)) != -1)
+        matcher_add(ports->matcher, symbol, 1);
+}
+
+static void inject_line(IoPorts* ports) {
+    int len = ports->line_len;
+    if (len && ports->line[len - 1] == '\r') len--;
+    if (ports->line_port != -1) matcher_add(ports->matcher, ports->line_port, 1);
+    inject_named(ports, ">line ", ports->line, len);
+    ports->line_len = 0;
+}
+
+/* take the next key (or line, if the program has no keys) of what's been
+ * read from stdin, returns 0 if there isn't a whole one yet */
+static int take_input(IoPorts* ports) {
+    char c;
+    while (ports->input_at < ports->input_len) {
+        c = ports->input[ports->input_at++];
+        if (ports->uses_keys) inject_named(ports, ">key ", &c, 1);
+        if (c == '\n')
+            inject_line(ports);
+        else if (ports->line_len < IO_NAME)
+            ports->line[ports->line_len++] = c;
+        if (ports->uses_keys || c == '\n') return 1;
+    }
+    return 0;
+}
+
+/* print (and take out) any <print outputs, returns 1 if there's an <exit */
+static int write_outputs(IoPorts* ports) {
+    int* accumulator = ports->matcher->accumulator;
+    int i, k, count;
+    for (i = 0; i < ports->prints_len; i++) {
+        if ((count = accumulator[ports->prints[i]]) <= 0) continue;
+        for (k = 0; k < count; k++)
+            printf("%s\n", ports->rules->syms->table[ports->prints[i]] + strlen("<print "));
+        matcher_add(ports->matcher, ports->prints[i], -count);
+    }
+    fflush(stdout);
+    return ports->exit_port != -1 && accumulator[ports->exit_port] > 0;
+}
+
+/* find the program's ports and start its timers */
+static int find_ports(IoPorts* ports, SparseRules* sparse) {
+    SymTable* syms = ports->rules->syms;
+    char* is_output = calloc(syms->len + 1, 1);
+    struct itimerspec every;
+    int i, k, ms;
+    ports->prints = malloc((syms->len + 1) * sizeof(int));
+    ports->watched = calloc(sparse->len + 1, 1);
+    if (!is_output || !ports->prints || !ports->watched) {
+        free(is_output);
+        return !printf("Out of memory\n");
+    }
+    ports->line_port = index_of_symbol(">line", syms);
+    ports->eof_port = index_of_symbol(">eof", syms);
+    ports->exit_port = index_of_symbol("<exit", syms);
+    if (ports->exit_port != -1) is_output[ports->exit_port] = 1;
+    for (i = 0; i < syms->len; i++) {
+        if (starts_with(syms->table[i], "<print ")) {
+            ports->prints[ports->prints_len++] = i;
+            is_output[i] = 1;
+        }
+        ports->uses_keys |= starts_with(syms->table[i], ">key ");
+        ports->uses_stdin |= starts_with(syms->table[i], ">line") || starts_with(syms->table[i], ">key ") || i == ports->eof_port;
+        if (!starts_with(syms->table[i], ">tick ")) continue;
+        walk_number(syms->table[i] + strlen(">tick "), &ms);
+        if (ms <= 0) continue;
+        if (ports->ticks_len == IO_MAX_TICKS) {
+            free(is_output);
+            return !printf("Too many ticks (most is %d)\n", IO_MAX_TICKS);
+        }
+        every.it_interval.tv_sec = every.it_value.tv_sec = ms / 1000;
+        every.it_interval.tv_nsec = every.it_value.tv_nsec = (ms % 1000) * 1000000L;
+        ports->tick_fds[ports->ticks_len] = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (ports->tick_fds[ports->ticks_len] == -1 || timerfd_settime(ports->tick_fds[ports->ticks_len], 0, &every, NULL) == -1) {
+            free(is_output);
+            return !printf("Couldn't start timer: %s\n", syms->table[i]);
+        }
+        ports->ticks[ports->ticks_len++] = i;
+    }
+    for (i = 0; i < sparse->len; i++)
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            ports->watched[i] |= is_output[sparse->delta_syms[k]];
+    free(is_output);
+    return 1;
+}
+
+int io_eval(BagOfFacts* bag, RuleTable* rules, int max_steps) {
+    SparseRules* sparse = sparse_rules(rules);
+    Matcher matcher;
+    IoPorts ports;
+    struct epoll_event event, events[IO_MAX_TICKS + 1];
+    struct termios raw;
+    struct sigaction restore, old_int, old_term;
+    static int restore_at_exit = 0;
+    unsigned long long expirations;
+    int epoll_fd = -1, handlers = 0, steps = 0;
+    int stdin_open, stdin_polled = 0, done = 0;
+    int i, rule, events_len, len;
+
+    memset(&ports, 0, sizeof(ports));
+    ports.rules = rules;
+    ports.matcher = &matcher;
+    if (!init_matcher(&matcher, rules, bag->accumulator)) {
+        printf("Out of memory\n");
+        return -1;
+    }
+    if (!find_ports(&ports, sparse) || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        steps = -1;
+        goto finish;
+    }
+    /* (events for ticks carry their index + 1, and 0 is stdin) */
+    for (i = 0; i < ports.ticks_len; i++) {
+        event.events = EPOLLIN;
+        event.data.u32 = i + 1;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ports.tick_fds[i], &event);
+    }
+    stdin_open = ports.uses_stdin;
+    if (stdin_open) {
+        event.events = EPOLLIN;
+        event.data.u32 = 0;
+        /* (a regular file can't be waited on, but it's always ready) */
+        stdin_polled = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0;
+    }
+    if (ports.uses_keys && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+        /* (set up before raw mode starts, so there's no moment a signal
+         * could leave it on) */
+        if (!restore_at_exit) restore_at_exit = atexit(restore_terminal) == 0;
+        memset(&restore, 0, sizeof(restore));
+        restore.sa_handler = restore_and_raise;
+        sigemptyset(&restore.sa_mask);
+        sigaction(SIGINT, &restore, &old_int);
+        sigaction(SIGTERM, &restore, &old_term);
+        handlers = 1;
+        raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw_mode = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+
+    done = write_outputs(&ports);
+    while (!done) {
+        if ((rule = matcher_step(&matcher)) != -1) {
+            steps++;
+            if (ports.watched[rule]) done = write_outputs(&ports);
+            if (max_steps != -1 && steps >= max_steps) break;
+            continue;
+        }
+        /* halted, so sleep until a port has something (or stop if none
+         * ever could) */
+        if (take_input(&ports)) continue;
+        if (!stdin_open && !ports.ticks_len) break;
+        if (stdin_open && !stdin_polled) {
+            events_len = 1;
+            events[0].data.u32 = 0;
+        }
+        else if ((events_len = epoll_wait(epoll_fd, events, IO_MAX_TICKS + 1, -1)) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (i = 0; i < events_len; i++) {
+            if (events[i].data.u32) {
+                if (read(ports.tick_fds[events[i].data.u32 - 1], &expirations, sizeof(expirations)) == sizeof(expirations))
+                    matcher_add(&matcher, ports.ticks[events[i].data.u32 - 1], (int)expirations);
+                continue;
+            }
+            if ((len = read(STDIN_FILENO, ports.input, sizeof(ports.input))) > 0) {
+                ports.input_at = 0;
+                ports.input_len = len;
+                continue;
+            }
+            if (len == -1 && errno == EINTR) continue;
+            /* end of stdin, including any last line without a newline */
+            if (ports.line_len) inject_line(&ports);
+            if (ports.eof_port != -1) matcher_add(&matcher, ports.eof_port, 1);
+            if (stdin_polled) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+            stdin_open = 0;
+        }
+    }
+    steps++; /* (eval counts the step that found nothing, or the last one) */
+
+finish:
+    restore_terminal();
+    if (handlers) {
+        sigaction(SIGINT, &old_int, NULL);
+        sigaction(SIGTERM, &old_term, NULL);
+    }
+    for (i = 0; i < ports.ticks_len; i++)
+        close(ports.tick_fds[i]);
+    if (epoll_fd != -1) close(epoll_fd);
+    free(ports.prints);
+    free(ports.watched);
+    free_matcher(&matcher);
+    return steps;
+}
+
+#else
+
+int io_eval(BagOfFacts* bag, RuleTable* rules, int max_steps) {
+    printf("--io needs Linux (epoll and timerfd)\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,39 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Running a program that talks to the outside world through built-in ports,
+ * sleeping (in epoll, so using no CPU) whenever no rule can go until one of
+ * them has something new for it:
+ *
+ * >line           one for each line read from stdin
+ * >line TEXT      one for each line read from stdin that's just TEXT
+ * >key C          one for each key C pressed (if the program has any of
+ *                 these, stdin is read a key at a time, and a terminal is
+ *                 put in raw mode while running)
+ * >eof            one once stdin is closed
+ * >tick MS        one every MS milliseconds (timerfd), from the start
+ * <print TEXT     prints TEXT on its own line, once for each there are, and
+ *                 takes them back out
+ * <exit           stops the program
+ *
+ * The program also stops once it's halted and nothing could ever wake it
+ * (stdin is closed and there are no ticks). Linux only. */
+
+#ifndef IO_H
+#define IO_H
+
+#include "interpreter.h"
+
+/* same as eval (counting steps the same way), but with the ports above.
+ * Returns -1 if the ports couldn't be set up (after printing why). */
+int io_eval(BagOfFacts* bag, RuleTable* rules, int max_steps);
+
+#endif
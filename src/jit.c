@@ -0,0 +1,95 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jit.h"
+#include "compiler.h"
+#include "image.h"
+#include "sparse.h"
+
+/* 64 bit FNV-1a of s, carrying on from hash */
+static unsigned long long hash_string(unsigned long long hash, char* s) {
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* load a built shared object, returns 0 if it isn't one of ours for this
+ * many symbols */
+static int open_build(Jit* jit, char* path, int symbols) {
+    int* jit_symbols;
+    if (!(jit->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL))) return 0;
+    jit_symbols = dlsym(jit->handle, "jit_symbols");
+    *(void**)&jit->step = dlsym(jit->handle, "jit_step");
+    *(void**)&jit->eval = dlsym(jit->handle, "jit_eval");
+    if (jit_symbols && *jit_symbols == symbols && jit->step && jit->eval) return 1;
+    free_jit(jit);
+    return 0;
+}
+
+/* compile the C at src_path into path, going through a file of our own so
+ * nothing else ever sees half a build. Returns 0 if it didn't compile. */
+static int build(char* src_path, char* path, char* cc) {
+    char command[3 * 4096 + 256];
+    char tmp_path[4096 + 32];
+    int built;
+    /* (paths are single quoted for the shell, so can't have any in them, cc
+     * is left for the shell to split like make would) */
+    if (strchr(src_path, '\'') || strchr(path, '\'')) return 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    snprintf(command, sizeof(command), "%s " JIT_FLAGS " -o '%s' '%s' >/dev/null 2>&1", cc, tmp_path, src_path);
+    built = system(command) == 0 && rename(tmp_path, path) == 0;
+    if (!built) remove(tmp_path);
+    return built;
+}
+
+int load_jit(Jit* jit, RuleTable* rules) {
+    char path[4096];
+    char src_path[4096 + 32];
+    SparseRules* sparse = sparse_rules(rules);
+    char* cc = getenv("CC");
+    char* src;
+    FILE* f;
+    int size, i, len = 0, loaded = 0;
+    memset(jit, 0, sizeof(Jit));
+    if (!sparse || sparse->len < 0) return 0;
+    for (i = 0; i < sparse->len; i++)
+        len += sparse->lhs_start[i] != sparse->lhs_start[i + 1];
+    if (len > JIT_MAX_RULES) return 0;
+    if (!cc || !cc[0]) cc = "cc";
+    if (!(size = compile_to_c_jit_size(rules)) || !(src = calloc(size, 1))) return 0;
+    compile_to_c_jit(rules, src);
+    /* keyed by everything that goes into the build */
+    if (cache_file_path(path, sizeof(path), NULL, hash_string(hash_string(hash_string(14695981039346656037ULL, src), cc), JIT_FLAGS), ".so")) {
+        if (!(loaded = open_build(jit, path, rules->syms->len))) {
+            snprintf(src_path, sizeof(src_path), "%s.%d.c", path, (int)getpid());
+            if ((f = fopen(src_path, "w"))) {
+                fputs(src, f);
+                if (!fclose(f) && build(src_path, path, cc))
+                    loaded = open_build(jit, path, rules->syms->len);
+                remove(src_path);
+            }
+        }
+    }
+    free(src);
+    return loaded;
+}
+
+void free_jit(Jit* jit) {
+    if (jit->handle) dlclose(jit->handle);
+    memset(jit, 0, sizeof(Jit));
+}
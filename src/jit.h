@@ -0,0 +1,45 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Running a program as native code: its rules are turned into C
+ * (compile_to_c_jit), built into a shared object with the local C compiler
+ * ($CC, or cc) and loaded with dlopen. Builds are cached next to images (see
+ * cache_file_path), named by a hash of the C and the compile command, so
+ * the same program is only ever built once. */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "parser.h"
+
+#define JIT_FLAGS "-O2 -fwrapv -shared -fPIC"
+
+/* the generated step tests every rule in order with no matcher, so past about
+ * this many rules (not counting facts) the interpreter's matcher wins and
+ * load_jit won't build them */
+#define JIT_MAX_RULES 128
+
+typedef struct Jit {
+    void* handle;
+    int (*step)(int* accumulator); /* same as step */
+    int (*eval)(int* accumulator, int max_steps); /* same as eval */
+} Jit;
+
+/* build (or find the cached build of) the rules and load it. Returns 0 if
+ * that couldn't be done (no compiler, nowhere to cache, more than
+ * JIT_MAX_RULES rules, ...), in which case the interpreter should be used
+ * instead. The loaded code has no state of
+ * its own, so any number of threads can run it on their own accumulators. */
+int load_jit(Jit* jit, RuleTable* rules);
+
+void free_jit(Jit* jit);
+
+#endif
@@ -0,0 +1,146 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include "jobs.h"
+
+#define RANGE(first, end) ((unsigned long long)(first) << 32 | (unsigned int)(end))
+#define RANGE_FIRST(range) ((int)((range) >> 32))
+#define RANGE_END(range) ((int)((range) & 0xffffffffu))
+
+/* take the next job off the front of thread's share, -1 if it's empty */
+static int take_job(JobPool* pool, int thread) {
+    unsigned long long range = atomic_load(&pool->ranges[thread]);
+    do {
+        if (RANGE_FIRST(range) >= RANGE_END(range)) return -1;
+    } while (!atomic_compare_exchange_weak(&pool->ranges[thread], &range, RANGE(RANGE_FIRST(range) + 1, RANGE_END(range))));
+    return RANGE_FIRST(range);
+}
+
+/* move the back half of the biggest share left into thread's (empty) one.
+ * Returns 0 if there's nothing left to steal. */
+static int steal_jobs(JobPool* pool, int thread) {
+    unsigned long long range;
+    int i, victim, left, most, half;
+    while (1) {
+        victim = -1;
+        most = 0;
+        for (i = 0; i < pool->threads; i++) {
+            range = atomic_load(&pool->ranges[i]);
+            left = RANGE_END(range) - RANGE_FIRST(range);
+            if (i != thread && left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim == -1) return 0;
+        range = atomic_load(&pool->ranges[victim]);
+        left = RANGE_END(range) - RANGE_FIRST(range);
+        if (left <= 0) continue;
+        half = (left + 1) / 2;
+        if (atomic_compare_exchange_strong(&pool->ranges[victim], &range, RANGE(RANGE_FIRST(range), RANGE_END(range) - half))) {
+            atomic_store(&pool->ranges[thread], RANGE(RANGE_END(range) - half, RANGE_END(range)));
+            return 1;
+        }
+    }
+}
+
+/* run jobs until there aren't any left to take or steal */
+static void work(JobPool* pool, int thread) {
+    int job;
+    do {
+        while ((job = take_job(pool, thread)) != -1) {
+            pool->run(pool->context, job, thread);
+            atomic_fetch_add(&pool->done, 1);
+        }
+    } while (steal_jobs(pool, thread));
+}
+
+static void* job_worker(void* arg) {
+    JobPool* pool = arg;
+    int generation = 0;
+    int thread;
+    pthread_mutex_lock(&pool->lock);
+    thread = ++pool->started;
+    while (1) {
+        while (pool->generation == generation && !pool->stop)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stop) break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        work(pool, thread);
+        pthread_mutex_lock(&pool->lock);
+        if (atomic_load(&pool->done) == pool->jobs)
+            pthread_cond_signal(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+int start_job_pool(JobPool* pool, int threads, JobFunction run, void* context) {
+    int i;
+    if (threads < 1) threads = 1;
+    pool->threads = threads;
+    pool->run = run;
+    pool->context = context;
+    pool->ranges = calloc(threads, sizeof(*pool->ranges));
+    pool->workers = calloc(threads, sizeof(pthread_t));
+    pool->jobs = pool->generation = pool->stop = pool->started = 0;
+    atomic_init(&pool->done, 0);
+    if (!pool->ranges || !pool->workers) {
+        free(pool->ranges);
+        free(pool->workers);
+        return 0;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&pool->workers[i], NULL, job_worker, pool) != 0) {
+            pool->threads = i;
+            stop_job_pool(pool);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void run_jobs(JobPool* pool, int jobs) {
+    int i;
+    atomic_store(&pool->done, 0);
+    for (i = 0; i < pool->threads; i++)
+        atomic_store(&pool->ranges[i], RANGE((long long)jobs * i / pool->threads, (long long)jobs * (i + 1) / pool->threads));
+    pthread_mutex_lock(&pool->lock);
+    pool->jobs = jobs;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    work(pool, 0);
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->done) < jobs)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void stop_job_pool(JobPool* pool) {
+    int i;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; i++)
+        pthread_join(pool->workers[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->ranges);
+    free(pool->workers);
+}
@@ -0,0 +1,59 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* A pool of threads for running lots of independent jobs of very different
+ * lengths. Each thread starts out with an even share of the jobs, and one
+ * that runs out steals half of whatever's left of the busiest thread's
+ * share, so a few long jobs don't leave the other threads idle. */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* runs job number job, on thread number thread (0 to threads - 1) */
+typedef void (*JobFunction)(void* context, int job, int thread);
+
+/* ----------------------------------------------
+ranges holds each thread's share of the jobs as (first << 32 | end), so a
+thread taking its next job and another stealing the back half are both one
+compare and swap. Thread 0 is whoever calls run_jobs, the rest wait on wake
+for the next generation.
+---------------------------------------------- */
+typedef struct JobPool {
+    int threads;
+    JobFunction run;
+    void* context;
+    _Atomic unsigned long long* ranges;
+    pthread_t* workers;
+    atomic_int done; /* jobs finished this generation */
+    int jobs;
+    int generation;
+    int started; /* workers that have taken a thread number */
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t finished;
+} JobPool;
+
+/* start threads - 1 threads for running jobs with run(context, job). Returns
+ * 0 if out of memory (or threads). */
+int start_job_pool(JobPool* pool, int threads, JobFunction run, void* context);
+
+/* run jobs 0 to jobs - 1 on every thread (including this one), returning once
+ * they've all finished */
+void run_jobs(JobPool* pool, int jobs);
+
+/* stop and free the threads */
+void stop_job_pool(JobPool* pool);
+
+#endif
@@ -0,0 +1,219 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include "matcher.h"
+
+static void enable_rule(Matcher* matcher, int rule) {
+    int level;
+    unsigned long long word;
+    for (level = 0; level < matcher->levels; level++) {
+        word = matcher->enabled[level][rule >> 6];
+        matcher->enabled[level][rule >> 6] = word | 1ULL << (rule & 63);
+        if (word) break; /* the levels above already know about this word */
+        rule >>= 6;
+    }
+}
+
+static void disable_rule(Matcher* matcher, int rule) {
+    int level;
+    for (level = 0; level < matcher->levels; level++) {
+        if ((matcher->enabled[level][rule >> 6] &= ~(1ULL << (rule & 63))))
+            break; /* something else in this word is still enabled */
+        rule >>= 6;
+    }
+}
+
+int matcher_first(Matcher* matcher) {
+    int level = matcher->levels - 1;
+    int i = 0;
+    if (!matcher->enabled[level][0]) return -1;
+    for (; level >= 0; level--)
+        i = (i << 6) + __builtin_ctzll(matcher->enabled[level][i]);
+    return i;
+}
+
+int init_matcher(Matcher* matcher, RuleTable* rules, int* accumulator) {
+    SparseRules* sparse = sparse_rules(rules);
+    int syms_len = rules->syms->len;
+    int words = (sparse->len >> 6) + 1;
+    int level_words;
+    int i, k;
+
+    matcher->levels = 0;
+    if (sparse->len < 0) return 0; /* (the sparse rules ran out of memory) */
+    matcher->sparse = sparse;
+    matcher->accumulator = accumulator;
+    matcher->watch_start = calloc(syms_len + 1, sizeof(int));
+    matcher->watch_rules = malloc((sparse->lhs_start[sparse->len] + 1) * sizeof(int));
+    matcher->missing = calloc(sparse->len + 1, sizeof(int));
+    matcher->shared = calloc(sparse->len + 1, sizeof(char));
+    matcher->claimed = calloc(syms_len + 1, sizeof(int));
+    matcher->fired = malloc((sparse->len + 1) * sizeof(int));
+    matcher->fired_executions = malloc((sparse->len + 1) * sizeof(int));
+    matcher->stamp = 0;
+    /* add levels until one has just the one word */
+    do {
+        matcher->enabled[matcher->levels++] = calloc(words, sizeof(unsigned long long));
+        level_words = words;
+        words = ((words - 1) >> 6) + 1;
+    } while (level_words > 1 && matcher->levels < MATCHER_LEVELS && matcher->enabled[matcher->levels - 1]);
+    if (!matcher->watch_start || !matcher->watch_rules || !matcher->missing || !matcher->enabled[matcher->levels - 1]
+            || !matcher->shared || !matcher->claimed || !matcher->fired || !matcher->fired_executions) {
+        free_matcher(matcher);
+        return 0;
+    }
+
+    /* count the rules watching each symbol, turn the counts into starts,
+     * then fill in the rules (counting the starts back up into place) */
+    for (k = 0; k < sparse->lhs_start[sparse->len]; k++)
+        matcher->watch_start[sparse->lhs[k] + 1]++;
+    for (i = 0; i < syms_len; i++)
+        matcher->watch_start[i + 1] += matcher->watch_start[i];
+    for (i = 0; i < sparse->len; i++)
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            matcher->watch_rules[matcher->watch_start[sparse->lhs[k]]++] = i;
+    for (i = syms_len; i > 0; i--)
+        matcher->watch_start[i] = matcher->watch_start[i - 1];
+    matcher->watch_start[0] = 0;
+
+    for (i = 0; i < sparse->len; i++) {
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++) {
+            if (accumulator[sparse->lhs[k]] <= 0)
+                matcher->missing[i]++;
+            /* a rule only ever conflicts with others watching the same
+             * symbols (see matcher_step_all) */
+            if (matcher->watch_start[sparse->lhs[k] + 1] - matcher->watch_start[sparse->lhs[k]] > 1)
+                matcher->shared[i] = 1;
+        }
+        /* (facts have no LHS, and never match) */
+        if (!matcher->missing[i] && sparse->lhs_start[i] != sparse->lhs_start[i + 1])
+            enable_rule(matcher, i);
+    }
+    return 1;
+}
+
+void free_matcher(Matcher* matcher) {
+    int level;
+    free(matcher->watch_start);
+    free(matcher->watch_rules);
+    free(matcher->missing);
+    free(matcher->shared);
+    free(matcher->claimed);
+    free(matcher->fired);
+    free(matcher->fired_executions);
+    for (level = 0; level < matcher->levels; level++)
+        free(matcher->enabled[level]);
+    matcher->watch_start = matcher->watch_rules = matcher->missing = NULL;
+    matcher->claimed = matcher->fired = matcher->fired_executions = NULL;
+    matcher->shared = NULL;
+    matcher->levels = 0;
+}
+
+void matcher_add(Matcher* matcher, int symbol, int delta) {
+    int before = matcher->accumulator[symbol];
+    int after = before + delta;
+    int k, rule;
+    matcher->accumulator[symbol] = after;
+    /* only running out or coming back changes what's enabled */
+    if ((before > 0) == (after > 0)) return;
+    for (k = matcher->watch_start[symbol]; k < matcher->watch_start[symbol + 1]; k++) {
+        rule = matcher->watch_rules[k];
+        if (after > 0) {
+            if (!--matcher->missing[rule])
+                enable_rule(matcher, rule);
+        }
+        else if (!matcher->missing[rule]++)
+            disable_rule(matcher, rule);
+    }
+}
+
+/* every LHS symbol is there, the rarest one decides how many times the rule
+ * runs (same as check_rule_against_accumulator) */
+static int rule_executions(Matcher* matcher, int rule) {
+    SparseRules* sparse = matcher->sparse;
+    int executions = -1;
+    int k, count;
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+        if (sparse->transfers && !limits_executions(sparse, rule, k))
+            continue;
+        count = matcher->accumulator[sparse->lhs[k]];
+        if (executions == -1 || count < executions)
+            executions = count;
+    }
+    if (executions == -1) executions = 1; /* (nothing limited it) */
+    return executions;
+}
+
+static void apply_rule(Matcher* matcher, int rule, int executions) {
+    SparseRules* sparse = matcher->sparse;
+    int k;
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++)
+        matcher_add(matcher, sparse->delta_syms[k], executions * sparse->deltas[k]);
+}
+
+int matcher_step(Matcher* matcher) {
+    int rule = matcher_first(matcher);
+    if (rule == -1) return -1;
+    apply_rule(matcher, rule, rule_executions(matcher, rule));
+    return rule;
+}
+
+int matcher_next(Matcher* matcher, int rule) {
+    int level = 0;
+    int words = (matcher->sparse->len >> 6) + 1; /* in this level */
+    int i = rule;
+    unsigned long long word;
+    for (; level < matcher->levels; level++) {
+        if ((i >> 6) >= words) return -1;
+        word = matcher->enabled[level][i >> 6] & (~0ULL << (i & 63));
+        if (word) {
+            /* found one in this word, walk back down to the rule */
+            i = (i & ~63) + __builtin_ctzll(word);
+            for (level--; level >= 0; level--)
+                i = (i << 6) + __builtin_ctzll(matcher->enabled[level][i]);
+            return i;
+        }
+        /* nothing else in this word, look from the next one up a level */
+        i = (i >> 6) + 1;
+        words = ((words - 1) >> 6) + 1;
+    }
+    return -1;
+}
+
+int matcher_step_all(Matcher* matcher) {
+    SparseRules* sparse = matcher->sparse;
+    int fired_len = 0;
+    int rule, k;
+    /* (a new stamp each step means nothing has to be cleared) */
+    matcher->stamp++;
+    /* pick the rules against the accumulator as it is before any of them
+     * run, the enabled bits can't change until they're applied */
+    for (rule = matcher_first(matcher); rule != -1; rule = matcher_next(matcher, rule + 1)) {
+        if (matcher->shared[rule]) {
+            /* a higher priority rule already took one of its symbols */
+            for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++)
+                if (matcher->claimed[sparse->lhs[k]] == matcher->stamp)
+                    break;
+            if (k < sparse->lhs_start[rule + 1]) continue;
+            for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++)
+                matcher->claimed[sparse->lhs[k]] = matcher->stamp;
+        }
+        matcher->fired[fired_len] = rule;
+        matcher->fired_executions[fired_len] = rule_executions(matcher, rule);
+        fired_len++;
+    }
+    /* no two of them share an LHS symbol, so none can take what another
+     * needed, and the deltas can all go in together */
+    for (k = 0; k < fired_len; k++)
+        apply_rule(matcher, matcher->fired[k], matcher->fired_executions[k]);
+    return fired_len;
+}
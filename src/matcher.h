@@ -0,0 +1,85 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Incremental rule matching. step() looks at every rule, every step, to find
+ * the first one that matches. A Matcher instead keeps track of which rules
+ * are enabled (every LHS symbol in the accumulator) as the accumulator
+ * changes, so a step only costs as much as the symbols it changes. It fires
+ * exactly the rule step() would. */
+
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include "parser.h"
+#include "sparse.h"
+
+/* enough levels of enabled bits for 64^8 rules */
+#define MATCHER_LEVELS 8
+
+/* ----------------------------------------------
+For each symbol, the rules that have it on their LHS (the "watch list"), so
+when a symbol runs out or comes back, only those rules need a look:
+
+watch_rules[watch_start[s]] up to watch_rules[watch_start[s + 1]]
+
+missing counts how many of each rule's LHS symbols are currently at 0, a rule
+with some LHS and nothing missing is enabled. Enabled rules are kept as bits,
+enabled[0] has a bit per rule, enabled[1] a bit per word of enabled[0] that
+has any set, and so on up to a single word, so finding the first enabled rule
+is a count-trailing-zeros per level.
+
+The rest is for matcher_step_all: which rules share an LHS symbol with some
+other rule (worked out once, from the watch lists), and per step, which
+symbols a rule has claimed (the step's stamp) and the rules that fire.
+---------------------------------------------- */
+typedef struct Matcher {
+    SparseRules* sparse;
+    int* accumulator; /* the bag's, which the matcher changes */
+    int* watch_start;
+    int* watch_rules;
+    int* missing;
+    int levels;
+    unsigned long long* enabled[MATCHER_LEVELS];
+    char* shared;
+    int* claimed;
+    int stamp;
+    int* fired;
+    int* fired_executions;
+} Matcher;
+
+/* set up a matcher for the rules against the accumulator as it currently is.
+ * If anything other than the matcher changes the accumulator after this, it
+ * has to go through matcher_add. Returns 0 if out of memory. */
+int init_matcher(Matcher* matcher, RuleTable* rules, int* accumulator);
+
+/* free everything init_matcher allocated */
+void free_matcher(Matcher* matcher);
+
+/* add delta of symbol to the accumulator, updating which rules are enabled */
+void matcher_add(Matcher* matcher, int symbol, int delta);
+
+/* first enabled rule in rule order, -1 if there aren't any */
+int matcher_first(Matcher* matcher);
+
+/* first enabled rule from rule on (in rule order), -1 if there aren't any */
+int matcher_next(Matcher* matcher, int rule);
+
+/* same as step(): find and apply the first matching rule, returning its
+ * index, or -1 if no rules match */
+int matcher_step(Matcher* matcher);
+
+/* maximal parallel step: fire every enabled rule that doesn't share an LHS
+ * symbol with an enabled rule before it, all against the accumulator as it
+ * was at the start of the step. Returns how many rules fired (0 if none
+ * match) */
+int matcher_step_all(Matcher* matcher);
+
+#endif
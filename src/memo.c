@@ -0,0 +1,120 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include <string.h>
+#include "memo.h"
+
+static unsigned long long hash_key(int* key, int len) {
+    unsigned long long hash = 0x9e3779b97f4a7c15ULL;
+    int i;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned int)key[i]) * 0xbf58476d1ce4e5b9ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+int init_memo(Memo* memo, int key_len, int value_len, int max_len) {
+    int buckets = 1;
+    while (buckets < max_len * 2) buckets <<= 1;
+    memo->key_len = key_len;
+    memo->value_len = value_len;
+    memo->len = 0;
+    memo->max_len = max_len;
+    memo->keys = malloc(((long long)max_len * key_len + 1) * sizeof(int));
+    memo->values = malloc(((long long)max_len * value_len + 1) * sizeof(int));
+    memo->steps = malloc(max_len * sizeof(int));
+    memo->hashes = malloc(max_len * sizeof(unsigned long long));
+    memo->buckets = calloc(buckets, sizeof(int));
+    memo->bucket_mask = buckets - 1;
+    memo->chain = malloc(max_len * sizeof(int));
+    memo->newer = malloc(max_len * sizeof(int));
+    memo->older = malloc(max_len * sizeof(int));
+    memo->newest = memo->oldest = -1;
+    memo->hits = memo->misses = 0;
+    if (!memo->keys || !memo->values || !memo->steps || !memo->hashes
+            || !memo->buckets || !memo->chain || !memo->newer || !memo->older) {
+        free_memo(memo);
+        return 0;
+    }
+    return 1;
+}
+
+void free_memo(Memo* memo) {
+    free(memo->keys);
+    free(memo->values);
+    free(memo->steps);
+    free(memo->hashes);
+    free(memo->buckets);
+    free(memo->chain);
+    free(memo->newer);
+    free(memo->older);
+    memo->keys = memo->values = memo->steps = NULL;
+    memo->hashes = NULL;
+    memo->buckets = memo->chain = memo->newer = memo->older = NULL;
+}
+
+/* take the entry out of the recently used list */
+static void unlink_entry(Memo* memo, int entry) {
+    if (memo->newer[entry] != -1) memo->older[memo->newer[entry]] = memo->older[entry];
+    else memo->newest = memo->older[entry];
+    if (memo->older[entry] != -1) memo->newer[memo->older[entry]] = memo->newer[entry];
+    else memo->oldest = memo->newer[entry];
+}
+
+/* put the entry at the front of the recently used list */
+static void link_newest(Memo* memo, int entry) {
+    memo->newer[entry] = -1;
+    memo->older[entry] = memo->newest;
+    if (memo->newest != -1) memo->newer[memo->newest] = entry;
+    memo->newest = entry;
+    if (memo->oldest == -1) memo->oldest = entry;
+}
+
+int memo_find(Memo* memo, int* key) {
+    unsigned long long hash = hash_key(key, memo->key_len);
+    int entry = memo->buckets[hash & memo->bucket_mask] - 1;
+    for (; entry != -1; entry = memo->chain[entry] - 1) {
+        if (memo->hashes[entry] != hash) continue;
+        if (memcmp(&memo->keys[(long long)entry * memo->key_len], key, memo->key_len * sizeof(int))) continue;
+        memo->hits++;
+        unlink_entry(memo, entry);
+        link_newest(memo, entry);
+        return entry;
+    }
+    memo->misses++;
+    return -1;
+}
+
+void memo_insert(Memo* memo, int* key, int* value, int steps) {
+    unsigned long long hash = hash_key(key, memo->key_len);
+    int* bucket;
+    int entry;
+    if (memo->len < memo->max_len)
+        entry = memo->len++;
+    else {
+        /* reuse the least recently used entry, taking it out of its bucket */
+        entry = memo->oldest;
+        unlink_entry(memo, entry);
+        bucket = &memo->buckets[memo->hashes[entry] & memo->bucket_mask];
+        while (*bucket - 1 != entry) bucket = &memo->chain[*bucket - 1];
+        *bucket = memo->chain[entry];
+    }
+    memcpy(&memo->keys[(long long)entry * memo->key_len], key, memo->key_len * sizeof(int));
+    memcpy(MEMO_VALUE(memo, entry), value, memo->value_len * sizeof(int));
+    memo->steps[entry] = steps;
+    memo->hashes[entry] = hash;
+    bucket = &memo->buckets[hash & memo->bucket_mask];
+    memo->chain[entry] = *bucket;
+    *bucket = entry + 1;
+    link_newest(memo, entry);
+}
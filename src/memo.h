@@ -0,0 +1,65 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* A bounded cache from a fixed length array of ints (e.g. some symbols'
+ * counts) to another one (e.g. what running some rules did to some others),
+ * plus a step count, throwing the least recently used entry out when full. */
+
+#ifndef MEMO_H
+#define MEMO_H
+
+/* ----------------------------------------------
+Entries live in flat arrays, entry i's key at keys[i * key_len] and value at
+values[i * value_len]. They're found by hash through buckets and chain (the
+first entry in each bucket, and the next entry in the same bucket after each
+entry, both as entry + 1 with 0 for none), and kept in least recently used
+order by a doubly linked list through newer and older, from newest to oldest
+(-1 at each end).
+---------------------------------------------- */
+typedef struct Memo {
+    int key_len;
+    int value_len;
+    int len;
+    int max_len;
+    int* keys;
+    int* values;
+    int* steps;
+    unsigned long long* hashes;
+    int* buckets;
+    int bucket_mask;
+    int* chain;
+    int* newer;
+    int* older;
+    int newest;
+    int oldest;
+    int hits;
+    int misses;
+} Memo;
+
+/* set up an empty memo with room for max_len entries. Returns 0 if out of
+ * memory. */
+int init_memo(Memo* memo, int key_len, int value_len, int max_len);
+
+/* free everything init_memo allocated */
+void free_memo(Memo* memo);
+
+/* the entry for the key, -1 if there isn't one. Counts a hit or a miss, and a
+ * hit becomes the most recently used entry */
+int memo_find(Memo* memo, int* key);
+
+/* the value of an entry memo_find returned */
+#define MEMO_VALUE(memo, entry) (&(memo)->values[(long long)(entry) * (memo)->value_len])
+
+/* add an entry (for a key that isn't in the memo yet), throwing out the least
+ * recently used one if it's full */
+void memo_insert(Memo* memo, int* key, int* value, int steps);
+
+#endif
@@ -11,29 +11,32 @@ WITH REGARD TO THIS SOFTWARE.
 ==================================================================== */
 
 #include "parser.h"
+#include "scan.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
+#define SYM_START 64 /* initial number of symbols the symbols table can hold */
+#define RUL_START 64 /* initial number of rules the rules table can hold */
+#define ENT_START 256 /* initial number of rule entries (symbols in rules) */
+#define NAM_START 4096 /* initial size of (and smallest new) symbol names array */
+#define CHUNK_SZ 65536 /* how much source parse_stream reads at a time */
 
-static char delim; /* the spacer glyph delimiter, conventionally '|' */
-static int parse_constants; /* whether to automatically handle x:100 type multiplicity syntax */
 
 /* iterate the pointer until we find the first non-whitespace character */ 
 static char* walk_whitespace(char* s) {
-    while (s[0] && s[0] <= 0x20) /* 'space' and below */
-        s++;
-    return s;
+    return scan_whitespace(s); /* 'space' and below */
 }
 
-/* turn all whitespace characters at end of string to null terms */
-static void trim(char** s) {
-    /* find the first null terminator so we can work backwards. */
-    char* end = *s;
-    while (*end) {
-        end++;
-    }
+/* turn all whitespace characters at the end of the string from start up to
+ * (not including) end into null terms */
+static void trim(char* start, char* end) {
     end = end - 1;
     /* work backwards from the end until we find a real letter. */
-    while (*end) {
+    while (end >= start) {
         if (*end > 0x20) break; /* I'm a real letter! */
         *end = 0; /* make this a null term */
         end--; /* work backwards */
@@ -43,7 +46,17 @@ static void trim(char** s) {
 /* check if two passed symbols are the same */
 /* I think the original assumption is that a is always the source code? hence
  * the assymetry originally */
-int compare_symbols(char* a, char* b) {
+int compare_symbols(char* a, char* b, SymTable* syms) {
+    char delim = syms->delim;
+    int parse_constants = syms->parse_constants;
+    /* jump straight over however much of the symbols is identical, except
+     * for any whitespace at the end of it, which the loop below needs to see
+     * all of to skip it properly */
+    int same = scan_same(a, b);
+    while (same > 0 && b[same - 1] <= 0x20)
+        same--;
+    a += same;
+    b += same;
     while (*a && *b) {
         /* stop when we've reached the end of one of the symbols */
         if ((*a == ',' || *a == delim || (*a == ':' && parse_constants)) && !*b) break;
@@ -69,17 +82,232 @@ int compare_symbols(char* a, char* b) {
     return !*b && (*a == ',' || *a == delim || *a <= 0x20 || (*a == ':' && parse_constants));
 }
 
-/* find ID of symbol in a symbols table */
-int index_of_symbol(char* s, SymTable* syms) {
-    int i = 0; /* symbol index */
-    for (i = 0; i < syms->len; i++) {
-        if (compare_symbols(s, syms->table[i])) {
-            return i;
+/* hash a symbol name the way compare_symbols sees it: stop at the end of the
+ * symbol, treat a space followed by more whitespace as a single space, and
+ * ignore trailing whitespace. Returns a pointer to where the symbol ends. */
+char* hash_symbol(char* s, unsigned int* hash, SymTable* syms) {
+    unsigned int h = 2166136261u; /* FNV-1a offset basis */
+    char* end = scan_symbol_end(s, syms->delim, syms->parse_constants);
+    char* last = end; /* just past the last non-whitespace character */
+    while (last > s && last[-1] <= 0x20)
+        last--;
+    while (s < last) {
+        if (*s > 0x20) {
+            h = (h ^ (unsigned char)*s) * 16777619u; /* FNV prime */
+            s++;
+            continue;
+        }
+        /* hash up to and including the first space of a run of whitespace,
+         * compare_symbols skips everything after that. (There's always more
+         * symbol after the run before last) */
+        while (*s <= 0x20) {
+            h = (h ^ (unsigned char)*s) * 16777619u;
+            if (*s++ == ' ') break;
         }
+        while (*s <= 0x20)
+            s++;
+    }
+    *hash = h;
+    return end;
+}
+
+/* find the symbol with the passed name and hash, -1 if there isn't one */
+static int find_symbol(char* s, unsigned int hash, SymTable* syms) {
+    int mask = syms->buckets_len - 1;
+    int i = hash & mask;
+    int id;
+    /* linear probing, walk until we find an empty bucket */
+    while (syms->buckets[i]) {
+        id = syms->buckets[i] - 1;
+        if (syms->hashes[id] == hash && compare_symbols(s, syms->table[id], syms))
+            return id;
+        i = (i + 1) & mask;
     }
     return -1;
 }
 
+/* put symbol ID in the first empty bucket for its hash */
+static void insert_symbol(int id, unsigned int hash, SymTable* syms) {
+    int mask = syms->buckets_len - 1;
+    int i = hash & mask;
+    while (syms->buckets[i])
+        i = (i + 1) & mask;
+    syms->buckets[i] = id + 1;
+    syms->hashes[id] = hash;
+}
+
+/* find ID of symbol in a symbols table, -1 if it isn't there */
+int index_of_symbol(char* s, SymTable* syms) {
+    unsigned int hash;
+    hash_symbol(s, &hash, syms);
+    return find_symbol(s, hash, syms);
+}
+
+/* add an already written symbol table entry to the table's hash index, so
+ * index_of_symbol can find it. */
+void index_symbol(int id, SymTable* syms) {
+    unsigned int hash;
+    hash_symbol(syms->table[id], &hash, syms);
+    insert_symbol(id, hash, syms);
+}
+
+/* set up empty symbol and rule tables, allocated out of (and grown within) the
+ * passed arena. Free them with arena_free. */
+void init_tables(Arena* arena, SymTable* syms, RuleTable* rules) {
+    syms->arena = arena;
+    syms->names = arena_alloc(arena, NAM_START);
+    syms->names_len = 0;
+    syms->max_names_len = NAM_START;
+    syms->table = arena_alloc(arena, SYM_START * sizeof(char*));
+    syms->len = 0;
+    syms->max_len = SYM_START;
+    syms->buckets = arena_alloc(arena, SYM_START * 2 * sizeof(int));
+    syms->buckets_len = SYM_START * 2;
+    syms->hashes = arena_alloc(arena, SYM_START * sizeof(unsigned int));
+    rules->syms = syms;
+    rules->entries = arena_alloc(arena, ENT_START * sizeof(RuleEntry));
+    rules->entries_len = 0;
+    rules->max_entries_len = ENT_START;
+    rules->starts = arena_alloc(arena, (RUL_START + 1) * sizeof(int));
+    rules->len = 0;
+    rules->max_len = RUL_START;
+    rules->sparse = NULL;
+    rules->transfers = NULL;
+    /* conventional syntax until a parse says otherwise */
+    syms->delim = '|';
+    syms->parse_constants = 1;
+    syms->names_in_place = 0;
+}
+
+/* double the number of symbols the table can hold */
+static int grow_symbols(RuleTable* rules) {
+    SymTable* syms = rules->syms;
+    size_t old_max = syms->max_len;
+    size_t new_max = old_max * 2;
+    int buckets_len = syms->buckets_len;
+    int i;
+    /* keep at least twice as many buckets as symbols, and a power of two (the
+     * table size isn't necessarily one, see load_image) */
+    while ((size_t)buckets_len < new_max * 2) buckets_len *= 2;
+    syms->table = arena_grow(syms->arena, syms->table, old_max * sizeof(char*), new_max * sizeof(char*));
+    syms->hashes = arena_grow(syms->arena, syms->hashes, old_max * sizeof(unsigned int), new_max * sizeof(unsigned int));
+    syms->buckets = arena_alloc(syms->arena, (size_t)buckets_len * sizeof(int));
+    if (!syms->table || !syms->hashes || !syms->buckets) return 0;
+
+    /* rebuild the hash index with the bigger bucket count */
+    syms->buckets_len = buckets_len;
+    for (i = 0; i < syms->len; i++)
+        insert_symbol(i, syms->hashes[i], syms);
+    syms->max_len = new_max;
+    return 1;
+}
+
+/* make sure there's room in the symbols table for a new symbol at syms->len,
+ * with a name of up to name_size characters (including the null term) at
+ * syms->names_len. Returns 0 if we're out of memory. */
+int reserve_symbol(RuleTable* rules, int name_size) {
+    SymTable* syms = rules->syms;
+    if (syms->names_len + name_size > syms->max_names_len) {
+        /* start a new names array rather than moving the old one, so the
+         * symbols table pointers into it don't need to change */
+        int size = syms->max_names_len * 2;
+        if (size < name_size) size = name_size;
+        if (!(syms->names = arena_alloc(syms->arena, size))) return 0;
+        syms->names_len = 0;
+        syms->max_names_len = size;
+    }
+    if (syms->len < syms->max_len) return 1;
+    return grow_symbols(rules);
+}
+
+/* make sure there's room in the rules table for a new rule at rules->len.
+ * Returns 0 if we're out of memory. */
+int reserve_rule(RuleTable* rules) {
+    size_t max_len = rules->max_len;
+    /* (throwing away whatever's left of a rule that was never finished) */
+    rules->entries_len = rules->starts[rules->len];
+    if (rules->len < rules->max_len) return 1;
+    rules->starts = arena_grow(rules->syms->arena, rules->starts, (max_len + 1) * sizeof(int), (max_len * 2 + 1) * sizeof(int));
+    if (!rules->starts) return 0;
+    if (rules->transfers) {
+        rules->transfers = arena_grow(rules->syms->arena, rules->transfers, max_len * sizeof(int), max_len * 2 * sizeof(int));
+        if (!rules->transfers) return 0;
+    }
+    rules->max_len *= 2;
+    return 1;
+}
+
+/* add lhs and rhs of sym to the rule being built (at rules->len). Returns 0 if
+ * we're out of memory. */
+int add_to_rule(RuleTable* rules, int sym, int lhs, int rhs) {
+    size_t max_len = rules->max_entries_len;
+    RuleEntry* entry;
+    if (rules->entries_len == rules->max_entries_len) {
+        rules->entries = arena_grow(rules->syms->arena, rules->entries, max_len * sizeof(RuleEntry), max_len * 2 * sizeof(RuleEntry));
+        if (!rules->entries) return 0;
+        rules->max_entries_len *= 2;
+    }
+    entry = &rules->entries[rules->entries_len++];
+    entry->sym = sym;
+    entry->lhs = lhs;
+    entry->rhs = rhs;
+    return 1;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return ((RuleEntry*)a)->sym - ((RuleEntry*)b)->sym;
+}
+
+/* end the rule being built, putting its symbols in order and adding together
+ * any that were added more than once */
+void finish_rule(RuleTable* rules) {
+    RuleEntry* entries = &rules->entries[rules->starts[rules->len]];
+    RuleEntry entry;
+    int len = rules->entries_len - rules->starts[rules->len];
+    int i, j, kept = 0;
+    /* (most rules are a handful of symbols, already close to in order) */
+    if (len > 16)
+        qsort(entries, len, sizeof(RuleEntry), compare_entries);
+    for (i = 1; len <= 16 && i < len; i++) {
+        entry = entries[i];
+        for (j = i; j > 0 && entries[j - 1].sym > entry.sym; j--)
+            entries[j] = entries[j - 1];
+        entries[j] = entry;
+    }
+    for (i = 0; i < len; i++) {
+        if (kept && entries[kept - 1].sym == entries[i].sym) {
+            entries[kept - 1].lhs += entries[i].lhs;
+            entries[kept - 1].rhs += entries[i].rhs;
+        }
+        else
+            entries[kept++] = entries[i];
+    }
+    /* a symbol with none on either side (e.g. x:0) isn't really in the rule */
+    for (i = 0, len = kept, kept = 0; i < len; i++)
+        if (entries[i].lhs || entries[i].rhs)
+            entries[kept++] = entries[i];
+    rules->entries_len = rules->starts[rules->len] + kept;
+    rules->len++;
+    rules->starts[rules->len] = rules->entries_len;
+}
+
+/* the entry for sym in the rule, NULL if it isn't in it */
+RuleEntry* rule_entry(RuleTable* rules, int rule, int sym) {
+    int low = rules->starts[rule];
+    int high = rules->starts[rule + 1];
+    int mid;
+    /* (binary search, entries are in order of symbol) */
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (rules->entries[mid].sym == sym) return &rules->entries[mid];
+        if (rules->entries[mid].sym < sym)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
 /* walk to the end of a multiplicity/constant number, filling the passed count
  * int with the parsed number's value */
 char* walk_number(char* s, int* count) {
@@ -98,33 +326,49 @@ char* walk_number(char* s, int* count) {
 
 /* walk to the end of the next symbol, adding it to the symbol table if it
  * hasn't been seen before. (and store the index to that symbol, as well as
- * count if we're handling constants) */ 
-static char* walk_symbol(char* s, int* id, SymTable* syms, int* count) {
+ * count if we're handling constants) Returns NULL if we're out of memory. */ 
+static char* walk_symbol(char* s, int* id, RuleTable* rules, int* count) {
+    SymTable* syms = rules->syms;
+    unsigned int hash;
+    char* name; /* where we're writing a new symbol's name */
+    char* end; /* where the symbol stops, (delimiter, end of fact syntax, or start of a number) */
     s = walk_whitespace(s);
-    *id = index_of_symbol(s, syms);
+    end = hash_symbol(s, &hash, syms);
+    *id = find_symbol(s, hash, syms);
     *count = 1; /* reset count, otherwise a "||x:5, y" is mistakenly made "||x:5, y:5" */
     if (*id > -1) {
-        /* we've seen this symbol before, so just walk to the end of it 
-         * (when we see a delimiter or end of fact syntax, or start of a number) */
-        while (s[0] && s[0] != delim && s[0] != ',' && (s[0] != ':' || !parse_constants)) {
-            s++;
-        }
+        /* we've seen this symbol before, so just jump to the end of it */
+        s = end;
         /* handle implicit constants if applicable and we see the ':' syntax */
-        if (s[0] == ':' && parse_constants) {
+        if (s[0] == ':' && syms->parse_constants) {
             s = walk_number(s + 1, count); /* we're at a ':', so +1 skips that to check for any ws afterwards */
         }
         return s;
     }
 
     /* new symbol found! Woo! */
-    /* assign the next symbol in the symbols table to the current position of
-     * the symbol names string. */
-    syms->table[syms->len] = &(syms->names[syms->names_len]);
+    if (syms->names_in_place) {
+        /* the character before the symbol is a delimiter, comma or whitespace
+         * we've already walked past, and the name is never longer than it is
+         * in the source, so it can be written over the source starting there
+         * without reaching the end of the symbol */
+        if (!reserve_symbol(rules, 0)) return NULL;
+        name = s - 1;
+    }
+    else {
+        /* make sure there's room for it first, the name can't be longer than
+         * it is in the source */
+        if (!reserve_symbol(rules, end - s + 1)) return NULL;
+        name = &(syms->names[syms->names_len]);
+    }
+    /* assign the next symbol in the symbols table to where we're writing the
+     * name. */
+    syms->table[syms->len] = name;
     syms->len = syms->len + 1;
-    /* write the symbol string to the names array */
-    while (s[0] && s[0] != delim && s[0] != ',' && (s[0] != ':' || !parse_constants)) {
-        syms->names[syms->names_len] = s[0];
-        syms->names_len++;
+    /* write the symbol string */
+    while (s[0] && s[0] != syms->delim && s[0] != ',' && (s[0] != ':' || !syms->parse_constants)) {
+        *name = s[0];
+        name++;
         /* skip anything more than one whitespace. TODO: should eventually be
          * sep pass */
         if (*s == ' ') {
@@ -133,14 +377,17 @@ static char* walk_symbol(char* s, int* id, SymTable* syms, int* count) {
         *s++;
     }
     /* handle implicit constants if applicable and we see the ':' syntax */
-    if (s[0] == ':' && parse_constants) {
+    if (s[0] == ':' && syms->parse_constants) {
         s = walk_number(s + 1, count); /* we're at a ':', so +1 skips that to check for any ws afterwards */
     }
-    syms->names_len++; /* increment once more to ensure a null term between names */
+    *name = 0; /* null term between names */
+    if (!syms->names_in_place)
+        syms->names_len = name - syms->names + 1;
     /* trim any whitespace off the end TODO: this should eventually be sep 
      * pass */
-    trim(&syms->table[syms->len - 1]);
+    trim(syms->table[syms->len - 1], name);
     *id = syms->len - 1;
+    insert_symbol(*id, hash, syms);
     return s;
 }
 
@@ -148,10 +395,11 @@ static char* walk_rule(char* s, RuleTable* rules) {
     int sym_id; /* used to track symbol count */
     int count = 1; /* number to add for walked symbol if we're parsing implicit constants */
     int still_parsing_side = 1;
+    if (!reserve_rule(rules)) return NULL;
     /* process left-hand side, the rule condition. */
     while(still_parsing_side) {
-        s = walk_symbol(s, &sym_id, rules->syms, &count);
-        rules->table[rules->len * rules->syms->max_len * 2 + sym_id] += count;
+        if (!(s = walk_symbol(s, &sym_id, rules, &count))) return NULL;
+        if (!add_to_rule(rules, sym_id, count, 0)) return NULL;
         if (s[0] == ',') 
             s++;
         else 
@@ -159,20 +407,20 @@ static char* walk_rule(char* s, RuleTable* rules) {
     }
     /* process right-hand side, the rule results. */
     /* we should be at a delimiter, indicating end of condition/start of results */
-    if (s[0] != delim)
+    if (s[0] != rules->syms->delim)
         printf("Broken rule?!\n"); /* TODO: figure out better way to do error reporting */
     s++;
     s = walk_whitespace(s);
-    still_parsing_side = (s[0] && s[0] != delim);
+    still_parsing_side = (s[0] && s[0] != rules->syms->delim);
     while (still_parsing_side) {
-        s = walk_symbol(s, &sym_id, rules->syms, &count);
-        rules->table[rules->len * rules->syms->max_len * 2 + sym_id + rules->syms->max_len] += count;
+        if (!(s = walk_symbol(s, &sym_id, rules, &count))) return NULL;
+        if (!add_to_rule(rules, sym_id, 0, count)) return NULL;
         if (s[0] == ',')
             s++;
         else
             still_parsing_side = 0;
     }
-    rules->len++;
+    finish_rule(rules);
     return walk_whitespace(s);
 }
 
@@ -181,18 +429,50 @@ static char* walk_fact(char* s, RuleTable* rules) {
     int sym_id;
     int count = 1; /* number to add for walked symbol if we're parsing implicit constants */
     int still_parsing = 1;
+    if (!reserve_rule(rules)) return NULL;
     while (still_parsing) {
-        s = walk_symbol(s, &sym_id, rules->syms, &count);
-        rules->table[rules->len * rules->syms->max_len * 2 + sym_id + rules->syms->max_len] += count;
+        if (!(s = walk_symbol(s, &sym_id, rules, &count))) return NULL;
+        if (!add_to_rule(rules, sym_id, 0, count)) return NULL;
         if (s[0] == ',')
             s++;
         else
             still_parsing = 0;
     }
-    rules->len++;
+    finish_rule(rules);
     return s;
 }
 
+/* parse the rule or fact whose opening delimiter s is just after */
+static char* walk_entry(char* s, RuleTable* rules) {
+    if (s[0] == rules->syms->delim) {
+        /* if we find another delimiter immediately after, we know it's a
+         * fact, e.g. `|| this is a fact` */
+        return walk_fact(s + 1, rules);
+    }
+    /* instead of a rule which starts with a single delimiter, e.g.
+     * `|this is a condition| this is the result` */
+    return walk_rule(s, rules);
+}
+
+/* parse every rule and fact in s, using the delimiter and constants settings
+ * on the rules' symbol table */
+static int parse_rules(char* s, RuleTable* rules) {
+    s = walk_whitespace(s);
+    while (s[0]) {
+        s = walk_whitespace(s);
+        if (s[0] == rules->syms->delim) {
+            if (!(s = walk_entry(s + 1, rules))) {
+                printf("Out of memory\n");
+                return 0;
+            }
+        } else if (s[0]) {
+            printf("Unexpected ending: [%c]%s]\n", s[0], s);
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* implicit_constants_pass of 1 means we automatically transcribe any 'x:NUM' symbols
  * into correct counts, without generating separate rules to do so. */
 int parse(char* s, RuleTable* rules, int implicit_constants_pass) {
@@ -200,25 +480,286 @@ int parse(char* s, RuleTable* rules, int implicit_constants_pass) {
      * conventionally '|', but can be anything.
      * (spacer glyph is the terminology used in
      * https://wiki.xxiivv.com/site/vera.html) */
-    delim = s[0];
-    parse_constants = implicit_constants_pass;
+    rules->syms->delim = s[0];
+    rules->syms->parse_constants = implicit_constants_pass;
+    rules->syms->names_in_place = 0;
+    return parse_rules(s, rules);
+}
+
+int parse_fact(char* s, RuleTable* rules, RuleTable* unknown, int* ids, int* counts) {
+    SymTable* syms = rules->syms;
+    int len = 0;
     s = walk_whitespace(s);
+    if (s[0] != syms->delim || s[1] != syms->delim) return -1;
+    s = walk_whitespace(s + 2);
+    /* (the names would otherwise be written over s, see parse_file) */
+    syms->names_in_place = 0;
+    if (unknown) {
+        unknown->syms->delim = syms->delim;
+        unknown->syms->parse_constants = syms->parse_constants;
+        unknown->syms->names_in_place = 0;
+    }
     while (s[0]) {
         s = walk_whitespace(s);
-        if (s[0] == delim) {
-            if (s[1] == delim) {
-                /* if we find another delimiter immediately after, we know it's a
-                 * fact, e.g. `|| this is a fact` */
-                s = walk_fact(s + 2, rules);
-            } else {
-                /* instead of a rule which starts with a single delimiter, e.g.
-                 * `|this is a condition| this is the result` */
-                s = walk_rule(s + 1, rules);
+        if (unknown && index_of_symbol(s, syms) == -1) {
+            if (!(s = walk_symbol(s, &ids[len], unknown, &counts[len]))) return -1;
+            ids[len] += syms->len;
+        }
+        else if (!(s = walk_symbol(s, &ids[len], rules, &counts[len]))) return -1;
+        len++;
+        if (s[0] != ',') break;
+        s++;
+    }
+    return walk_whitespace(s)[0] ? -1 : len;
+}
+
+/* where we are in a rule while looking for rule starts, see parse_stream */
+enum { IN_BODY, IN_LHS, AFTER_OPEN };
+
+/* parse source read from f a chunk at a time. Only the rules that are
+ * complete so far get parsed, whatever is left over (a rule split across
+ * chunks) is carried into the next read, so the source never has to be in
+ * memory all at once. */
+int parse_stream(FILE* f, RuleTable* rules, int implicit_constants_pass) {
+    size_t size = CHUNK_SZ * 2;
+    size_t len = 0; /* how much is in buf */
+    size_t scanned = 0; /* how far into buf we've looked for rule starts */
+    size_t cut; /* last place a rule starts, parse everything before it */
+    size_t got;
+    int state = IN_BODY;
+    int first_chunk = 1;
+    int ok = 1;
+    char delim = 0;
+    char saved;
+    char* buf = malloc(size);
+    char* grown;
+    char* next;
+    if (!buf) return !printf("Out of memory\n");
+    rules->syms->parse_constants = implicit_constants_pass;
+    rules->syms->names_in_place = 0;
+    while (ok) {
+        /* a single rule bigger than what's left in the buffer needs more */
+        if (len + CHUNK_SZ + 1 > size) {
+            if (!(grown = realloc(buf, size * 2))) {
+                ok = !printf("Out of memory\n");
+                break;
             }
-        } else if (s) {
-            printf("Unexpected ending: [%c]%s]\n", s[0], s);
-            return 0;
+            buf = grown;
+            size *= 2;
+        }
+        if (!(got = fread(&buf[len], 1, CHUNK_SZ, f))) break;
+        if (first_chunk) delim = rules->syms->delim = buf[0]; /* first character of the source */
+        first_chunk = 0;
+        len += got;
+
+        /* A delimiter starts a new rule unless it closes a rule's LHS, so
+         * track which side of the rule we're on. After a rule starts, the
+         * next character tells us if it's a fact (straight to the body) */
+        cut = 0;
+        while (scanned < len) {
+            if (state == AFTER_OPEN) {
+                state = buf[scanned] == delim ? IN_BODY : IN_LHS;
+                scanned++;
+                continue;
+            }
+            /* nothing but a delimiter changes the state, so skip to the next */
+            if (!(next = memchr(&buf[scanned], delim, len - scanned))) {
+                scanned = len;
+                break;
+            }
+            scanned = next - buf;
+            if (state == IN_LHS)
+                state = IN_BODY;
+            else {
+                cut = scanned;
+                state = AFTER_OPEN;
+            }
+            scanned++;
         }
+        if (!cut) continue;
+
+        /* parse everything up to the last rule start, then move the rest to
+         * the front to be finished off by the next chunk */
+        saved = buf[cut];
+        buf[cut] = 0;
+        ok = parse_rules(buf, rules);
+        buf[cut] = saved;
+        memmove(buf, &buf[cut], len - cut);
+        len -= cut;
+        scanned -= cut;
+    }
+    if (ok && len) {
+        buf[len] = 0;
+        ok = parse_rules(buf, rules);
+    }
+    free(buf);
+    return ok;
+}
+
+/* one piece of the source for parse_parallel, parsed into its own tables */
+typedef struct ParseChunk {
+    /* where the chunk starts. For every chunk but the first this is the
+     * opening delimiter of a rule, which gets overwritten with a null term to
+     * end the chunk before it. */
+    char* start;
+    Arena arena;
+    SymTable syms;
+    RuleTable rules;
+    int ok;
+} ParseChunk;
+
+/* the work shared between parse_parallel's threads */
+typedef struct ParseJob {
+    ParseChunk* chunks;
+    int len;
+    atomic_int next; /* next chunk for a thread to pick up */
+    char delim;
+    int parse_constants;
+} ParseJob;
+
+/* keep grabbing and parsing chunks until there aren't any left */
+static void* parse_worker(void* arg) {
+    ParseJob* job = arg;
+    ParseChunk* chunk;
+    char* s;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->len) {
+        chunk = &job->chunks[i];
+        init_tables(&chunk->arena, &chunk->syms, &chunk->rules);
+        chunk->syms.delim = job->delim;
+        chunk->syms.parse_constants = job->parse_constants;
+        /* names have to be copied, writing them in place could reach back
+         * over the null term that ends the chunk before */
+        chunk->syms.names_in_place = 0;
+        if (i == 0)
+            chunk->ok = parse_rules(chunk->start, &chunk->rules);
+        else if (!(s = walk_entry(chunk->start + 1, &chunk->rules)))
+            chunk->ok = !printf("Out of memory\n");
+        else
+            chunk->ok = parse_rules(s, &chunk->rules);
+    }
+    return NULL;
+}
+
+/* add the symbols and rules from one chunk's tables onto the end of the
+ * passed tables, renumbering symbols to match */
+static int merge_tables(RuleTable* rules, RuleTable* from) {
+    SymTable* syms = rules->syms;
+    int* ids = arena_alloc(from->syms->arena, ((size_t)from->syms->len + 1) * sizeof(int));
+    char* name;
+    int i, k, size;
+    if (!ids) return 0;
+
+    /* going through the chunk's symbols in order keeps IDs in order of first
+     * appearance, same as parsing the whole source at once */
+    for (i = 0; i < from->syms->len; i++) {
+        name = from->syms->table[i];
+        ids[i] = find_symbol(name, from->syms->hashes[i], syms);
+        if (ids[i] > -1) continue;
+        size = strlen(name) + 1;
+        if (!reserve_symbol(rules, size)) return 0;
+        syms->table[syms->len] = memcpy(&(syms->names[syms->names_len]), name, size);
+        syms->names_len += size;
+        ids[i] = syms->len;
+        syms->len++;
+        insert_symbol(ids[i], from->syms->hashes[i], syms);
+    }
+
+    for (i = 0; i < from->len; i++) {
+        if (!reserve_rule(rules)) return 0;
+        for (k = from->starts[i]; k < from->starts[i + 1]; k++)
+            if (!add_to_rule(rules, ids[from->entries[k].sym], from->entries[k].lhs, from->entries[k].rhs))
+                return 0;
+        finish_rule(rules);
     }
     return 1;
 }
+
+/* parse s by splitting it at rule boundaries into chunks, parsing the chunks
+ * on up to the passed number of threads, then merging each chunk's symbol
+ * and rule tables (in order) into the passed tables. s gets written to while
+ * parsing but is put back the way it was. */
+int parse_parallel(char* s, RuleTable* rules, int implicit_constants_pass, int threads) {
+    size_t len = strlen(s);
+    char* end = s + len;
+    char* p = s;
+    int count = threads * 4; /* extra chunks so faster threads pick up slack */
+    int state = IN_BODY;
+    int ok = 1;
+    int i;
+    pthread_t* workers;
+    ParseJob job;
+
+    if ((size_t)count > len / CHUNK_SZ) count = (int)(len / CHUNK_SZ);
+    if (threads < 2 || count < 2)
+        return parse(s, rules, implicit_constants_pass);
+    if (!(job.chunks = calloc(count, sizeof(ParseChunk))) || !(workers = calloc(threads, sizeof(pthread_t)))) {
+        free(job.chunks);
+        return !printf("Out of memory\n");
+    }
+    job.delim = rules->syms->delim = s[0];
+    job.parse_constants = rules->syms->parse_constants = implicit_constants_pass;
+    rules->syms->names_in_place = 0;
+    atomic_init(&job.next, 0);
+
+    /* find rule starts the same way parse_stream does, but since only
+     * delimiters change the state we can jump between them with memchr. Cut
+     * at the first rule start past each evenly spaced target. */
+    job.chunks[0].start = s;
+    job.len = 1;
+    while (job.len < count && p < end && (p = memchr(p, job.delim, end - p))) {
+        if (state == IN_LHS) {
+            state = IN_BODY;
+            p++;
+            continue;
+        }
+        if (p != s && (size_t)(p - s) >= len / count * job.len)
+            job.chunks[job.len++].start = p;
+        state = p[1] == job.delim ? IN_BODY : IN_LHS;
+        p += state == IN_BODY ? 2 : 1;
+    }
+    for (i = 1; i < job.len; i++)
+        *job.chunks[i].start = 0;
+
+    if (threads > job.len) threads = job.len;
+    for (i = 1; i < threads; i++)
+        pthread_create(&workers[i], NULL, parse_worker, &job);
+    parse_worker(&job);
+    for (i = 1; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    for (i = 0; i < job.len; i++) {
+        if (i > 0) *job.chunks[i].start = job.delim;
+        if (ok) ok = job.chunks[i].ok && merge_tables(rules, &job.chunks[i].rules);
+        arena_free(&job.chunks[i].arena);
+    }
+    free(workers);
+    free(job.chunks);
+    return ok;
+}
+
+/* parse the (already opened) source file f by mapping it into memory rather
+ * than reading it. New symbol names are written into the mapping (a private
+ * copy, the file itself is untouched) so they point at the source instead of
+ * being copied into syms->names. The mapping lasts until the table's arena is
+ * freed. With more than one thread, big files are parsed with parse_parallel
+ * instead (which does copy names). Falls back to parse_stream for anything
+ * that can't be mapped, like a pipe. Returns -1 if the file is empty. */
+int parse_file(FILE* f, RuleTable* rules, int implicit_constants_pass, int threads) {
+    struct stat st;
+    char* src;
+    int ok;
+    if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode))
+        return parse_stream(f, rules, implicit_constants_pass);
+    if (!st.st_size) return -1;
+    if (!(src = arena_map_file(rules->syms->arena, fileno(f), st.st_size)))
+        return parse_stream(f, rules, implicit_constants_pass);
+    if (threads > 1)
+        return parse_parallel(src, rules, implicit_constants_pass, threads);
+    rules->syms->delim = src[0];
+    rules->syms->parse_constants = implicit_constants_pass;
+    rules->syms->names_in_place = 1;
+    ok = parse_rules(src, rules);
+    rules->syms->names_in_place = 0;
+    return ok;
+}
@@ -17,12 +17,23 @@ WITH REGARD TO THIS SOFTWARE.
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdio.h>
+#include "arena.h"
+
 /* ----------------------------------------------
 Table relating internal symbols as pointers to where their string names are,
 so if source is "apple, some fruit":
 
 names = ['a', 'p', 'p', 'l', 'e', 0x0, 's', 'o', 'm', 'e', ' ', 'f', 'r', 'u', 'i', 't', 0x0]
 table = [(pointer to names[0]), (pointer to names[6])]
+
+Lookups go through a hash of each name (buckets/hashes) rather than comparing
+against every symbol in the table.
+
+All of the arrays come out of the table's arena and grow as symbols are added
+(see init_tables/reserve_symbol). When the current names array fills up a new
+one is started rather than moving the old, so pointers in table stay valid.
+(Symbols parsed with parse_file point into the mapped source instead.)
 ---------------------------------------------- */
 typedef struct SymTable {
     /* pointer to an array of all unique symbol names separated by null terms */
@@ -34,41 +45,108 @@ typedef struct SymTable {
     int max_len; /* bounds for the syms table */
     /* the last stop within the names string array, start next new symbol here. */
     int names_len;
-    /* int max_names_len */
+    int max_names_len; /* bounds for the current names array */
+    /* hash index over the symbols table for O(1) lookups by name, see
+     * index_of_symbol. Each bucket holds a symbol ID + 1, with 0 meaning the
+     * bucket is empty, so a zeroed array is an empty index. buckets_len must be
+     * a power of two and larger than max_len. */
+    int* buckets;
+    int buckets_len;
+    /* hash of each symbol's (whitespace-normalized) name, by symbol ID */
+    unsigned int* hashes;
+    Arena* arena; /* where all of the above lives */
+    /* the syntax symbols were parsed with, which decides where a symbol name
+     * ends when looking one up. Set by the parse functions. */
+    char delim; /* the spacer glyph delimiter, conventionally '|' */
+    int parse_constants; /* whether to automatically handle x:100 type multiplicity syntax */
+    /* whether new symbol names get written over the source rather than into
+     * names (see parse_file) */
+    int names_in_place;
 } SymTable;
 
 /* ----------------------------------------------
-Table where each row has counts of symbols on LHS and counts of symbols on RHS of a rule,
-so if source was: (given symbol table example above)
+Each rule is a list of the symbols in it, with how many of each are on its LHS
+and RHS, so if source was: (given symbol table example above)
 
 |apple, apple| some fruit
 || apple, apple
 
-table = [2, 0, 0, 1, 0, 0, 2, 0]
-         ^LHS0 ^RHS0 ^LHS1 ^RHS1
-
-Note that I'm assuming a single dimensional rules table, do math manually
-because it's too weird and annoying to figure out how to correctly pass around
-a two dimensional array of unknown dimensions.
+starts = [0, 2, 3]
+entries = [(0, 2, 0), (1, 0, 1), (0, 0, 2)]
+           ^rule 0               ^rule 1
 
-Specifically, accessing symbol index 1 of the righthand side for the 4th rule would be:
+Rule i's entries are entries[starts[i]] up to (not including)
+entries[starts[i + 1]], one per symbol in the rule, in order of symbol ID. So
+the table only takes up as much as the program has in it, however many
+symbols there are.
 
-mytable.table[3 * mytable.syms->max_len * 2 + 1 + mytable.syms->max_len]
-              ^row                      !!!   ^col
+A rule is built by reserve_rule, then add_to_rule for each of its symbols (in
+any order, more than once is fine), then finish_rule. starts[len] is always
+where the rule being built starts.
 ---------------------------------------------- */
+typedef struct RuleEntry {
+    int sym;
+    int lhs; /* count on the LHS */
+    int rhs; /* count on the RHS */
+} RuleEntry;
+
 typedef struct RuleTable {
     SymTable* syms;
-    int* table;
+    RuleEntry* entries;
+    int entries_len;
+    int max_entries_len;
+    int* starts; /* max_len + 1 of them */
     int len; /* current number/position of rules in table */
     int max_len; /* bounds for the rules table */
+    /* compressed copy of the table the interpreter runs from, built on demand
+     * (see sparse.h) */
+    struct SparseRules* sparse;
+    /* 1 for each rule that's a native transfer (see variables_pass.h), grown
+     * along with the table. NULL until a pass adds the first one. */
+    int* transfers;
 } RuleTable;
 
-/* check if two passed symbols are the same */
-int compare_symbols(char* a, char* b);
+/* set up empty symbol and rule tables, allocated out of (and grown within) the
+ * passed arena. Free them with arena_free. */
+void init_tables(Arena* arena, SymTable* syms, RuleTable* rules);
+
+/* make sure there's room in the symbols table for a new symbol at syms->len,
+ * with a name of up to name_size characters (including the null term) at
+ * syms->names_len. Returns 0 if we're out of memory. */
+int reserve_symbol(RuleTable* rules, int name_size);
+
+/* start a new rule at rules->len, making sure there's room for it. Returns 0
+ * if we're out of memory. */
+int reserve_rule(RuleTable* rules);
 
-/* find ID of symbol in a symbols table */
+/* add lhs and rhs of sym to the rule being built (at rules->len). Returns 0 if
+ * we're out of memory. */
+int add_to_rule(RuleTable* rules, int sym, int lhs, int rhs);
+
+/* end the rule being built, putting its symbols in order and adding together
+ * any that were added more than once */
+void finish_rule(RuleTable* rules);
+
+/* the entry for sym in the rule, NULL if it isn't in it */
+RuleEntry* rule_entry(RuleTable* rules, int rule, int sym);
+
+/* check if two passed symbols are the same (a is allowed to be in source, so
+ * can end at the delimiter etc. of the symbols table) */
+int compare_symbols(char* a, char* b, SymTable* syms);
+
+/* hash a symbol name the way compare_symbols sees it: stop at the end of the
+ * symbol, treat a space followed by more whitespace as a single space, and
+ * ignore trailing whitespace. Returns a pointer to where the symbol ends. */
+char* hash_symbol(char* s, unsigned int* hash, SymTable* syms);
+
+/* find ID of symbol in a symbols table, -1 if it isn't there */
 int index_of_symbol(char* s, SymTable* syms);
 
+/* add an already written symbol table entry to the table's hash index, so
+ * index_of_symbol can find it. (The parser does this itself, this is for
+ * passes that add their own symbols.) */
+void index_symbol(int id, SymTable* syms);
+
 /* walk to the end of a multiplicity/constant number, filling the passed count
  * int with the parsed number's value */
 char* walk_number(char* s, int* count);
@@ -77,4 +155,31 @@ char* walk_number(char* s, int* count);
  * into correct counts, without generating separate rules to do so. */
 int parse(char* s, RuleTable* rules, int implicit_constants_pass);
 
+/* parse a single fact (`|| x:5, y`) in s, with the syntax the rules were
+ * parsed with, into the ID and count of each of its symbols. Symbols the table
+ * hasn't seen are added to it, or if unknown isn't NULL, to unknown's table
+ * instead (leaving the rules' table as it was), with IDs that carry on from
+ * the rules' symbols: unknown's symbol i is ID rules->syms->len + i. ids and
+ * counts need room for one more than the number of commas in s. Returns the
+ * number of symbols, or -1 if s isn't just one fact (or we're out of memory). */
+int parse_fact(char* s, RuleTable* rules, RuleTable* unknown, int* ids, int* counts);
+
+/* parse source read from f a chunk at a time, rules can span chunks. Only a
+ * chunk (plus any unfinished rule) is in memory at once. */
+int parse_stream(FILE* f, RuleTable* rules, int implicit_constants_pass);
+
+/* parse the (already opened) source file f by mapping it into memory instead
+ * of reading it, new symbol names point into the mapping rather than being
+ * copied into syms->names. The mapping is released by arena_free. Pass more
+ * than one thread to use parse_parallel on the mapping. Falls back to
+ * parse_stream if f can't be mapped (e.g. a pipe). Returns -1 if the file is
+ * empty. */
+int parse_file(FILE* f, RuleTable* rules, int implicit_constants_pass, int threads);
+
+/* parse s on up to the passed number of threads, by splitting it into chunks
+ * at rule boundaries, parsing each chunk into its own tables, then merging
+ * them. Symbol IDs and rule order come out the same as with parse. s is
+ * written to while parsing, but put back the way it was. */
+int parse_parallel(char* s, RuleTable* rules, int implicit_constants_pass, int threads);
+
 #endif
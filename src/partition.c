@@ -0,0 +1,181 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include "partition.h"
+
+/* root of the symbol's group (union-find, halving the path on the way) */
+static int find(int* parent, int s) {
+    while (parent[s] != s)
+        s = parent[s] = parent[parent[s]];
+    return s;
+}
+
+/* put every symbol the rule touches in the group of its first LHS symbol */
+static void join_rule(SparseRules* sparse, int rule, int* parent) {
+    int root = find(parent, sparse->lhs[sparse->lhs_start[rule]]);
+    int k, other;
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++)
+        if ((other = find(parent, sparse->lhs[k])) != root) parent[other] = root;
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++)
+        if ((other = find(parent, sparse->delta_syms[k])) != root) parent[other] = root;
+}
+
+/* allocate the partition's arrays, with rules.len, and the lhs_start and
+ * delta_start totals in the last slot of each, already counted */
+static int alloc_partition(Partition* part, int lhs_len, int deltas_len, int transfers) {
+    int len = part->rules.len;
+    part->symbols = malloc((part->syms.len + 1) * sizeof(int));
+    part->accumulator = calloc(part->syms.len + 1, sizeof(int));
+    part->sparse.lhs_start = malloc((len + 1) * sizeof(int));
+    part->sparse.lhs = malloc((lhs_len + 1) * sizeof(int));
+    part->sparse.lhs_counts = malloc((lhs_len + 1) * sizeof(int));
+    part->sparse.delta_start = malloc((len + 1) * sizeof(int));
+    part->sparse.delta_syms = malloc((deltas_len + 1) * sizeof(int));
+    part->sparse.deltas = malloc((deltas_len + 1) * sizeof(int));
+    if (transfers) part->sparse.transfers = malloc((len + 1) * sizeof(int));
+    part->syms.max_len = part->syms.len;
+    part->rules.syms = &part->syms;
+    part->rules.max_len = len;
+    part->rules.sparse = &part->sparse;
+    part->rules.transfers = part->sparse.transfers;
+    /* (filled in as the rules are copied over) */
+    part->sparse.len = 0;
+    if (part->sparse.lhs_start) part->sparse.lhs_start[0] = 0;
+    if (part->sparse.delta_start) part->sparse.delta_start[0] = 0;
+    return part->symbols && part->accumulator && part->sparse.lhs_start
+        && part->sparse.lhs && part->sparse.lhs_counts && part->sparse.delta_start
+        && part->sparse.delta_syms && part->sparse.deltas
+        && (!transfers || part->sparse.transfers);
+}
+
+/* copy the rule over to the end of its partition, with local symbol IDs */
+static void copy_rule(SparseRules* sparse, int rule, Partition* part, int* local) {
+    SparseRules* to = &part->sparse;
+    int i = to->len;
+    int k, n;
+    n = to->lhs_start[i];
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++, n++) {
+        to->lhs[n] = local[sparse->lhs[k]];
+        to->lhs_counts[n] = sparse->lhs_counts[k];
+    }
+    to->lhs_start[i + 1] = n;
+    n = to->delta_start[i];
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++, n++) {
+        to->delta_syms[n] = local[sparse->delta_syms[k]];
+        to->deltas[n] = sparse->deltas[k];
+    }
+    to->delta_start[i + 1] = n;
+    if (to->transfers) to->transfers[i] = sparse->transfers[rule];
+    to->len++;
+}
+
+int init_partitions(Partitions* partitions, RuleTable* rules) {
+    SparseRules* sparse = sparse_rules(rules);
+    int syms_len = rules->syms->len;
+    int* parent = NULL;
+    int* group = NULL; /* partition of each group root, -1 for none yet */
+    int* local = NULL; /* local ID of each symbol, -1 if no rule uses it */
+    int* sizes = NULL; /* LHS and delta totals of each partition */
+    int ok = 0;
+    int i, k, s, p;
+
+    partitions->len = 0;
+    partitions->parts = NULL;
+    if (!sparse || sparse->len < 0) return 0;
+    parent = malloc((syms_len + 1) * sizeof(int));
+    group = malloc((syms_len + 1) * sizeof(int));
+    local = malloc((syms_len + 1) * sizeof(int));
+    if (!parent || !group || !local) goto done;
+    for (s = 0; s < syms_len; s++) {
+        parent[s] = s;
+        group[s] = local[s] = -1;
+    }
+    for (i = 0; i < sparse->len; i++)
+        if (sparse->lhs_start[i] != sparse->lhs_start[i + 1])
+            join_rule(sparse, i, parent);
+
+    /* number the partitions in order of their first rule */
+    for (i = 0; i < sparse->len; i++) {
+        if (sparse->lhs_start[i] == sparse->lhs_start[i + 1]) continue;
+        s = find(parent, sparse->lhs[sparse->lhs_start[i]]);
+        if (group[s] == -1) group[s] = partitions->len++;
+    }
+    partitions->parts = calloc(partitions->len + 1, sizeof(Partition));
+    sizes = calloc(partitions->len * 2 + 1, sizeof(int));
+    if (!partitions->parts || !sizes) goto done;
+    for (i = 0; i < sparse->len; i++) {
+        if (sparse->lhs_start[i] == sparse->lhs_start[i + 1]) continue;
+        p = group[find(parent, sparse->lhs[sparse->lhs_start[i]])];
+        partitions->parts[p].rules.len++;
+        sizes[p * 2] += sparse->lhs_start[i + 1] - sparse->lhs_start[i];
+        sizes[p * 2 + 1] += sparse->delta_start[i + 1] - sparse->delta_start[i];
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            local[sparse->lhs[k]] = 0;
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            local[sparse->delta_syms[k]] = 0;
+    }
+    /* local IDs go up with the program's, so each rule's symbols stay in
+     * order (which the interpreter relies on, see sparse.h) */
+    for (s = 0; s < syms_len; s++)
+        if (local[s] != -1)
+            local[s] = partitions->parts[group[find(parent, s)]].syms.len++;
+    for (p = 0; p < partitions->len; p++)
+        if (!alloc_partition(&partitions->parts[p], sizes[p * 2], sizes[p * 2 + 1], sparse->transfers != NULL))
+            goto done;
+    for (s = 0; s < syms_len; s++)
+        if (local[s] != -1)
+            partitions->parts[group[find(parent, s)]].symbols[local[s]] = s;
+    for (i = 0; i < sparse->len; i++)
+        if (sparse->lhs_start[i] != sparse->lhs_start[i + 1])
+            copy_rule(sparse, i, &partitions->parts[group[find(parent, sparse->lhs[sparse->lhs_start[i]])]], local);
+    ok = 1;
+
+done:
+    free(parent);
+    free(group);
+    free(local);
+    free(sizes);
+    if (!ok) free_partitions(partitions);
+    return ok;
+}
+
+void free_partitions(Partitions* partitions) {
+    Partition* part;
+    int p;
+    for (p = 0; partitions->parts && p < partitions->len; p++) {
+        part = &partitions->parts[p];
+        free(part->symbols);
+        free(part->accumulator);
+        free(part->sparse.lhs_start);
+        free(part->sparse.lhs);
+        free(part->sparse.lhs_counts);
+        free(part->sparse.delta_start);
+        free(part->sparse.delta_syms);
+        free(part->sparse.deltas);
+        free(part->sparse.transfers);
+    }
+    free(partitions->parts);
+    partitions->parts = NULL;
+    partitions->len = 0;
+}
+
+void partition_load(Partition* part, int* accumulator) {
+    int i;
+    for (i = 0; i < part->syms.len; i++)
+        part->accumulator[i] = accumulator[part->symbols[i]];
+}
+
+void partition_store(Partition* part, int* accumulator) {
+    int i;
+    for (i = 0; i < part->syms.len; i++)
+        accumulator[part->symbols[i]] = part->accumulator[i];
+}
@@ -0,0 +1,64 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Splitting a program into independent parts. Two rules that never touch the
+ * same symbol can't affect each other: firing one never enables, disables or
+ * changes the executions of the other. So if the rules fall into groups that
+ * share no symbols, each group runs exactly as it would on its own, and
+ * running every group to the end (in any order, or all at once) leaves the
+ * same bag as running the whole program to the end. Only the interleaving of
+ * the steps is different, so this is for running to completion, not for a
+ * set number of steps. */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "parser.h"
+#include "sparse.h"
+
+/* ----------------------------------------------
+A group of rules with its own numbering of just the symbols it uses, so it
+can be run with its own (small) accumulator:
+
+symbols[local] is the program's symbol ID for each local symbol ID
+rules and sparse are the group's rules, in the same order as in the program,
+over the local symbol IDs (rules has no entries, only the sparse layout)
+accumulator is the group's slice of the bag, see partition_load/partition_store
+---------------------------------------------- */
+typedef struct Partition {
+    int* symbols;
+    int* accumulator;
+    SymTable syms; /* (only len and max_len are set) */
+    RuleTable rules;
+    SparseRules sparse;
+} Partition;
+
+/* Facts aren't in any partition (they never fire), nor are symbols no rule
+ * uses. */
+typedef struct Partitions {
+    int len;
+    Partition* parts;
+} Partitions;
+
+/* split the rules into partitions that share no symbols, ordered by their
+ * first rule. Returns 0 if out of memory. */
+int init_partitions(Partitions* partitions, RuleTable* rules);
+
+/* free everything init_partitions allocated */
+void free_partitions(Partitions* partitions);
+
+/* copy the partition's symbols out of the program's accumulator into its own */
+void partition_load(Partition* part, int* accumulator);
+
+/* copy the partition's symbols back into the program's accumulator */
+void partition_store(Partition* part, int* accumulator);
+
+#endif
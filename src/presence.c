@@ -0,0 +1,122 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include "presence.h"
+#include "scan.h"
+
+int init_presence(Presence* presence, RuleTable* rules, int* accumulator) {
+    SparseRules* sparse = sparse_rules(rules);
+    int never = rules->syms->len; /* (facts' bit, see presence.h) */
+    int i, k, len;
+
+    presence->present = NULL;
+    presence->mask_start = presence->mask_words = NULL;
+    presence->masks = NULL;
+    if (sparse->len < 0) return 0; /* (the sparse rules ran out of memory) */
+    presence->sparse = sparse;
+    presence->accumulator = accumulator;
+    presence->words = (never >> 6) + 1;
+    presence->present = calloc(presence->words, sizeof(unsigned long long));
+    presence->mask_start = malloc((sparse->len + 1) * sizeof(int));
+    /* (never more masks than LHS symbols, plus one per fact) */
+    len = sparse->lhs_start[sparse->len] + sparse->len + 1;
+    presence->mask_words = malloc(len * sizeof(int));
+    presence->masks = malloc(len * sizeof(unsigned long long));
+    if (!presence->present || !presence->mask_start || !presence->mask_words || !presence->masks) {
+        free_presence(presence);
+        return 0;
+    }
+
+    for (i = 0; i < never; i++)
+        if (accumulator[i] > 0)
+            presence->present[i >> 6] |= 1ULL << (i & 63);
+    /* the sparse LHS symbols are in order, so each rule's symbols that share
+     * a word are next to each other */
+    len = 0;
+    for (i = 0; i < sparse->len; i++) {
+        presence->mask_start[i] = len;
+        if (sparse->lhs_start[i] == sparse->lhs_start[i + 1]) {
+            presence->mask_words[len] = never >> 6;
+            presence->masks[len++] = 1ULL << (never & 63);
+            continue;
+        }
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++) {
+            if (len == presence->mask_start[i] || presence->mask_words[len - 1] != sparse->lhs[k] >> 6) {
+                presence->mask_words[len] = sparse->lhs[k] >> 6;
+                presence->masks[len++] = 0;
+            }
+            presence->masks[len - 1] |= 1ULL << (sparse->lhs[k] & 63);
+        }
+    }
+    presence->mask_start[sparse->len] = len;
+    return 1;
+}
+
+void free_presence(Presence* presence) {
+    free(presence->present);
+    free(presence->mask_start);
+    free(presence->mask_words);
+    free(presence->masks);
+    presence->present = NULL;
+    presence->mask_start = presence->mask_words = NULL;
+    presence->masks = NULL;
+}
+
+void presence_add(Presence* presence, int symbol, int delta) {
+    int after = presence->accumulator[symbol] += delta;
+    /* (cheaper to just set the bit than to check if it crossed zero) */
+    if (after > 0) presence->present[symbol >> 6] |= 1ULL << (symbol & 63);
+    else presence->present[symbol >> 6] &= ~(1ULL << (symbol & 63));
+}
+
+int presence_first(Presence* presence) {
+    unsigned long long* present = presence->present;
+    int* mask_start = presence->mask_start;
+    int* mask_words = presence->mask_words;
+    unsigned long long* masks = presence->masks;
+    int len = presence->sparse->len;
+    int i, k;
+    /* one mask per rule, all in word 0 */
+    if (presence->words == 1) {
+        i = scan_masks(masks, len, ~present[0]);
+        return i < len ? i : -1;
+    }
+    for (i = 0; i < len; i++) {
+        /* most rules only need the one word, check it before looping */
+        k = mask_start[i];
+        if (masks[k] & ~present[mask_words[k]]) continue;
+        for (k++; k < mask_start[i + 1]; k++)
+            if (masks[k] & ~present[mask_words[k]]) break;
+        if (k == mask_start[i + 1]) return i;
+    }
+    return -1;
+}
+
+int presence_step(Presence* presence) {
+    SparseRules* sparse = presence->sparse;
+    int rule = presence_first(presence);
+    int executions = -1;
+    int k, count;
+    if (rule == -1) return -1;
+    /* (same as matcher_step) */
+    for (k = sparse->lhs_start[rule]; k < sparse->lhs_start[rule + 1]; k++) {
+        if (sparse->transfers && !limits_executions(sparse, rule, k))
+            continue;
+        count = presence->accumulator[sparse->lhs[k]];
+        if (executions == -1 || count < executions)
+            executions = count;
+    }
+    if (executions == -1) executions = 1; /* (nothing limited it) */
+    for (k = sparse->delta_start[rule]; k < sparse->delta_start[rule + 1]; k++)
+        presence_add(presence, sparse->delta_syms[k], executions * sparse->deltas[k]);
+    return rule;
+}
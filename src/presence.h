@@ -0,0 +1,70 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Presence matching. A rule is enabled when every symbol on its LHS has a
+ * nonzero count, so for finding a match all that matters about the
+ * accumulator is which symbols are nonzero. A Presence keeps that as a bit per
+ * symbol, and each rule's LHS as bit masks over the same words, so checking a
+ * rule is a few and-nots instead of a count lookup per symbol. It still goes
+ * through the rules in order like step(), so it's best for programs with a
+ * few thousand symbols or less and rules that are mostly enabled early on
+ * (matcher.h is better when lots of rules sit idle in front of the ones
+ * that run). It fires exactly the rule step() would. */
+
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include "parser.h"
+#include "sparse.h"
+
+/* ----------------------------------------------
+present has bit s % 64 of word s / 64 set when symbol s is nonzero in the
+accumulator. Each rule's LHS is kept as the words it needs something in, and
+which bits it needs in them:
+
+mask_words[mask_start[i]] up to mask_words[mask_start[i + 1]] (word indices)
+masks[mask_start[i]] up to masks[mask_start[i + 1]] (bits in those words)
+
+so rule i is enabled when (masks[k] & ~present[mask_words[k]]) is 0 for all
+of its k. Facts never match, so they get the bit for symbol syms->len, which
+is never present. With under 64 symbols every rule has just the one mask in
+word 0, and finding the first enabled rule is a vector scan (see scan_masks)
+---------------------------------------------- */
+typedef struct Presence {
+    SparseRules* sparse;
+    int* accumulator; /* the bag's, which the presence changes */
+    int words; /* in present, including the never present bit */
+    unsigned long long* present;
+    int* mask_start;
+    int* mask_words;
+    unsigned long long* masks;
+} Presence;
+
+/* set up presence bits for the rules against the accumulator as it currently
+ * is. If anything other than presence_add/presence_step changes the
+ * accumulator after this, it has to go through presence_add. Returns 0 if out
+ * of memory. */
+int init_presence(Presence* presence, RuleTable* rules, int* accumulator);
+
+/* free everything init_presence allocated */
+void free_presence(Presence* presence);
+
+/* add delta of symbol to the accumulator, updating its presence bit */
+void presence_add(Presence* presence, int symbol, int delta);
+
+/* first enabled rule in rule order, -1 if there aren't any */
+int presence_first(Presence* presence);
+
+/* same as step(): find and apply the first matching rule, returning its
+ * index, or -1 if no rules match */
+int presence_step(Presence* presence);
+
+#endif
@@ -11,71 +11,476 @@ WITH REGARD TO THIS SOFTWARE.
 ==================================================================== */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "parser.h"
 #include "interpreter.h"
 #include "variables_pass.h"
+#include "image.h"
+#include "matcher.h"
+#include "presence.h"
+#include "checkpoint.h"
+#include "jobs.h"
+#include "explore.h"
+#include "io.h"
+#include "jit.h"
+#include "scan.h"
+#include "batch.h"
 
-#define SRC_SZ 32768 /* maximum size of input vera source code */
-#define NAM_SZ 32768 /* maximum combined text size of all symbol names? */
-#define SYM_SZ 256  /* maximum number of unique symbols? */
-#define RUL_SZ 128   /* maximum number of rules we can handle */
-
-static char src[SRC_SZ];
-static char names[NAM_SZ];
-static char* syms[SYM_SZ];
-static int rules[RUL_SZ * SYM_SZ * 2];
-static int acc[SYM_SZ];
-
-static SymTable sym_table = {
-    .names = names,
-    .table = syms,
-    .len = 0,
-    .max_len = SYM_SZ,
-    .names_len = 0,
-};
-
-static RuleTable rule_table = {
-    .syms = &sym_table,
-    .table = rules,
-    .len = 0,
-    .max_len = RUL_SZ,
-};
-
-static BagOfFacts bag = {
-    .syms = &sym_table,
-    .accumulator = acc,
-};
+static Arena arena; /* everything for the program is allocated from here */
+static SymTable sym_table;
+static RuleTable rule_table;
+
+static BagOfFacts bag;
+static SparseBag sparse_bag;
+static int use_sparse_bag = 0; /* --sparse-bag */
+static Matcher matcher; /* for stepping the dense bag */
+static int use_matcher = 0;
+static Presence presence;
+static int use_presence = 0; /* --presence */
+static int parallel_step = 0; /* --parallel-step */
+static int match_threads = 1; /* --match-threads [NUM] */
+static MatchPool* pool = NULL;
+static int partition_threads = 1; /* --partition-threads [NUM] */
+static int detect_cycles = 0; /* --detect-cycles */
+static Cycle cycle;
+static int memo_rules = 0; /* --memo [NUM] */
+static int memo_hits = 0;
+static int memo_misses = 0;
+static char* checkpoint_path = NULL; /* --checkpoint [FILE] */
+static int checkpoint_every = 60; /* --checkpoint-every [SECONDS] */
+static char* batch_path = NULL; /* --batch [FILE] */
+static int batch_threads = 0; /* --batch-threads [NUM], 0 for one per processor */
+static char* explore_bad = NULL; /* --explore [FACT] */
+static int explore_depth = -1; /* --explore-depth [NUM] */
+static int explore_states = 1 << 22; /* --explore-states [NUM] */
+static int explore_threads = 0; /* --explore-threads [NUM], 0 for one per processor */
+static int io_mode = 0; /* --io */
+static int use_jit = 0; /* --jit, cleared if it can't be built */
+static Jit jit;
+
+/* how many ints of accumulators a block of --batch records can take up */
+#define BATCH_BLOCK_INTS (1 << 24)
+#define BATCH_BLOCK_RECORDS 4096
+/* --batch runs records BATCH_LANES at a time on a Batch (per job) when the
+ * program has at most BATCH_RULES rules and there are vector instructions
+ * for it, past that separate evals are faster (see bench-batch) */
+#define BATCH_LANES 64
+#define BATCH_RULES 24
+
+/* number of symbol i in whichever bag we're using */
+static int count_of(int i) {
+    return use_sparse_bag ? sparse_bag_count(&sparse_bag, i) : bag.accumulator[i];
+}
+
+static int run_step() {
+    if (use_sparse_bag) return sparse_step(&sparse_bag, &rule_table);
+    if (parallel_step) return use_matcher ? matcher_step_all(&matcher) : 0;
+    if (pool) return pool_step(pool);
+    if (use_presence) return presence_step(&presence);
+    if (use_jit) return jit.step(bag.accumulator);
+    return use_matcher ? matcher_step(&matcher) : step(&bag, &rule_table);
+}
+
+/* the JIT's eval, a hook->every steps at a time (its code keeps nothing
+ * between calls, so it carries on where it left off), calling the hook in
+ * between the same way the interpreter's evals do */
+static int jit_eval(int max_steps, EvalHook* hook) {
+    int steps = 0;
+    int left, taken;
+    if (!hook) return jit.eval(bag.accumulator, max_steps);
+    if (max_steps == 0) max_steps = 1; /* (eval always takes the one step) */
+    while (1) {
+        left = max_steps == -1 || max_steps - steps > hook->every ? hook->every : max_steps - steps;
+        steps += taken = jit.eval(bag.accumulator, left);
+        if (taken < left || (max_steps != -1 && steps >= max_steps)) break; /* (halted) */
+        hook->call(hook, steps);
+    }
+    return steps;
+}
+
+/* eval with whichever engine was asked for, calling hook (if it isn't NULL)
+ * as it goes, see EvalHook */
+static int run_eval(int max_steps, EvalHook* hook) {
+    if (use_sparse_bag) return sparse_eval(&sparse_bag, &rule_table, max_steps);
+    if (parallel_step) return parallel_eval(&bag, &rule_table, max_steps, hook);
+    if (detect_cycles) return cycle_eval(&bag, &rule_table, max_steps, &cycle, hook);
+    if (memo_rules) return memo_eval(&bag, &rule_table, max_steps, memo_rules, &memo_hits, &memo_misses, hook);
+    /* (running partitions separately only ends up the same once they halt) */
+    if (partition_threads > 1 && max_steps == -1) return partitioned_eval(&bag, &rule_table, partition_threads, hook);
+    if (match_threads > 1) return threaded_eval(&bag, &rule_table, max_steps, match_threads, hook);
+    if (use_jit) return jit_eval(max_steps, hook);
+    return use_presence ? presence_eval(&bag, &rule_table, max_steps, hook) : hooked_eval(&bag, &rule_table, max_steps, hook);
+}
+
+/* seconds on a clock that only goes forward */
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* how often (in steps) a checkpointed eval checks whether a checkpoint's due */
+#define CHECKPOINT_STEPS (1 << 16)
+
+/* the checkpointed_eval an EvalHook is for */
+typedef struct CheckpointRun {
+    Checkpointer checkpointer;
+    long long resumed; /* steps taken before this run */
+    double last; /* when the last checkpoint was taken */
+} CheckpointRun;
+
+static void checkpoint_hook(EvalHook* hook, int steps) {
+    CheckpointRun* run = hook->context;
+    if (now() - run->last < checkpoint_every) return;
+    checkpoint(&run->checkpointer, bag.accumulator, run->resumed + steps);
+    run->last = now();
+}
+
+/* run_eval, handing the bag to a Checkpointer every checkpoint_every seconds
+ * (from inside the eval, see EvalHook) and once at the end. steps is how
+ * many a resumed run had already taken, which max_steps includes. Returns
+ * the number of checkpoint writes that failed. */
+static int checkpointed_eval(int max_steps, long long steps, unsigned long long fingerprint) {
+    CheckpointRun run;
+    EvalHook hook;
+    if (!start_checkpointer(&run.checkpointer, checkpoint_path, fingerprint, sym_table.len))
+        return 1;
+    run.resumed = steps;
+    run.last = now();
+    hook.call = checkpoint_hook;
+    hook.every = CHECKPOINT_STEPS;
+    hook.context = &run;
+    if (max_steps == -1 || steps < max_steps)
+        steps += run_eval(max_steps == -1 ? -1 : (int)(max_steps - steps), &hook);
+    checkpoint(&run.checkpointer, bag.accumulator, steps);
+    return stop_checkpointer(&run.checkpointer);
+}
+
+/* a block of --batch records, read and parsed all together before being run
+ * (each one's symbols are pairs[starts[i]] to pairs[starts[i] + lens[i]], lens
+ * is -1 for a record that didn't parse). Symbols the program doesn't have go
+ * in the block's own unknown table rather than the program's, since no rule
+ * can change them they're only ever printed back out (from unknown_counts,
+ * which is left all 0 between records). */
+typedef struct BatchBlock {
+    int len;
+    int* starts;
+    int* lens;
+    int* lines;
+    int* ids;
+    int* counts;
+    int pairs_len;
+    int max_pairs;
+    int syms_len;
+    int* accumulators; /* syms_len each */
+    int max_steps;
+    Arena unknown_arena;
+    SymTable unknown_syms;
+    RuleTable unknown;
+    int* unknown_counts;
+    int vars_pass; /* (see add_variable_unknowns) */
+    int transfers;
+    Batch* batches; /* one per thread, NULL if each record gets its own eval */
+    int threads;
+} BatchBlock;
+
+/* (re)start the block's batches for the rules as they are now, or drop them
+ * if the rules aren't worth batching. Returns 0 if out of memory. */
+static int start_batches(BatchBlock* block) {
+    SparseRules* sparse = sparse_rules(&rule_table);
+    int i;
+    for (i = 0; block->batches && i < block->threads; i++)
+        free_batch(&block->batches[i]);
+    if (!sparse || sparse->len < 0) return 0;
+    if (use_jit || scan_simd_level() < 1 || sparse->len > BATCH_RULES) {
+        free(block->batches);
+        block->batches = NULL;
+        return 1;
+    }
+    if (!block->batches && !(block->batches = calloc(block->threads, sizeof(Batch)))) return 0;
+    for (i = 0; i < block->threads; i++)
+        if (!init_batch(&block->batches[i], &rule_table, BATCH_LANES)) return 0;
+    return 1;
+}
+
+/* a job is a record, or BATCH_LANES of them with batches */
+static void run_batch_job(void* context, int job, int thread) {
+    BatchBlock* block = context;
+    BagOfFacts job_bag;
+    Batch* batch;
+    int i, first = job * BATCH_LANES;
+    if (block->batches) {
+        batch = &block->batches[thread];
+        clear_batch(batch);
+        for (i = first; i < block->len && i < first + BATCH_LANES; i++)
+            if (block->lens[i] != -1)
+                batch_set_bag(batch, i - first, &block->accumulators[(size_t)i * block->syms_len]);
+        batch_eval(batch, block->max_steps);
+        for (i = first; i < block->len && i < first + BATCH_LANES; i++)
+            if (block->lens[i] != -1)
+                batch_get_bag(batch, i - first, &block->accumulators[(size_t)i * block->syms_len]);
+        return;
+    }
+    job_bag.syms = &sym_table;
+    job_bag.accumulator = &block->accumulators[(size_t)job * block->syms_len];
+    if (block->lens[job] != -1 && use_jit)
+        jit.eval(job_bag.accumulator, block->max_steps);
+    else if (block->lens[job] != -1)
+        eval(&job_bag, &rule_table, block->max_steps);
+}
+
+/* with --vars, a record can be the first to mention a movement or copy
+ * between variables, which then needs its rules (added here, while no jobs
+ * are running). Records' unknown symbols were numbered from syms_len, so
+ * they're renumbered after the symbols the program has now. */
+static int add_variable_unknowns(BatchBlock* block, int syms_len) {
+    SparseRules* sparse;
+    int first_symbol = sym_table.len;
+    int k, id;
+    if (!block->vars_pass || !add_variable_symbols(&rule_table, block->unknown_syms.table, block->unknown_syms.len))
+        return 1;
+    add_variable_rules(&rule_table, first_symbol, block->transfers);
+    for (k = 0; k < block->pairs_len; k++) {
+        if (block->ids[k] < syms_len) continue;
+        id = index_of_symbol(block->unknown_syms.table[block->ids[k] - syms_len], &sym_table);
+        block->ids[k] = id != -1 ? id : block->ids[k] - syms_len + sym_table.len;
+    }
+    /* (the rules are rebuilt before any threads use them again) */
+    if (use_jit) {
+        free_jit(&jit);
+        use_jit = load_jit(&jit, &rule_table);
+    }
+    return (sparse = sparse_rules(&rule_table)) && sparse->len >= 0 && (!block->batches || start_batches(block));
+}
+
+/* read up to records records from f into block, returns 0 if out of memory */
+static int read_batch_block(FILE* f, BatchBlock* block, int records, int* line) {
+    char* record = NULL;
+    size_t record_size = 0;
+    ssize_t record_len;
+    int syms_len = sym_table.len;
+    int i, k;
+    block->len = block->pairs_len = 0;
+    arena_free(&block->unknown_arena);
+    init_tables(&block->unknown_arena, &block->unknown_syms, &block->unknown);
+    while (block->len < records && (record_len = getline(&record, &record_size, f)) != -1) {
+        (*line)++;
+        for (k = 0; k < record_len && record[k] <= 0x20; k++);
+        if (k == record_len) continue; /* (blank) */
+        if (block->pairs_len + record_len / 2 + 1 > block->max_pairs) {
+            block->max_pairs = (block->pairs_len + record_len / 2 + 1) * 2;
+            block->ids = realloc(block->ids, block->max_pairs * sizeof(int));
+            block->counts = realloc(block->counts, block->max_pairs * sizeof(int));
+            if (!block->ids || !block->counts) break;
+        }
+        block->starts[block->len] = block->pairs_len;
+        block->lines[block->len] = *line;
+        block->lens[block->len] = parse_fact(record, &rule_table, &block->unknown, &block->ids[block->pairs_len], &block->counts[block->pairs_len]);
+        if (block->lens[block->len] > 0) block->pairs_len += block->lens[block->len];
+        block->len++;
+    }
+    free(record);
+    if (!block->ids || !block->counts || !add_variable_unknowns(block, syms_len)) return 0;
+
+    block->syms_len = sym_table.len;
+    free(block->accumulators);
+    free(block->unknown_counts);
+    block->accumulators = calloc((size_t)block->len * block->syms_len + 1, sizeof(int));
+    block->unknown_counts = calloc(block->unknown_syms.len + 1, sizeof(int));
+    if (!block->accumulators || !block->unknown_counts) return 0;
+    for (i = 0; i < block->len; i++)
+        for (k = block->starts[i]; k < block->starts[i] + block->lens[i]; k++)
+            if (block->ids[k] < block->syms_len)
+                block->accumulators[(size_t)i * block->syms_len + block->ids[k]] += block->counts[k];
+    return 1;
+}
+
+/* print a --batch job's bag on one line, as a fact (or --printout style) */
+static void print_batch_job(BatchBlock* block, int job, int printout_format) {
+    int* accumulator = &block->accumulators[(size_t)job * block->syms_len];
+    int* unknown_counts = block->unknown_counts;
+    char* separator = " ";
+    int i, k, unknown;
+    if (block->lens[job] == -1) {
+        printf("Broken record on line %d\n", block->lines[job]);
+        return;
+    }
+    if (!printout_format)
+        printf("%c%c", sym_table.delim, sym_table.delim);
+    for (i = 0; i < block->syms_len; i++) {
+        if (printout_format)
+            printf("%d,", accumulator[i]);
+        else if (accumulator[i] >= 1) {
+            printf(accumulator[i] == 1 ? "%s%s" : "%s%s:%d", separator, sym_table.table[i], accumulator[i]);
+            separator = ", ";
+        }
+    }
+    /* then anything the program doesn't have, in the order the record had
+     * it (--printout only has columns for the program's own symbols) */
+    for (k = block->starts[job]; !printout_format && k < block->starts[job] + block->lens[job]; k++)
+        if ((unknown = block->ids[k] - block->syms_len) >= 0)
+            unknown_counts[unknown] += block->counts[k];
+    for (k = block->starts[job]; !printout_format && k < block->starts[job] + block->lens[job]; k++) {
+        if ((unknown = block->ids[k] - block->syms_len) < 0) continue;
+        if (unknown_counts[unknown] >= 1) {
+            i = unknown_counts[unknown];
+            printf(i == 1 ? "%s%s" : "%s%s:%d", separator, block->unknown_syms.table[unknown], i);
+            separator = ", ";
+        }
+        unknown_counts[unknown] = 0;
+    }
+    printf("\n");
+}
+
+/* run every record in the file at path (- for stdin) as its own job, a block
+ * at a time on a JobPool, printing each one's final bag in the same order */
+static int run_batch(int max_steps, int printout_format, int vars_pass, int transfers) {
+    FILE* f = strcmp(batch_path, "-") == 0 ? stdin : fopen(batch_path, "r");
+    BatchBlock block;
+    JobPool jobs;
+    int records, line = 0;
+    int i, ok = 1;
+    if (!f) return !printf("Batch missing: %s\n", batch_path);
+    if (batch_threads < 1) batch_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    memset(&block, 0, sizeof(block));
+    block.max_steps = max_steps;
+    block.vars_pass = vars_pass;
+    block.transfers = transfers;
+    block.threads = batch_threads;
+    block.starts = malloc(BATCH_BLOCK_RECORDS * sizeof(int));
+    block.lens = malloc(BATCH_BLOCK_RECORDS * sizeof(int));
+    block.lines = malloc(BATCH_BLOCK_RECORDS * sizeof(int));
+    /* (the rules are only compiled once, before any threads use them) */
+    if (!sparse_rules(&rule_table) || !block.starts || !block.lens || !block.lines || !start_batches(&block)
+            || !start_job_pool(&jobs, batch_threads, run_batch_job, &block)) {
+        ok = !printf("Out of memory\n");
+        batch_threads = 0;
+    }
+    while (ok) {
+        records = BATCH_BLOCK_INTS / (sym_table.len + 1);
+        if (records > BATCH_BLOCK_RECORDS) records = BATCH_BLOCK_RECORDS;
+        if (records < 1) records = 1;
+        if (!read_batch_block(f, &block, records, &line)) {
+            ok = !printf("Out of memory\n");
+            break;
+        }
+        if (!block.len) break;
+        run_jobs(&jobs, block.batches ? (block.len + BATCH_LANES - 1) / BATCH_LANES : block.len);
+        for (i = 0; i < block.len; i++)
+            print_batch_job(&block, i, printout_format);
+    }
+    if (batch_threads) stop_job_pool(&jobs);
+    if (f != stdin) fclose(f);
+    free(block.starts);
+    free(block.lens);
+    free(block.lines);
+    free(block.ids);
+    free(block.counts);
+    free(block.accumulators);
+    free(block.unknown_counts);
+    arena_free(&block.unknown_arena);
+    for (i = 0; block.batches && i < block.threads; i++)
+        free_batch(&block.batches[i]);
+    free(block.batches);
+    return ok;
+}
 
 static void print_bag() {
     int i;
-    for (i = 0; i < SYM_SZ; i++) {
-        if (acc[i] == 1)
-            printf("%s\n", syms[i]);
-        if (acc[i] > 1) {
-            printf("%s:%d\n", syms[i], acc[i]);
+    for (i = 0; i < sym_table.len; i++) {
+        if (count_of(i) == 1)
+            printf("%s\n", sym_table.table[i]);
+        if (count_of(i) > 1) {
+            printf("%s:%d\n", sym_table.table[i], count_of(i));
         }
     }
 }
 
+/* search for inputs that take the program from bag to the bag in
+ * explore_bad, printing them and the bad bag if there are any. max_run is
+ * the most steps the program can take between inputs. Returns 0 if there's
+ * something wrong with the search itself. */
+static int run_explore(int max_run) {
+    Explorer explorer;
+    int facts_len = sym_table.len;
+    int* ids = malloc((strlen(explore_bad) / 2 + 2) * sizeof(int));
+    int* counts = malloc((strlen(explore_bad) / 2 + 2) * sizeof(int));
+    int* facts = NULL;
+    int* trace = NULL;
+    int len, i, ok = 0;
+    if (!ids || !counts)
+        printf("Out of memory\n");
+    else if ((len = parse_fact(explore_bad, &rule_table, NULL, ids, counts)) == -1)
+        printf("Broken bad state: %s\n", explore_bad);
+    /* (the bad state can add symbols, which nothing starts with any of) */
+    else if (!(facts = calloc(sym_table.len + 1, sizeof(int))))
+        printf("Out of memory\n");
+    else if (!init_explorer(&explorer, &rule_table, ids, counts, len, explore_depth, explore_states, max_run,
+                explore_threads < 1 ? sysconf(_SC_NPROCESSORS_ONLN) : explore_threads))
+        printf("Out of memory\n");
+    else {
+        memcpy(facts, bag.accumulator, facts_len * sizeof(int));
+        if (explore(&explorer, facts) && (trace = malloc((explorer.depth + 2) * sizeof(int)))) {
+            len = explore_trace(&explorer, trace);
+            printf(len ? "Bad state reached by: " : "Bad state reached with no inputs");
+            for (i = 0; i < len; i++)
+                printf(i ? ", %s" : "%s", sym_table.table[trace[i]]);
+            printf("\n");
+            bag.accumulator = explorer.found_bag;
+            print_bag();
+        }
+        else if (atomic_load(&explorer.full))
+            printf("No bad state in the first %d states\n", atomic_load(&explorer.states));
+        else if (atomic_load(&explorer.next) > explorer.level_start)
+            printf("No bad state within %d inputs (%d states)\n", explorer.depth, atomic_load(&explorer.states));
+        else
+            printf("No bad state reachable (%d states)\n", atomic_load(&explorer.states));
+        if (atomic_load(&explorer.unsettled))
+            printf("%d runs didn't halt within %d steps\n", atomic_load(&explorer.unsettled), max_run);
+        ok = !atomic_load(&explorer.reached) || trace;
+        free_explorer(&explorer);
+    }
+    free(ids);
+    free(counts);
+    free(facts);
+    free(trace);
+    return ok;
+}
+
 /* this is a printout of the same format as the DEBUG compiled c version */
 static void printout() {
     int i;
     for (i = 0; i < sym_table.len; i++) {
-        printf("%d,", acc[i]);
+        printf("%d,", count_of(i));
     }
     printf("\n");
 }
 
 int main(int argc, char* argv[]) {
     FILE *f;
+    FILE *cached_f;
+    int parsed;
     int a = 1;
+    int* facts = NULL; /* initial accumulator, when loaded from an image */
+    char cache_path[4096];
+    unsigned long long source_hash = 0;
+    int cached = 0;
 
     int print_last_only = 0; /* --plast */
     int printout_format = 0; /* --printout */
     int implicit_constants = 1; /* --no-implicit-constants */
     int max_steps = -1; /* --steps [NUM] */
     int vars_pass = 0; /* --vars */
+    int transfers = 0; /* --transfers */
+    int parse_threads = 1; /* --parse-threads [NUM] */
+    int use_cache = 0; /* --cache */
+    int resume = 0; /* --resume */
+    long long resumed_steps = 0;
+    unsigned long long fingerprint = 0;
+    char* image_out = NULL; /* --write-image [FILE] */
     int filename_argv_index = -1; /* if never set, expect stdin */
 
     /* cli arg parsing */
@@ -90,56 +495,229 @@ int main(int argc, char* argv[]) {
         }
         else if (strcmp(argv[a], "--vars") == 0)
             vars_pass = 1;
+        else if (strcmp(argv[a], "--transfers") == 0)
+            transfers = 1;
         else if (strcmp(argv[a], "--printout") == 0)
             printout_format = 1;
+        else if (strcmp(argv[a], "--sparse-bag") == 0)
+            use_sparse_bag = 1;
+        else if (strcmp(argv[a], "--presence") == 0)
+            use_presence = 1;
+        else if (strcmp(argv[a], "--parallel-step") == 0)
+            parallel_step = 1;
+        else if (strcmp(argv[a], "--parse-threads") == 0) {
+            a++;
+            walk_number(argv[a], &parse_threads);
+        }
+        else if (strcmp(argv[a], "--match-threads") == 0) {
+            a++;
+            walk_number(argv[a], &match_threads);
+        }
+        else if (strcmp(argv[a], "--memo") == 0) {
+            a++;
+            walk_number(argv[a], &memo_rules);
+        }
+        else if (strcmp(argv[a], "--detect-cycles") == 0)
+            detect_cycles = 1;
+        else if (strcmp(argv[a], "--partition-threads") == 0) {
+            a++;
+            walk_number(argv[a], &partition_threads);
+        }
+        else if (strcmp(argv[a], "--checkpoint") == 0) {
+            a++;
+            checkpoint_path = argv[a];
+        }
+        else if (strcmp(argv[a], "--checkpoint-every") == 0) {
+            a++;
+            walk_number(argv[a], &checkpoint_every);
+        }
+        else if (strcmp(argv[a], "--resume") == 0)
+            resume = 1;
+        else if (strcmp(argv[a], "--batch") == 0) {
+            a++;
+            batch_path = argv[a];
+        }
+        else if (strcmp(argv[a], "--batch-threads") == 0) {
+            a++;
+            walk_number(argv[a], &batch_threads);
+        }
+        else if (strcmp(argv[a], "--explore") == 0) {
+            a++;
+            explore_bad = argv[a];
+        }
+        else if (strcmp(argv[a], "--explore-depth") == 0) {
+            a++;
+            walk_number(argv[a], &explore_depth);
+        }
+        else if (strcmp(argv[a], "--explore-states") == 0) {
+            a++;
+            walk_number(argv[a], &explore_states);
+        }
+        else if (strcmp(argv[a], "--explore-threads") == 0) {
+            a++;
+            walk_number(argv[a], &explore_threads);
+        }
+        else if (strcmp(argv[a], "--io") == 0)
+            io_mode = 1;
+        else if (strcmp(argv[a], "--jit") == 0)
+            use_jit = 1;
+        else if (strcmp(argv[a], "--cache") == 0)
+            use_cache = 1;
+        else if (strcmp(argv[a], "--write-image") == 0) {
+            a++;
+            image_out = argv[a];
+        }
         else
             filename_argv_index = a;
         a++;
     }
 
+    init_tables(&arena, &sym_table, &rule_table);
+
     /* grab source code from correct source */
     if (filename_argv_index > -1) {
         /* open and read in the source file */
         if(!(f = fopen(argv[filename_argv_index], "r")))
             return !printf("Source missing: %s\n", argv[a]);
-        if(!fread(&src, 1, SRC_SZ, f))
-            return !printf("Source empty: %s\n", argv[a]);
+        if (is_image(f)) {
+            use_cache = 0; /* (already as cached as it gets) */
+            if (!(parsed = load_image(f, &rule_table, &facts, vars_pass)))
+                return !printf("Broken image: %s\n", argv[filename_argv_index]);
+        }
+        else {
+            /* a cached image of the same source (and options) skips parsing
+             * and passes entirely */
+            if (use_cache) {
+                source_hash = hash_source(f) ^ (implicit_constants | vars_pass << 1 | transfers << 2);
+                if (!image_cache_path(cache_path, sizeof(cache_path), NULL, source_hash))
+                    use_cache = 0;
+                else if ((cached_f = fopen(cache_path, "rb"))) {
+                    /* (--batch records can need more --vars rules added) */
+                    cached = parsed = load_image(cached_f, &rule_table, &facts, vars_pass && batch_path);
+                    fclose(cached_f);
+                }
+            }
+            if (!cached && (parsed = parse_file(f, &rule_table, implicit_constants, parse_threads)) == -1)
+                return !printf("Source empty: %s\n", argv[a]);
+        }
     }
     else {
         /* read source code from stdin */
         /* NOTE: if you aren't piping anything in, you can just enter code and
          * use ctrl+D to term */
-        fread(&src, 1, SRC_SZ, stdin);
+        use_cache = 0; /* only files are cached */
+        if (is_image(stdin)) {
+            if (!(parsed = load_image(stdin, &rule_table, &facts, vars_pass)))
+                return !printf("Broken image\n");
+        }
+        else
+            parsed = parse_stream(stdin, &rule_table, implicit_constants);
     }
 
-    if(parse(src, &rule_table, implicit_constants)) {
-        if (vars_pass) {
-            run_variables_pass(&rule_table, 0);
+    if(parsed) {
+        if (vars_pass && !cached) {
+            run_variables_pass(&rule_table, 0, transfers);
+            facts = NULL;
+        }
+        if (use_cache && !cached)
+            write_image_file(cache_path, &rule_table, source_hash);
+        if (image_out && !write_image_file(image_out, &rule_table, source_hash))
+            return !printf("Couldn't write image: %s\n", image_out);
+        /* (falling back to the interpreter if there's no compiler) */
+        if (use_jit && !use_sparse_bag)
+            use_jit = load_jit(&jit, &rule_table);
+        if (batch_path) {
+            /* every record is its own bag, instead of the program's facts */
+            parsed = run_batch(max_steps, printout_format, vars_pass, transfers);
+            arena_free(&arena);
+            return !parsed;
+        }
+        if (use_sparse_bag) {
+            init_sparse_bag(&sparse_bag, &sym_table, &arena);
+            populate_sparse_facts(&sparse_bag, &rule_table);
+        }
+        else {
+            init_bag(&bag, &sym_table, &arena);
+            if (facts)
+                memcpy(bag.accumulator, facts, sym_table.len * sizeof(int));
+            else
+                populate_facts(&bag, &rule_table);
+            if (checkpoint_path)
+                fingerprint = program_fingerprint(&rule_table);
+            if (checkpoint_path && resume && read_checkpoint_file(checkpoint_path, fingerprint, &resumed_steps, bag.accumulator, sym_table.len) == -1)
+                return !printf("Checkpoint isn't of this program: %s\n", checkpoint_path);
+        }
+
+        if (explore_bad && !use_sparse_bag) {
+            parsed = run_explore(max_steps == -1 ? 1 << 16 : max_steps);
+            arena_free(&arena);
+            return !parsed;
+        }
+
+        if (io_mode && !use_sparse_bag) {
+            /* (only what it prints, unless the final bag is asked for) */
+            parsed = io_eval(&bag, &rule_table, max_steps) != -1;
+            if (parsed && print_last_only) print_bag();
+            arena_free(&arena);
+            return !parsed;
         }
-        populate_facts(&bag, &rule_table);
 
         if (print_last_only) {
-            eval(&bag, &rule_table, max_steps);
+            if (checkpoint_path && !use_sparse_bag) {
+                if (checkpointed_eval(max_steps, resumed_steps, fingerprint))
+                    printf("Couldn't write checkpoint: %s\n", checkpoint_path);
+            }
+            else
+                run_eval(max_steps, NULL);
+            if (cycle.length)
+                printf("Cycle of %d steps, entered after step %d\n", cycle.length, cycle.entry);
+            if (memo_rules)
+                printf("Memo: %d hits, %d misses\n", memo_hits, memo_misses);
             print_bag();
         }
         else if (printout_format) {
-            eval(&bag, &rule_table, -1);
+            if (checkpoint_path && !use_sparse_bag) {
+                if (checkpointed_eval(-1, resumed_steps, fingerprint))
+                    printf("Couldn't write checkpoint: %s\n", checkpoint_path);
+            }
+            else
+                run_eval(-1, NULL);
             printout();
         }
         else {
             int out = 0;
             int steps_to_take = max_steps;
+            if (use_sparse_bag)
+                use_presence = parallel_step = 0;
+            else if (!parallel_step && match_threads > 1 && (pool = start_match_pool(&rule_table, bag.accumulator, match_threads)))
+                use_presence = 0;
+            else if (use_presence && !parallel_step)
+                use_presence = init_presence(&presence, &rule_table, bag.accumulator);
+            else {
+                use_presence = 0;
+                use_matcher = init_matcher(&matcher, &rule_table, bag.accumulator);
+            }
             while (out != -1 && (max_steps == -1 || steps_to_take > 0)) {
                 print_bag();
-                out = step(&bag, &rule_table);
-                printf("Matched rule %d...\n", out);
+                out = run_step();
+                if (parallel_step) {
+                    printf("Matched %d rules...\n", out);
+                    if (!out) out = -1;
+                }
+                else
+                    printf("Matched rule %d...\n", out);
                 steps_to_take -= 1;
             }
             print_bag();
+            if (use_matcher) free_matcher(&matcher);
+            if (use_presence) free_presence(&presence);
+            if (pool) stop_match_pool(pool);
         }
     }
     else {
         return 1;
     }
+    if (use_jit) free_jit(&jit);
+    arena_free(&arena);
     return 0;
 }
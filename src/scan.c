@@ -0,0 +1,206 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "scan.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* what a scan is looking for */
+enum { SCAN_WHITESPACE, SCAN_SYMBOL_END };
+
+/* 0 = scalar, 1 = SSE2, 2 = AVX2 */
+static int simd_level = 0;
+
+/* the scalar version of every scan, which the vector versions have to agree
+ * with. (Note char is signed on x86, so bytes 0x80 and up count as
+ * whitespace, the vector compares are signed to match.) */
+static inline int is_stop(char c, int kind, char delim, int colons) {
+    if (kind == SCAN_WHITESPACE)
+        return !c || c > 0x20;
+    return !c || c == delim || c == ',' || (c == ':' && colons);
+}
+
+static inline char* scan_scalar(char* s, int kind, char delim, int colons) {
+    while (!is_stop(*s, kind, delim, colons))
+        s++;
+    return s;
+}
+
+#ifdef SCAN_X86
+/* bitmask of which of the 16 characters in v a scan stops at */
+static inline unsigned int sse2_stops(__m128i v, int kind, char delim, int colons) {
+    __m128i stops = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+    if (kind == SCAN_WHITESPACE)
+        return _mm_movemask_epi8(_mm_or_si128(stops, _mm_cmpgt_epi8(v, _mm_set1_epi8(0x20))));
+    stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8(delim)));
+    stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    if (colons)
+        stops = _mm_or_si128(stops, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+    return _mm_movemask_epi8(stops);
+}
+
+/* aligned loads never cross into the next page, so starting from the block s
+ * is in and ignoring the characters before s can't fault */
+static inline char* scan_sse2(char* s, int kind, char delim, int colons) {
+    int offset = (uintptr_t)s & 15;
+    char* p = s - offset;
+    unsigned int mask = sse2_stops(_mm_load_si128((__m128i*)p), kind, delim, colons) & (0xffffu << offset);
+    while (!mask) {
+        p += 16;
+        mask = sse2_stops(_mm_load_si128((__m128i*)p), kind, delim, colons);
+    }
+    return p + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned int avx2_stops(__m256i v, int kind, char delim, int colons) {
+    __m256i stops = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+    if (kind == SCAN_WHITESPACE)
+        return _mm256_movemask_epi8(_mm256_or_si256(stops, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x20))));
+    stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(delim)));
+    stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+    if (colons)
+        stops = _mm256_or_si256(stops, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+    return _mm256_movemask_epi8(stops);
+}
+
+__attribute__((target("avx2")))
+static inline char* scan_avx2(char* s, int kind, char delim, int colons) {
+    int offset = (uintptr_t)s & 31;
+    char* p = s - offset;
+    unsigned int mask = avx2_stops(_mm256_load_si256((__m256i*)p), kind, delim, colons) & (0xffffffffu << offset);
+    while (!mask) {
+        p += 32;
+        mask = avx2_stops(_mm256_load_si256((__m256i*)p), kind, delim, colons);
+    }
+    return p + __builtin_ctz(mask);
+}
+
+__attribute__((target("avx2")))
+static char* scan_whitespace_avx2(char* s) {
+    return scan_avx2(s, SCAN_WHITESPACE, 0, 0);
+}
+
+__attribute__((target("avx2")))
+static char* scan_symbol_end_avx2(char* s, char delim, int colons) {
+    return scan_avx2(s, SCAN_SYMBOL_END, delim, colons);
+}
+
+/* first of 8 masks at a time with none of the absent bits set */
+__attribute__((target("avx2")))
+static int scan_masks_avx2(const unsigned long long* masks, int len, unsigned long long absent) {
+    __m256i a = _mm256_set1_epi64x((long long)absent);
+    __m256i zero = _mm256_setzero_si256();
+    unsigned int hits;
+    int i;
+    for (i = 0; i + 8 <= len; i += 8) {
+        hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(_mm256_loadu_si256((__m256i*)(masks + i)), a), zero)));
+        hits |= _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(_mm256_loadu_si256((__m256i*)(masks + i + 4)), a), zero))) << 4;
+        if (hits) return i + __builtin_ctz(hits);
+    }
+    while (i < len && (masks[i] & absent))
+        i++;
+    return i;
+}
+
+/* SSE2 has no 64 bit compare, a mask is clear when both its halves are */
+static int scan_masks_sse2(const unsigned long long* masks, int len, unsigned long long absent) {
+    __m128i a = _mm_set1_epi64x((long long)absent);
+    unsigned int hits;
+    int i;
+    for (i = 0; i + 2 <= len; i += 2) {
+        hits = _mm_movemask_epi8(_mm_cmpeq_epi32(
+            _mm_and_si128(_mm_loadu_si128((__m128i*)(masks + i)), a), _mm_setzero_si128()));
+        if ((hits & 0xff) == 0xff) return i;
+        if ((hits & 0xff00) == 0xff00) return i + 1;
+    }
+    while (i < len && (masks[i] & absent))
+        i++;
+    return i;
+}
+
+/* pick the best version the CPU (and VERA_SIMD) allows before main runs, so
+ * parse_parallel's threads never race to do it */
+__attribute__((constructor))
+static void pick_simd_level() {
+    char* cap = getenv("VERA_SIMD");
+    __builtin_cpu_init();
+    simd_level = __builtin_cpu_supports("avx2") ? 2 : 1; /* SSE2 is always there on x86_64 */
+    if (cap && cap[0] >= '0' && cap[0] - '0' < simd_level)
+        simd_level = cap[0] - '0';
+}
+#endif
+
+char* scan_whitespace(char* s) {
+#ifdef SCAN_X86
+    if (simd_level == 2) return scan_whitespace_avx2(s);
+    if (simd_level == 1) return scan_sse2(s, SCAN_WHITESPACE, 0, 0);
+#endif
+    return scan_scalar(s, SCAN_WHITESPACE, 0, 0);
+}
+
+char* scan_symbol_end(char* s, char delim, int colons) {
+#ifdef SCAN_X86
+    if (simd_level == 2) return scan_symbol_end_avx2(s, delim, colons);
+    if (simd_level == 1) return scan_sse2(s, SCAN_SYMBOL_END, delim, colons);
+#endif
+    return scan_scalar(s, SCAN_SYMBOL_END, delim, colons);
+}
+
+int scan_same(char* a, char* b) {
+    int n = 0;
+#ifdef SCAN_X86
+    __m128i va, vb;
+    unsigned int mask;
+    /* these loads aren't aligned, so only take them while neither a nor b
+     * is close enough to the end of a page to read into the next one.
+     * (Symbol names are short, so this sticks to SSE2) */
+    if (simd_level >= 1) {
+        while (((uintptr_t)(a + n) & 4095) <= 4096 - 16 && ((uintptr_t)(b + n) & 4095) <= 4096 - 16) {
+            va = _mm_loadu_si128((__m128i*)(a + n));
+            vb = _mm_loadu_si128((__m128i*)(b + n));
+            mask = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+            mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(vb, _mm_setzero_si128()));
+            if (mask) return n + __builtin_ctz(mask);
+            n += 16;
+        }
+    }
+#endif
+    while (a[n] == b[n] && b[n])
+        n++;
+    return n;
+}
+
+int scan_masks(const unsigned long long* masks, int len, unsigned long long absent) {
+    int i = 0;
+#ifdef SCAN_X86
+    if (simd_level == 2) return scan_masks_avx2(masks, len, absent);
+    if (simd_level == 1) return scan_masks_sse2(masks, len, absent);
+#endif
+    while (i < len && (masks[i] & absent))
+        i++;
+    return i;
+}
+
+int scan_simd_level(void) {
+#ifdef SCAN_X86
+    return simd_level;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,47 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Scanning kernels for the parser's (and presence matching's) inner loops,
+ * which look at 16 (SSE2) or 32 (AVX2) bytes at a time when the CPU has them,
+ * and one at a time otherwise. Every version gives the same answer as the
+ * scalar loop described for it.
+ *
+ * The character scans all stop at a null term, and never read past the page
+ * the null term is in, so they're safe right up to the end of a buffer or
+ * mapping. Setting the VERA_SIMD environment variable to 0 (scalar), 1 (SSE2)
+ * or 2 (AVX2) caps which version gets used. */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+/* first character that isn't whitespace, same as
+ * while (*s && *s <= 0x20) s++; */
+char* scan_whitespace(char* s);
+
+/* first character that ends a symbol: a null term, the delimiter, ',' or ':'
+ * if colons is set. (Newlines are just whitespace inside a symbol) */
+char* scan_symbol_end(char* s, char delim, int colons);
+
+/* how many characters at the start of a and b are the same, not counting b's
+ * null term */
+int scan_same(char* a, char* b);
+
+/* index of the first mask with none of the absent bits set (len if there
+ * isn't one), same as
+ * while (i < len && (masks[i] & absent)) i++; */
+int scan_masks(const unsigned long long* masks, int len, unsigned long long absent);
+
+/* which version the scans use: 0 for scalar, 1 for SSE2, 2 for AVX2 (always
+ * 0 off x86), for other kernels that pick a version the same way (see
+ * batch.c) */
+int scan_simd_level(void);
+
+#endif
@@ -0,0 +1,181 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <string.h>
+#include "sparse.h"
+
+#define BAG_START 64 /* initial number of slots in a sparse bag */
+
+/* build (or rebuild) the sparse layout of the rules table, allocated out of
+ * the passed arena. Returns 0 if out of memory */
+int build_sparse_rules(RuleTable* rules, SparseRules* sparse, Arena* arena) {
+    RuleEntry* entry;
+    int lhs_len = 0;
+    int delta_len = 0;
+    int delta;
+    int i, k;
+
+    /* count the nonzero entries first so everything is allocated once */
+    for (k = 0; k < rules->entries_len; k++) {
+        entry = &rules->entries[k];
+        if (entry->lhs) lhs_len++;
+        if (entry->rhs - (entry->lhs != 0)) delta_len++;
+    }
+    sparse->lhs_start = arena_alloc(arena, ((size_t)rules->len + 1) * sizeof(int));
+    sparse->lhs = arena_alloc(arena, (size_t)lhs_len * sizeof(int));
+    sparse->lhs_counts = arena_alloc(arena, (size_t)lhs_len * sizeof(int));
+    sparse->delta_start = arena_alloc(arena, ((size_t)rules->len + 1) * sizeof(int));
+    sparse->delta_syms = arena_alloc(arena, (size_t)delta_len * sizeof(int));
+    sparse->deltas = arena_alloc(arena, (size_t)delta_len * sizeof(int));
+    if (!sparse->lhs_start || !sparse->lhs || !sparse->lhs_counts || !sparse->delta_start || !sparse->delta_syms || !sparse->deltas)
+        return 0;
+    sparse->transfers = NULL;
+    if (rules->transfers) {
+        if (!(sparse->transfers = arena_alloc(arena, ((size_t)rules->len + 1) * sizeof(int))))
+            return 0;
+        memcpy(sparse->transfers, rules->transfers, (size_t)rules->len * sizeof(int));
+    }
+
+    lhs_len = 0;
+    delta_len = 0;
+    for (i = 0; i < rules->len; i++) {
+        sparse->lhs_start[i] = lhs_len;
+        sparse->delta_start[i] = delta_len;
+        for (k = rules->starts[i]; k < rules->starts[i + 1]; k++) {
+            entry = &rules->entries[k];
+            /* any nonzero LHS count means the rule takes one of the symbol
+             * per execution, multiplicity on the LHS doesn't matter */
+            if (entry->lhs) {
+                sparse->lhs[lhs_len] = entry->sym;
+                sparse->lhs_counts[lhs_len] = entry->lhs;
+                lhs_len++;
+            }
+            delta = entry->rhs - (entry->lhs != 0);
+            if (delta) {
+                sparse->delta_syms[delta_len] = entry->sym;
+                sparse->deltas[delta_len] = delta;
+                delta_len++;
+            }
+        }
+    }
+    sparse->lhs_start[rules->len] = lhs_len;
+    sparse->delta_start[rules->len] = delta_len;
+    sparse->len = rules->len;
+    return 1;
+}
+
+/* rebuild the rule entries from rules->sparse, for rules that were loaded
+ * without them. Returns 0 if out of memory */
+int build_rule_entries(RuleTable* rules) {
+    SparseRules* sparse = rules->sparse;
+    int i, k;
+    rules->len = 0;
+    rules->entries_len = 0;
+    for (i = 0; i < sparse->len; i++) {
+        if (!reserve_rule(rules)) return 0;
+        /* undo the -1 in the delta (finish_rule adds them back together),
+         * symbols that come back out the same won't have a delta at all */
+        for (k = sparse->lhs_start[i]; k < sparse->lhs_start[i + 1]; k++)
+            if (!add_to_rule(rules, sparse->lhs[k], sparse->lhs_counts[k], 1)) return 0;
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            if (!add_to_rule(rules, sparse->delta_syms[k], 0, sparse->deltas[k])) return 0;
+        finish_rule(rules);
+    }
+    if (sparse->transfers) {
+        if (!(rules->transfers = arena_alloc(rules->syms->arena, (size_t)rules->max_len * sizeof(int))))
+            return 0;
+        memcpy(rules->transfers, sparse->transfers, (size_t)sparse->len * sizeof(int));
+    }
+    return 1;
+}
+
+int limits_executions(SparseRules* sparse, int rule, int k) {
+    int d;
+    if (!sparse->transfers || !sparse->transfers[rule]) return 1;
+    for (d = sparse->delta_start[rule]; d < sparse->delta_start[rule + 1]; d++)
+        if (sparse->delta_syms[d] == sparse->lhs[k])
+            return 1;
+    return 0;
+}
+
+/* get the sparse layout of the rules, building it if it hasn't been yet or if
+ * rules have been added since */
+SparseRules* sparse_rules(RuleTable* rules) {
+    if (!rules->sparse)
+        rules->sparse = arena_alloc(rules->syms->arena, sizeof(SparseRules));
+    if (rules->sparse && rules->sparse->len != rules->len)
+        if (!build_sparse_rules(rules, rules->sparse, rules->syms->arena))
+            rules->sparse->len = -1; /* out of memory, try again next time */
+    return rules->sparse;
+}
+
+/* set up an empty sparse accumulator */
+void init_sparse_bag(SparseBag* bag, SymTable* syms, Arena* arena) {
+    bag->syms = syms;
+    bag->arena = arena;
+    bag->keys = arena_alloc(arena, BAG_START * sizeof(int));
+    bag->counts = arena_alloc(arena, BAG_START * sizeof(int));
+    bag->len = 0;
+    bag->max_len = BAG_START;
+}
+
+/* find the slot for the passed symbol, either where it is or the empty slot
+ * it would go in */
+static int find_slot(int* keys, int max_len, int sym) {
+    int mask = max_len - 1;
+    int i = (sym * 2654435761u) & mask; /* Knuth's multiplicative hash */
+    while (keys[i] && keys[i] != sym + 1)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* number of the passed symbol currently in the bag */
+int sparse_bag_count(SparseBag* bag, int sym) {
+    int i = find_slot(bag->keys, bag->max_len, sym);
+    return bag->keys[i] ? bag->counts[i] : 0;
+}
+
+/* double the number of slots, rehashing everything already in the bag */
+static int grow_sparse_bag(SparseBag* bag) {
+    int max_len = bag->max_len * 2;
+    int* keys = arena_alloc(bag->arena, max_len * sizeof(int));
+    int* counts = arena_alloc(bag->arena, max_len * sizeof(int));
+    int i, slot;
+    if (!keys || !counts) return 0;
+    for (i = 0; i < bag->max_len; i++) {
+        if (!bag->keys[i]) continue;
+        slot = find_slot(keys, max_len, bag->keys[i] - 1);
+        keys[slot] = bag->keys[i];
+        counts[slot] = bag->counts[i];
+    }
+    bag->keys = keys;
+    bag->counts = counts;
+    bag->max_len = max_len;
+    return 1;
+}
+
+/* add delta (which can be negative) of the passed symbol to the bag, returns
+ * 0 if out of memory */
+int sparse_bag_add(SparseBag* bag, int sym, int delta) {
+    int i = find_slot(bag->keys, bag->max_len, sym);
+    if (!bag->keys[i]) {
+        /* keep the table at most half full so probing stays short. (symbols
+         * that drop back to 0 keep their slot, they'll likely be back) */
+        if ((bag->len + 1) * 2 > bag->max_len) {
+            if (!grow_sparse_bag(bag)) return 0;
+            i = find_slot(bag->keys, bag->max_len, sym);
+        }
+        bag->keys[i] = sym + 1;
+        bag->len++;
+    }
+    bag->counts[i] += delta;
+    return 1;
+}
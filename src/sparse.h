@@ -0,0 +1,102 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Compressed sparse (CSR) versions of the rules table and accumulator, for
+ * when most symbols aren't involved in any given rule (or bag). */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "parser.h"
+
+/* ----------------------------------------------
+Each rule as just the symbols it needs and the changes it makes, so if the
+rules table was: (a, b, c)
+
+|a, b| c:2
+|a| a, b
+
+lhs_start = [0, 2, 3]
+lhs = [0, 1, 0]
+lhs_counts = [1, 1, 1]
+delta_start = [0, 3, 4]
+delta_syms = [0, 1, 2, 1]
+deltas = [-1, -1, 2, 1]
+
+Rule i takes the symbols lhs[lhs_start[i]] up to (not including)
+lhs[lhs_start[i + 1]], and each execution of it adds deltas[k] to symbol
+delta_syms[k] for delta_start[i] <= k < delta_start[i + 1]. A delta is the
+RHS count minus one if the symbol is also on the LHS, symbols that come back
+out the same (like the a above) are left out entirely.
+
+Facts have no LHS symbols, their deltas are just their RHS counts. The LHS
+counts aren't needed to run a rule (a rule only needs one of each), but are
+kept so the rule entries can be rebuilt exactly.
+
+transfers is a copy of RuleTable.transfers (NULL if there aren't any). A
+native transfer's executions are limited only by the LHS symbols it changes,
+not the ones it puts back, see limits_executions.
+---------------------------------------------- */
+typedef struct SparseRules {
+    int len; /* number of rules */
+    int* lhs_start;
+    int* lhs;
+    int* lhs_counts;
+    int* delta_start;
+    int* delta_syms;
+    int* deltas;
+    int* transfers;
+} SparseRules;
+
+/* ----------------------------------------------
+Accumulator as a hash map from symbol ID to count, so it only needs space for
+the symbols that have shown up in it rather than every symbol in the table.
+---------------------------------------------- */
+typedef struct SparseBag {
+    SymTable* syms;
+    int* keys; /* symbol ID + 1 in each slot, 0 for an empty slot */
+    int* counts;
+    int len; /* number of used slots */
+    int max_len; /* number of slots, always a power of two */
+    Arena* arena;
+} SparseBag;
+
+/* build (or rebuild, e.g. after a pass added rules) the sparse layout of the
+ * rules table, allocated out of the passed arena. Returns 0 if out of memory */
+int build_sparse_rules(RuleTable* rules, SparseRules* sparse, Arena* arena);
+
+/* rebuild the rule entries from rules->sparse, for rules that were loaded
+ * without them (see load_image), into the (empty) rules table. Returns 0 if out
+ * of memory */
+int build_rule_entries(RuleTable* rules);
+
+/* get the sparse layout of the rules, building it if it hasn't been yet or if
+ * rules have been added since. (If you change rules in place, rebuild it
+ * yourself with build_sparse_rules) */
+SparseRules* sparse_rules(RuleTable* rules);
+
+/* whether LHS symbol k (an index into sparse->lhs) of the rule limits how
+ * many times it executes, which is always unless the rule is a native
+ * transfer and puts the symbol back. (Check sparse->transfers first, this
+ * looks through the rule's deltas) */
+int limits_executions(SparseRules* sparse, int rule, int k);
+
+/* set up an empty sparse accumulator */
+void init_sparse_bag(SparseBag* bag, SymTable* syms, Arena* arena);
+
+/* number of the passed symbol currently in the bag */
+int sparse_bag_count(SparseBag* bag, int sym);
+
+/* add delta (which can be negative) of the passed symbol to the bag, returns
+ * 0 if out of memory */
+int sparse_bag_add(SparseBag* bag, int sym, int delta);
+
+#endif
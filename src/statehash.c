@@ -0,0 +1,63 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include "statehash.h"
+
+/* splitmix64, so the keys are the same every run */
+static unsigned long long mix(unsigned long long x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+int init_state_table(StateTable* table, int syms_len, int slots) {
+    int i;
+    table->keys = malloc((syms_len + 1) * sizeof(unsigned long long));
+    table->hashes = malloc(slots * sizeof(unsigned long long));
+    table->steps = malloc(slots * sizeof(int));
+    table->mask = slots - 1;
+    if (!table->keys || !table->hashes || !table->steps) {
+        free_state_table(table);
+        return 0;
+    }
+    for (i = 0; i < syms_len; i++)
+        table->keys[i] = mix(i);
+    for (i = 0; i < slots; i++)
+        table->steps[i] = -1;
+    return 1;
+}
+
+void free_state_table(StateTable* table) {
+    free(table->keys);
+    free(table->hashes);
+    free(table->steps);
+    table->keys = table->hashes = NULL;
+    table->steps = NULL;
+}
+
+unsigned long long state_hash(StateTable* table, int* accumulator, int len) {
+    unsigned long long hash = 0;
+    int i;
+    for (i = 0; i < len; i++)
+        hash += STATE_HASH_DELTA(table, i, accumulator[i]);
+    return hash;
+}
+
+int state_seen(StateTable* table, unsigned long long hash, int step) {
+    /* (the low bits of the sum are the weakest, so slot by the high ones) */
+    int slot = (int)((hash >> 32) & (unsigned int)table->mask);
+    int seen = table->steps[slot] != -1 && table->hashes[slot] == hash ? table->steps[slot] : -1;
+    table->hashes[slot] = hash;
+    table->steps[slot] = step;
+    return seen;
+}
@@ -0,0 +1,53 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* Hashing whole accumulator states, for noticing when a program comes back
+ * around to a bag it's already been in. */
+
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+/* ----------------------------------------------
+Each symbol gets a random 64 bit key, and a state's hash is the sum of each
+symbol's count times its key (wrapping around). Like a Zobrist hash it can be
+kept up to date as the bag changes, by adding delta * key for just the symbols
+a step touches, but counts don't have to be small enough to key each one.
+
+Seen states go in a fixed size table, one (hash, step) per slot picked by the
+hash, a newer state taking the slot over from an older one. So it only ever
+remembers the most recent states, and a cycle is caught as long as some state
+in it is still in the table when it comes back around.
+---------------------------------------------- */
+typedef struct StateTable {
+    unsigned long long* keys; /* by symbol ID */
+    unsigned long long* hashes; /* by slot */
+    int* steps; /* step each slot's state was seen at, -1 if empty */
+    int mask; /* slots - 1 */
+} StateTable;
+
+/* set up keys for syms_len symbols and an empty table of slots (a power of
+ * two) slots. Returns 0 if out of memory. */
+int init_state_table(StateTable* table, int syms_len, int slots);
+
+/* free everything init_state_table allocated */
+void free_state_table(StateTable* table);
+
+/* hash of the whole accumulator */
+unsigned long long state_hash(StateTable* table, int* accumulator, int len);
+
+/* change to a state's hash from delta more of the symbol */
+#define STATE_HASH_DELTA(table, sym, delta) ((unsigned long long)(long long)(delta) * (table)->keys[sym])
+
+/* record that the state with the passed hash was seen at step, returning the
+ * step it was last seen at, -1 if it isn't in the table */
+int state_seen(StateTable* table, unsigned long long hash, int step);
+
+#endif
@@ -13,74 +13,49 @@ WITH REGARD TO THIS SOFTWARE.
 #include <string.h>
 #include "parser.h"
 #include "variables_pass.h"
+#include "image.h"
 
-#define SRC_SZ 32768 /* maximum size of input vera source code */
-#define NAM_SZ 32768 /* maximum combined text size of all symbol names? */
-#define SYM_SZ 256  /* maximum number of unique symbols? */
-#define RUL_SZ 128   /* maximum number of rules we can handle */
-
-static char src[SRC_SZ];
-static char names[NAM_SZ];
-static char* syms[SYM_SZ];
-static int rules[RUL_SZ * SYM_SZ * 2];
-static int acc[SYM_SZ];
-
-static SymTable sym_table = {
-    .names = names,
-    .table = syms,
-    .len = 0,
-    .max_len = SYM_SZ,
-    .names_len = 0,
-};
-
-static RuleTable rule_table = {
-    .syms = &sym_table,
-    .table = rules,
-    .len = 0,
-    .max_len = RUL_SZ,
-};
+static Arena arena; /* everything for the program is allocated from here */
+static SymTable sym_table;
+static RuleTable rule_table;
 
 static void
 dump_vera() {
-    int i, j;
-    for (i = 0; i < RUL_SZ; i++) {
-        int sum = 0;
-        /* determine if this rule "exists"/isn't blank if any of the associated symbol
-           s are > 0 */
-        for (j = 0; j < SYM_SZ*2; j++) {
-            sum += rules[i*SYM_SZ*2 + j];
-        }
-        if (sum > 0) {
+    int i, k;
+    RuleEntry* entry;
+    for (i = 0; i < rule_table.len; i++) {
+        /* skip any rule that's blank (no symbols on either side) */
+        if (rule_table.starts[i] != rule_table.starts[i + 1]) {
             printf("|", i);
             int first_printed = 0; /* use this to determine whether to print, or not */
-            for (j = 0; j < SYM_SZ; j++) {
+            for (k = rule_table.starts[i]; k < rule_table.starts[i + 1]; k++) {
                 /* handle printing symbol and multiplicity if part of the rule
                  * lhs */
-                if (rules[i*SYM_SZ*2 + j] == 1) {
+                entry = &rule_table.entries[k];
+                if (entry->lhs == 1) {
                     if (first_printed) printf(",");
                     first_printed = 1;
-                    printf("%s", syms[j]);
-                } else if (rules[i*SYM_SZ*2 + j] > 1) {
+                    printf("%s", sym_table.table[entry->sym]);
+                } else if (entry->lhs > 1) {
                     if (first_printed) printf(",");
                     first_printed = 1;
-                    printf("%s:%d", syms[j], rules[i*SYM_SZ*2 + j]);
+                    printf("%s:%d", sym_table.table[entry->sym], entry->lhs);
                 }
             }
             printf("|");
             first_printed = 0;
-            int rel_j;
-            for (j = SYM_SZ; j < SYM_SZ*2; j++) {
+            for (k = rule_table.starts[i]; k < rule_table.starts[i + 1]; k++) {
                 /* handle printing symbol and multiplicity if part of the rule
                  * rhs */
-                rel_j = j - SYM_SZ;
-                if (rules[i*SYM_SZ*2 + j] == 1) {
+                entry = &rule_table.entries[k];
+                if (entry->rhs == 1) {
                     if (first_printed) printf(",");
                     first_printed = 1;
-                    printf("%s", syms[rel_j]);
-                } else if (rules[i*SYM_SZ*2 + j] > 1) {
+                    printf("%s", sym_table.table[entry->sym]);
+                } else if (entry->rhs > 1) {
                     if (first_printed) printf(",");
                     first_printed = 1;
-                    printf("%s:%d", syms[rel_j], rules[i*SYM_SZ*2 + j]);
+                    printf("%s:%d", sym_table.table[entry->sym], entry->rhs);
                 }
             }
             printf("\n");
@@ -90,41 +65,69 @@ dump_vera() {
 
 int main(int argc, char* argv[]) {
     FILE *f;
+    int parsed;
     int a = 1;
 
     int force = 0; /* --force */
+    int transfers = 0; /* --transfers */
+    int parse_threads = 1; /* --parse-threads [NUM] */
+    int image = 0; /* --image, output a binary image instead of vera */
     int filename_argv_index = -1; /* if never set, expect stdin */
 
     /* cli arg parsing */
     while (a < argc) {
         if (strcmp(argv[a], "--force") == 0)
             force = 1;
+        else if (strcmp(argv[a], "--transfers") == 0)
+            transfers = 1;
+        else if (strcmp(argv[a], "--parse-threads") == 0) {
+            a++;
+            walk_number(argv[a], &parse_threads);
+        }
+        else if (strcmp(argv[a], "--image") == 0)
+            image = 1;
         else
             filename_argv_index = a;
         a++;
     }
 
+    init_tables(&arena, &sym_table, &rule_table);
+
     /* grab source code from correct source */
     if (filename_argv_index > -1) {
         /* open and read in the source file */
         if(!(f = fopen(argv[filename_argv_index], "r")))
             return !printf("Source missing: %s\n", argv[a]);
-        if(!fread(&src, 1, SRC_SZ, f))
+        if (is_image(f)) {
+            if (!(parsed = load_image(f, &rule_table, NULL, 1)))
+                return !printf("Broken image: %s\n", argv[filename_argv_index]);
+        }
+        else if((parsed = parse_file(f, &rule_table, 1, parse_threads)) == -1)
             return !printf("Source empty: %s\n", argv[a]);
     }
     else {
         /* read source code from stdin */
         /* NOTE: if you aren't piping anything in, you can just enter code and
          * use ctrl+D to term */
-        fread(&src, 1, SRC_SZ, stdin);
+        if (is_image(stdin)) {
+            if (!(parsed = load_image(stdin, &rule_table, NULL, 1)))
+                return !printf("Broken image\n");
+        }
+        else
+            parsed = parse_stream(stdin, &rule_table, 1);
     }
 
-    if(parse(src, &rule_table, 1)) {
-        run_variables_pass(&rule_table, force);
-        dump_vera();
+    if(parsed) {
+        run_variables_pass(&rule_table, force, transfers);
+        if (image) {
+            if (!write_image(stdout, &rule_table, 0)) return 1;
+        }
+        else
+            dump_vera();
     }
     else {
         return 1;
     }
+    arena_free(&arena);
     return 0;
 }
@@ -10,160 +10,321 @@ WITH REGARD TO THIS SOFTWARE.
 ==================================================================== */
 
 #include "variables_pass.h"
+#include <stdlib.h>
+#include <string.h>
 
 
-/* return nonzero if "a sep b" == "z" */
-int compare_syms_concat_separator_symbol(char* a, char* b, char* sep, char* z) {
-    int not_equal = 0;
-    /* make sure the a symbol part matches the beginning of the z symbol */
-    while (*a && *z) {
-        if (*a != *z) return 0;
-        a++;
-        z++;
-    }
-    /* if we've reached the end of z, this isn't a match */
-    if (!*z)
-        return 0;
-    /* make sure the separator (' -> ') portion aligns */
-    while (*sep && *z) {
-        if (*sep != *z) return 0;
-        sep++;
-        z++;
-    }
-    /* if we've reached the end of z, this isn't a match */
-    if (!*z)
-        return 0;
-    /* make sure the b symbol part matches the end of the z symbol */
-    while (*b && *z) {
-        if (*b != *z) return 0;
-        b++;
-        z++;
-    }
-    /* we should now be at the end of both symbols */
-    return !*b && !*z;
+/* write "a sep b" into the unused space at the end of the symbol names array,
+ * without adding it to the symbols table yet. Returns a pointer to the name. */
+static char* write_concat_separator_name(char* a, char* b, char* sep, SymTable* syms) {
+    char* name = &(syms->names[syms->names_len]);
+    char* cursor = name;
+    while (*a) *cursor++ = *a++;
+    while (*sep) *cursor++ = *sep++;
+    while (*b) *cursor++ = *b++;
+    *cursor = 0;
+    return name;
 }
 
-/* add "a sep b" symbol to the passed symbols table, return index of new symbol
- * in table. */
-int add_syms_concat_separator_symbol(char* a, char* b, char* sep, SymTable* syms) {
-    /* assign the next symbol in the symbols table to the current position of
-     * the symbol names string. */
-    syms->table[syms->len] = &(syms->names[syms->names_len]);
+/* find the "a sep b" symbol, or if it isn't in the symbols table yet and add
+ * is nonzero, add it. Returns the index of the symbol, or -1 if it isn't there
+ * and wasn't added (or we ran out of memory). */
+int find_or_add_syms_concat_separator_symbol(char* a, char* b, char* sep, RuleTable* rules, int add) {
+    SymTable* syms = rules->syms;
+    char* name;
+    int index;
+    if (!reserve_symbol(rules, strlen(a) + strlen(sep) + strlen(b) + 1)) return -1;
+    name = write_concat_separator_name(a, b, sep, syms);
+    index = index_of_symbol(name, syms);
+    if (index > -1 || !add)
+        return index; /* leave the written name to be overwritten by the next one */
+    /* assign the next symbol in the symbols table to the name we just wrote */
+    syms->table[syms->len] = name;
     syms->len = syms->len + 1;
-    /* write the symbol string to the names array */
-    while (a[0]) {
-        syms->names[syms->names_len] = a[0];
-        syms->names_len++;
-        *a++;
-    }
-    while (sep[0]) {
-        syms->names[syms->names_len] = sep[0];
-        syms->names_len++;
-        *sep++;
-    }
-    while (b[0]) {
-        syms->names[syms->names_len] = b[0];
-        syms->names_len++;
-        *b++;
-    }
+    while (syms->names[syms->names_len]) syms->names_len++;
     syms->names_len++; /* increment once more to ensure a null term between names */
+    index_symbol(syms->len - 1, syms);
     return syms->len - 1;
 }
 
+/* the variables listed by '|#| variables, ...' annotations */
+typedef struct Variables {
+    int* symbols; /* symbol IDs, in the order they were listed */
+    int len;
+    /* per symbol ID, its position in symbols + 1, or 0 if it isn't a
+     * variable, so a name can be checked in O(1) once it's looked up */
+    int* position;
+    int position_len;
+} Variables;
+
+/* a movement or copy between two variables whose control symbol showed up */
+typedef struct VariableRule {
+    int a; /* positions in Variables.symbols */
+    int b;
+    int copy; /* 0 for 'a -> b', 1 for 'a = b' */
+} VariableRule;
+
+/* mark a rule the pass just added as a native transfer */
+static void mark_transfer(RuleTable* rules, int rule) {
+    if (!rules->transfers)
+        rules->transfers = arena_alloc(rules->syms->arena, rules->max_len * sizeof(int));
+    if (rules->transfers)
+        rules->transfers[rule] = 1;
+}
+
 /* destructive data movement rules of form:
  * |a -> b, a| a -> b, b
  * |a -> b|
  * with force = 0, a rule doesn't get added if it won't be needed, pass
  * something non-zero to force all rules to be generated (useful e.g. for a
- * repl)
+ * repl). With transfers, the first rule is a native transfer, which moves
+ * all of a in one step rather than one per step.
  * */
-void add_move_a_to_b_rules(int sym_a_index, int sym_b_index, RuleTable* rules, int force) {
+void add_move_a_to_b_rules(int sym_a_index, int sym_b_index, RuleTable* rules, int force, int transfers) {
     /* search for the 'a -> b' symbol - if it's not in the symbols table yet,
-     * that means we don't need to add this rule, because it wouldn't be used? (if not force) */
-    int movement_sym_index = -1;
-    int i; /* symbol index */
-    for (i = 0; i < rules->syms->len; i++) {
-        if (compare_syms_concat_separator_symbol(rules->syms->table[sym_a_index], rules->syms->table[sym_b_index], " -> ", rules->syms->table[i])) {
-            movement_sym_index = i;
-        }
-    }
-
-    if (movement_sym_index == -1) {
-        if (force) {
-            /* add the 'a -> b' name to symbol names list if not already there */
-            movement_sym_index = add_syms_concat_separator_symbol(
-                    rules->syms->table[sym_a_index],
-                    rules->syms->table[sym_b_index],
-                    " -> ",
-                    rules->syms);
-        }
-        else return;
-    }
+     * that means we don't need to add this rule, because it wouldn't be used?
+     * (if not force, otherwise add the 'a -> b' name to the symbols table) */
+    int movement_sym_index = find_or_add_syms_concat_separator_symbol(
+            rules->syms->table[sym_a_index],
+            rules->syms->table[sym_b_index],
+            " -> ",
+            rules,
+            force);
+    if (movement_sym_index == -1) return;
 
     /* now add the actual rules */
 
     /* add the |a -> b, a| a -> b, b rule */
-    /* left hand side a -> b */
-    rules->table[rules->len * rules->syms->max_len * 2 + movement_sym_index] = 1;
-    /* left hand side a */
-    rules->table[rules->len * rules->syms->max_len * 2 + sym_a_index] = 1;
-    /* right hand side a -> b */
-    rules->table[rules->len * rules->syms->max_len * 2 + movement_sym_index + rules->syms->max_len] = 1;
-    /* right hand side b */
-    rules->table[rules->len * rules->syms->max_len * 2 + sym_b_index + rules->syms->max_len] = 1;
-    rules->len++;
+    if (!reserve_rule(rules)
+            || !add_to_rule(rules, movement_sym_index, 1, 1)
+            || !add_to_rule(rules, sym_a_index, 1, 0)
+            || !add_to_rule(rules, sym_b_index, 0, 1))
+        return;
+    if (transfers) mark_transfer(rules, rules->len);
+    finish_rule(rules);
 
     /* add the |a -> b| rule */
-    rules->table[rules->len * rules->syms->max_len * 2 + movement_sym_index] = 1;
-    rules->len++;
+    if (!reserve_rule(rules) || !add_to_rule(rules, movement_sym_index, 1, 0)) return;
+    finish_rule(rules);
 }
 
 /* nondestructive data movement rules of form:
- * |a = b, a| a = b, b_copy, a
+ * |a = b, a| a = b, b, a => b
  * |a = b|
- * |b_copy| b */
-void add_copy_a_to_b_rules(int sym_a_index, int sym_b_index, RuleTable* rules) {
-}
+ * |a => b| a
+ * where 'a => b' holds the copied a until the copy is done. Only added if
+ * the 'a = b' symbol is already in the symbols table. With transfers, the
+ * first rule is a native transfer. */
+void add_copy_a_to_b_rules(int sym_a_index, int sym_b_index, RuleTable* rules, int transfers) {
+    int copy_sym_index = find_or_add_syms_concat_separator_symbol(
+            rules->syms->table[sym_a_index],
+            rules->syms->table[sym_b_index],
+            " = ",
+            rules,
+            0);
+    int held_sym_index;
+    if (copy_sym_index == -1) return;
+    held_sym_index = find_or_add_syms_concat_separator_symbol(
+            rules->syms->table[sym_a_index],
+            rules->syms->table[sym_b_index],
+            " => ",
+            rules,
+            1);
+    if (held_sym_index == -1) return;
+
+    /* add the |a = b, a| a = b, b, a => b rule */
+    if (!reserve_rule(rules)
+            || !add_to_rule(rules, copy_sym_index, 1, 1)
+            || !add_to_rule(rules, sym_a_index, 1, 0)
+            || !add_to_rule(rules, sym_b_index, 0, 1)
+            || !add_to_rule(rules, held_sym_index, 0, 1))
+        return;
+    if (transfers) mark_transfer(rules, rules->len);
+    finish_rule(rules);
 
+    /* add the |a = b| rule */
+    if (!reserve_rule(rules) || !add_to_rule(rules, copy_sym_index, 1, 0)) return;
+    finish_rule(rules);
 
-void run_variables_pass(RuleTable* rules, int force_all_rules) {
-    /* search for annotation rules '|#|...' */
+    /* add the |a => b| a rule */
+    if (!reserve_rule(rules)
+            || !add_to_rule(rules, held_sym_index, 1, 0)
+            || !add_to_rule(rules, sym_a_index, 0, 1))
+        return;
+    finish_rule(rules);
+}
+
+/* collect every variable from every '|#| variables, ...' annotation, each
+ * only once. Returns 0 if there aren't any (or we ran out of memory). */
+static int collect_variables(RuleTable* rules, Variables* vars) {
     int annotation_sym_index = index_of_symbol("#", rules->syms);
     int variables_sym_index = index_of_symbol("variables", rules->syms);
+    RuleEntry* annotation;
+    RuleEntry* variables;
+    int i; /* rule index */
+    int k; /* entry index */
+    int j; /* symbol index */
+    vars->len = 0;
+    vars->position_len = rules->syms->len;
+    vars->symbols = NULL;
+    vars->position = NULL;
     if (annotation_sym_index == -1 || variables_sym_index == -1) {
         /* if there's no variable annotation symbols, nothing to do */
-        return;
+        return 0;
     }
-
-    /* collect all variable symbols */
-    /* TODO: just limiting to 10 for now, prob need to figure out better way to
-     * do this */
-    int variable_symbols[10];
-    int vars_index = 0;
-    int i; /* rule index */
-    int j; /* symbol index */
+    vars->symbols = malloc((rules->syms->len + 1) * sizeof(int));
+    vars->position = calloc(rules->syms->len + 1, sizeof(int));
+    if (!vars->symbols || !vars->position) return 0;
     for (i = 0; i < rules->len; i++) {
-        if (rules->table[i * rules->syms->max_len * 2 + annotation_sym_index] &&
-                rules->table[i * rules->syms->max_len * 2 + variables_sym_index + rules->syms->max_len]) {
+        annotation = rule_entry(rules, i, annotation_sym_index);
+        variables = rule_entry(rules, i, variables_sym_index);
+        if (annotation && annotation->lhs && variables && variables->rhs) {
             /* we found a |#| variables annotation! Add all other symbols found
-             * on RHS of this rule to variable_symbols */
-            for (j = 0; j < rules->syms->len; j++) {
+             * on RHS of this rule to the variables */
+            for (k = rules->starts[i]; k < rules->starts[i + 1]; k++) {
+                j = rules->entries[k].sym;
                 if (j == variables_sym_index) continue; /* ignore the "variables" symbol itself obviously */
-                if (rules->table[i * rules->syms->max_len * 2 + j + rules->syms->max_len]) {
-                    variable_symbols[vars_index] = j;
-                    vars_index++;
+                if (rules->entries[k].rhs && !vars->position[j]) {
+                    vars->symbols[vars->len] = j;
+                    vars->len++;
+                    vars->position[j] = vars->len;
                 }
             }
         }
     }
-    
-    /* Add the appropriate rules for each one */
-    /* i is now symbol a, j is now symbol b */
-    for (i = 0; i < vars_index; i++) {
-        for (j = 0; j < vars_index; j++) {
+    return vars->len > 0;
+}
+
+static void free_variables(Variables* vars) {
+    free(vars->symbols);
+    free(vars->position);
+}
+
+/* position of the variable named by name (up to end, which is written over
+ * while looking it up) + 1, or 0 if it isn't one */
+static int variable_named(char* name, char* end, Variables* vars, SymTable* syms) {
+    char c = *end;
+    int index;
+    *end = 0;
+    index = index_of_symbol(name, syms);
+    *end = c;
+    if (index < 0 || index >= vars->position_len) return 0;
+    return vars->position[index];
+}
+
+/* if the symbol is an 'a -> b' or 'a = b' between two variables, fill in
+ * which. Splits the name at each separator in turn, and looks up both sides
+ * through the symbol hash index, rather than trying every pair of variables
+ * against it. (A separator has whitespace on both sides) */
+static int control_symbol_rule(char* name, Variables* vars, SymTable* syms, VariableRule* rule) {
+    char* s;
+    char* left_end;
+    char* right;
+    int sep_len;
+    for (s = name + 1; *s; s++) {
+        if (s[0] == '-' && s[1] == '>') sep_len = 2;
+        else if (s[0] == '=') sep_len = 1;
+        else continue;
+        if (s[-1] > 0x20 || !s[sep_len] || s[sep_len] > 0x20) continue;
+        left_end = s;
+        while (left_end > name && left_end[-1] <= 0x20) left_end--;
+        right = s + sep_len;
+        while (*right && *right <= 0x20) right++;
+        rule->a = variable_named(name, left_end, vars, syms);
+        rule->b = variable_named(right, right + strlen(right), vars, syms);
+        if (!rule->a || !rule->b || rule->a == rule->b) continue;
+        rule->a--;
+        rule->b--;
+        rule->copy = sep_len == 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* the order the rules go in: by variable a, then variable b, then movement
+ * before copy (the same order as trying every pair) */
+static int compare_variable_rules(const void* x, const void* y) {
+    const VariableRule* a = x;
+    const VariableRule* b = y;
+    if (a->a != b->a) return a->a - b->a;
+    if (a->b != b->b) return a->b - b->b;
+    return a->copy - b->copy;
+}
+
+/* add the rules for every movement/copy symbol from first_symbol on */
+static void add_variable_rules_from(RuleTable* rules, Variables* vars, int first_symbol, int transfers) {
+    VariableRule* found;
+    int found_len = 0;
+    int last_symbol = rules->syms->len; /* (the rules add symbols of their own) */
+    int i;
+    if (first_symbol >= last_symbol) return;
+    if (!(found = malloc((last_symbol - first_symbol) * sizeof(VariableRule)))) return;
+    for (i = first_symbol; i < last_symbol; i++)
+        if (control_symbol_rule(rules->syms->table[i], vars, rules->syms, &found[found_len]))
+            found_len++;
+    qsort(found, found_len, sizeof(VariableRule), compare_variable_rules);
+    for (i = 0; i < found_len; i++) {
+        /* (differently spaced names can split into the same pair, the rules
+         * go with whichever one is spaced the way they write it) */
+        if (i > 0 && compare_variable_rules(&found[i - 1], &found[i]) == 0) continue;
+        if (found[i].copy)
+            add_copy_a_to_b_rules(vars->symbols[found[i].a], vars->symbols[found[i].b], rules, transfers);
+        else
+            add_move_a_to_b_rules(vars->symbols[found[i].a], vars->symbols[found[i].b], rules, 0, transfers);
+    }
+    free(found);
+}
+
+int add_variable_rules(RuleTable* rules, int first_symbol, int transfers) {
+    Variables vars;
+    if (collect_variables(rules, &vars))
+        add_variable_rules_from(rules, &vars, first_symbol, transfers);
+    free_variables(&vars);
+    return rules->syms->len;
+}
+
+int add_variable_symbols(RuleTable* rules, char** names, int names_len) {
+    Variables vars;
+    VariableRule rule;
+    int added = 0;
+    int i;
+    if (collect_variables(rules, &vars)) {
+        for (i = 0; i < names_len; i++) {
+            if (!control_symbol_rule(names[i], &vars, rules->syms, &rule)) continue;
+            added += find_or_add_syms_concat_separator_symbol(
+                    rules->syms->table[vars.symbols[rule.a]],
+                    rules->syms->table[vars.symbols[rule.b]],
+                    rule.copy ? " = " : " -> ",
+                    rules,
+                    1) != -1;
+        }
+    }
+    free_variables(&vars);
+    return added;
+}
+
+void run_variables_pass(RuleTable* rules, int force_all_rules, int transfers) {
+    Variables vars;
+    int i; /* variable a */
+    int j; /* variable b */
+    if (!collect_variables(rules, &vars)) {
+        free_variables(&vars);
+        return;
+    }
+    if (!force_all_rules) {
+        /* only the movements and copies something actually mentions */
+        add_variable_rules_from(rules, &vars, 0, transfers);
+        free_variables(&vars);
+        return;
+    }
+    /* Add the appropriate rules for every pair */
+    for (i = 0; i < vars.len; i++) {
+        for (j = 0; j < vars.len; j++) {
             /* doesn't make sense to add a -> a rules... */
             if (i == j) continue;
-            add_move_a_to_b_rules(variable_symbols[i], variable_symbols[j], rules, force_all_rules);
+            add_move_a_to_b_rules(vars.symbols[i], vars.symbols[j], rules, 1, transfers);
+            add_copy_a_to_b_rules(vars.symbols[i], vars.symbols[j], rules, transfers);
         }
     }
+    free_variables(&vars);
 }
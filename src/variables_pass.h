@@ -16,6 +16,33 @@ WITH REGARD TO THIS SOFTWARE.
 
 #include "parser.h"
 
-void run_variables_pass(RuleTable* rules, int force_all_rules);
+/* add the rules for the variables listed in '|#| variables, ...'
+ * annotations: for each 'a -> b' (move all of a into b) and 'a = b' (copy a
+ * into b) symbol between two variables, the rules that carry it out when
+ * that symbol shows up in the bag. Any number of variables is fine, the
+ * symbols are split apart and looked up by name rather than every pair of
+ * variables being tried.
+ *
+ * Rules are only added for symbols already in the symbols table, unless
+ * force_all_rules is set, which adds movement rules (and symbols) for every
+ * pair of variables (for e.g. a repl, where they could be typed in later).
+ *
+ * With transfers, the rule doing the moving or copying is a native transfer,
+ * whose executions aren't limited by the control symbol it puts back, so the
+ * whole of a goes in one step rather than one per step. (Only images carry
+ * this, printed out as vera they're ordinary rules again) */
+void run_variables_pass(RuleTable* rules, int force_all_rules, int transfers);
+
+/* add the rules for any movement or copy symbols added to the symbols table
+ * since run_variables_pass (from first_symbol on), e.g. by
+ * add_variable_symbols or by parsing more source into the same tables.
+ * Returns the symbols table's length, to pass as first_symbol next time. */
+int add_variable_rules(RuleTable* rules, int first_symbol, int transfers);
+
+/* add whichever of names (names_len of them, e.g. symbols in a bag that the
+ * program doesn't have) are an 'a -> b' or 'a = b' between two variables to
+ * the symbols table, for add_variable_rules to then add their rules. The
+ * rest are left out of it. Returns how many were added. */
+int add_variable_symbols(RuleTable* rules, char** names, int names_len);
 
 #endif
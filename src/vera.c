@@ -0,0 +1,307 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+#include <stdlib.h>
+#include <string.h>
+#include "vera.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "matcher.h"
+#include "sparse.h"
+#include "image.h"
+#include "variables_pass.h"
+
+/* (flags for each of a bag's output ports) */
+#define PORT_RAISED 1 /* nonzero since we last saw it at 0 */
+#define PORT_QUEUED 2 /* in dirty, waiting for its callback */
+
+/* everything a program needs lives in its own arena, facts is the starting
+ * accumulator every new bag gets a copy of. The output ports are numbered
+ * separately (output_of each symbol, -1 if it isn't one), and touches lists
+ * the output ports each rule changes (touch_start has each rule's start), so
+ * a step only looks at the ports it could have raised. */
+struct VeraProgram {
+    Arena arena;
+    SymTable syms;
+    RuleTable rules;
+    int* facts;
+    int* outputs;
+    int outputs_len;
+    int* output_of;
+    int* touch_start;
+    int* touches;
+};
+
+/* a bag steps through a Matcher once it has one, which anything that
+ * changes the accumulator behind its back (vera_eval) throws away. The port
+ * arrays (one of each per output port) are only there once a callback's been
+ * registered (listening is how many are). */
+struct VeraBag {
+    VeraProgram* program;
+    BagOfFacts bag;
+    Matcher matcher;
+    int matching;
+    int listening;
+    VeraPortCallback* callbacks;
+    void** contexts;
+    char* ports;
+    int* dirty;
+    int dirty_len;
+};
+
+/* number the output ports and list the ones each rule changes */
+static int find_outputs(VeraProgram* program) {
+    SparseRules* sparse = sparse_rules(&program->rules);
+    Arena* arena = &program->arena;
+    int i, k, len = 0;
+    program->output_of = arena_alloc(arena, (program->syms.len + 1) * sizeof(int));
+    program->outputs = arena_alloc(arena, (program->syms.len + 1) * sizeof(int));
+    program->touch_start = arena_alloc(arena, (sparse->len + 1) * sizeof(int));
+    if (!program->output_of || !program->outputs || !program->touch_start) return 0;
+    for (i = 0; i < program->syms.len; i++) {
+        program->output_of[i] = -1;
+        if (program->syms.table[i][0] == '<') {
+            program->output_of[i] = program->outputs_len;
+            program->outputs[program->outputs_len++] = i;
+        }
+    }
+    for (i = 0; i < sparse->len; i++) {
+        program->touch_start[i] = len;
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            len += program->output_of[sparse->delta_syms[k]] != -1;
+    }
+    program->touch_start[sparse->len] = len;
+    if (!(program->touches = arena_alloc(arena, (len + 1) * sizeof(int)))) return 0;
+    for (i = 0, len = 0; i < sparse->len; i++)
+        for (k = sparse->delta_start[i]; k < sparse->delta_start[i + 1]; k++)
+            if (program->output_of[sparse->delta_syms[k]] != -1)
+                program->touches[len++] = program->output_of[sparse->delta_syms[k]];
+    return 1;
+}
+
+static VeraProgram* new_program() {
+    VeraProgram* program = calloc(1, sizeof(VeraProgram));
+    if (program) init_tables(&program->arena, &program->syms, &program->rules);
+    return program;
+}
+
+/* run the passes and work out everything a bag needs, so nothing about the
+ * program changes after this. facts is the starting accumulator if it's
+ * already known (from an image). */
+static VeraProgram* finish_program(VeraProgram* program, int* facts, int options) {
+    SparseRules* sparse;
+    BagOfFacts bag;
+    if (options & VERA_VARS) {
+        run_variables_pass(&program->rules, 0, (options & VERA_TRANSFERS) != 0);
+        facts = NULL;
+    }
+    sparse = sparse_rules(&program->rules);
+    init_bag(&bag, &program->syms, &program->arena);
+    if (!sparse || sparse->len < 0 || !bag.accumulator || !find_outputs(program)) {
+        vera_free_program(program);
+        return NULL;
+    }
+    if (facts)
+        memcpy(bag.accumulator, facts, program->syms.len * sizeof(int));
+    else
+        populate_facts(&bag, &program->rules);
+    program->facts = bag.accumulator;
+    return program;
+}
+
+VeraProgram* vera_parse(const char* source, int options) {
+    VeraProgram* program = new_program();
+    char* copy;
+    size_t len = strlen(source) + 1;
+    if (!program) return NULL;
+    /* (the parser gets its own copy to work in) */
+    if (!(copy = arena_alloc(&program->arena, len))
+            || !parse(memcpy(copy, source, len), &program->rules, !(options & VERA_NO_IMPLICIT_CONSTANTS))) {
+        vera_free_program(program);
+        return NULL;
+    }
+    return finish_program(program, NULL, options);
+}
+
+VeraProgram* vera_parse_file(FILE* f, int options) {
+    VeraProgram* program = new_program();
+    int* facts = NULL;
+    int parsed;
+    if (!program) return NULL;
+    if (is_image(f))
+        parsed = load_image(f, &program->rules, &facts, (options & VERA_VARS) != 0);
+    else
+        parsed = parse_file(f, &program->rules, !(options & VERA_NO_IMPLICIT_CONSTANTS), 1) == 1;
+    if (!parsed) {
+        vera_free_program(program);
+        return NULL;
+    }
+    return finish_program(program, facts, options);
+}
+
+void vera_free_program(VeraProgram* program) {
+    if (!program) return;
+    arena_free(&program->arena);
+    free(program);
+}
+
+int vera_symbols(const VeraProgram* program) {
+    return program->syms.len;
+}
+
+int vera_rules(const VeraProgram* program) {
+    return program->rules.len;
+}
+
+const char* vera_symbol_name(const VeraProgram* program, int symbol) {
+    return symbol >= 0 && symbol < program->syms.len ? program->syms.table[symbol] : NULL;
+}
+
+int vera_symbol(const VeraProgram* program, const char* name) {
+    return index_of_symbol((char*)name, (SymTable*)&program->syms);
+}
+
+VeraBag* vera_new_bag(const VeraProgram* program) {
+    VeraBag* bag = calloc(1, sizeof(VeraBag));
+    if (!bag) return NULL;
+    bag->program = (VeraProgram*)program;
+    bag->bag.syms = &bag->program->syms;
+    /* (not from the program's arena, which isn't ours to grow) */
+    if (!(bag->bag.accumulator = malloc((program->syms.len + 1) * sizeof(int)))) {
+        free(bag);
+        return NULL;
+    }
+    memcpy(bag->bag.accumulator, program->facts, program->syms.len * sizeof(int));
+    return bag;
+}
+
+VeraBag* vera_copy_bag(const VeraBag* bag) {
+    VeraBag* copy = vera_new_bag(bag->program);
+    if (copy) memcpy(copy->bag.accumulator, bag->bag.accumulator, bag->program->syms.len * sizeof(int));
+    return copy;
+}
+
+void vera_free_bag(VeraBag* bag) {
+    if (!bag) return;
+    if (bag->matching) free_matcher(&bag->matcher);
+    free(bag->bag.accumulator);
+    free(bag->callbacks);
+    free(bag->contexts);
+    free(bag->ports);
+    free(bag->dirty);
+    free(bag);
+}
+
+int vera_count(const VeraBag* bag, int symbol) {
+    return bag->bag.accumulator[symbol];
+}
+
+/* see whether an output port's been raised (or gone back to 0) since we
+ * last looked, queueing its callback if it's been raised */
+static void touch_output(VeraBag* bag, int output) {
+    if (!bag->bag.accumulator[bag->program->outputs[output]])
+        bag->ports[output] &= ~PORT_RAISED;
+    else if (!(bag->ports[output] & PORT_RAISED)) {
+        bag->ports[output] |= PORT_RAISED;
+        if (bag->callbacks[output] && !(bag->ports[output] & PORT_QUEUED)) {
+            bag->ports[output] |= PORT_QUEUED;
+            bag->dirty[bag->dirty_len++] = output;
+        }
+    }
+}
+
+/* call the callbacks of every output raised since the last time, including
+ * any the callbacks themselves raise */
+static void dispatch_outputs(VeraBag* bag) {
+    int output, port;
+    while (bag->dirty_len) {
+        output = bag->dirty[--bag->dirty_len];
+        bag->ports[output] &= ~PORT_QUEUED;
+        port = bag->program->outputs[output];
+        if (bag->callbacks[output] && bag->bag.accumulator[port])
+            bag->callbacks[output](bag, port, bag->bag.accumulator[port], bag->contexts[output]);
+    }
+}
+
+void vera_add(VeraBag* bag, int symbol, int count) {
+    if (bag->matching)
+        matcher_add(&bag->matcher, symbol, count);
+    else
+        bag->bag.accumulator[symbol] += count;
+    if (bag->listening && bag->program->output_of[symbol] != -1)
+        touch_output(bag, bag->program->output_of[symbol]);
+}
+
+int vera_on_output(VeraBag* bag, int port, VeraPortCallback callback, void* context) {
+    int outputs_len = bag->program->outputs_len;
+    int output = port >= 0 && port < bag->program->syms.len ? bag->program->output_of[port] : -1;
+    if (output == -1) return 0;
+    if (!bag->ports) {
+        bag->callbacks = calloc(outputs_len, sizeof(VeraPortCallback));
+        bag->contexts = calloc(outputs_len, sizeof(void*));
+        bag->ports = calloc(outputs_len, 1);
+        bag->dirty = malloc(outputs_len * sizeof(int));
+        if (!bag->callbacks || !bag->contexts || !bag->ports || !bag->dirty) {
+            free(bag->callbacks);
+            free(bag->contexts);
+            free(bag->ports);
+            free(bag->dirty);
+            bag->callbacks = NULL;
+            bag->contexts = NULL;
+            bag->ports = NULL;
+            bag->dirty = NULL;
+            return 0;
+        }
+    }
+    bag->listening += (callback != NULL) - (bag->callbacks[output] != NULL);
+    bag->callbacks[output] = callback;
+    bag->contexts[output] = context;
+    if (callback) touch_output(bag, output);
+    return 1;
+}
+
+int vera_inject(VeraBag* bag, int port, int count) {
+    if (port < 0 || port >= bag->program->syms.len || bag->program->syms.table[port][0] != '>')
+        return 0;
+    vera_add(bag, port, count - bag->bag.accumulator[port]);
+    return 1;
+}
+
+int vera_step(VeraBag* bag) {
+    VeraProgram* program = bag->program;
+    int rule, k;
+    if (!bag->matching)
+        bag->matching = init_matcher(&bag->matcher, &program->rules, bag->bag.accumulator);
+    /* (without memory for a matcher, still take the step) */
+    rule = bag->matching ? matcher_step(&bag->matcher) : step(&bag->bag, &program->rules);
+    if (!bag->listening) return rule;
+    for (k = rule == -1 ? 0 : program->touch_start[rule]; rule != -1 && k < program->touch_start[rule + 1]; k++)
+        touch_output(bag, program->touches[k]);
+    dispatch_outputs(bag);
+    return rule;
+}
+
+int vera_eval(VeraBag* bag, int max_steps) {
+    int steps = 0;
+    if (bag->listening) {
+        while (1) {
+            steps += 1;
+            if (vera_step(bag) == -1) break;
+            if (max_steps != -1 && steps >= max_steps) break;
+        }
+        return steps;
+    }
+    if (bag->matching) {
+        free_matcher(&bag->matcher);
+        bag->matching = 0;
+    }
+    return eval(&bag->bag, &bag->program->rules, max_steps);
+}
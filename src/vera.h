@@ -0,0 +1,98 @@
+/* ====================================================================
+Copyright (c) 2024 Nathan Martindale
+
+Permission to use, copy, modify, and distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE.
+==================================================================== */
+
+/* libvera, for running vera programs from inside another program (build
+ * with make lib, then link bin/libvera.a or bin/libvera.so with -pthread).
+ *
+ * A VeraProgram is parsed (and put through any passes) once, and never
+ * changes after that, so any number of threads can make and run VeraBags
+ * of it at once without locking anything. Each VeraBag is its own copy of
+ * the program's state and belongs to whichever thread is using it. Nothing
+ * here is kept in globals, so a process can have as many programs as it
+ * likes.
+ *
+ * Symbols starting with '<' are output ports and ones starting with '>'
+ * input ports. Rather than looking at every output after every step, a host
+ * registers a callback on the outputs it handles (vera_on_output), which is
+ * called when that output goes from 0 to something, and answers inputs with
+ * vera_inject. */
+
+#ifndef VERA_H
+#define VERA_H
+
+#include <stdio.h>
+
+typedef struct VeraProgram VeraProgram;
+typedef struct VeraBag VeraBag;
+
+/* called with the output port's symbol and its count, after the step that
+ * raised it. It can change the bag (e.g. vera_add to take the output back
+ * out, or vera_inject an answer), but not step it. */
+typedef void (*VeraPortCallback)(VeraBag* bag, int port, int count, void* context);
+
+/* options for vera_parse and vera_parse_file, or'd together */
+#define VERA_NO_IMPLICIT_CONSTANTS 1 /* (see --no-implicit-constants) */
+#define VERA_VARS 2 /* run the variables pass */
+#define VERA_TRANSFERS 4 /* make the variables pass's moves native transfers */
+
+/* parse vera source, returning NULL if it's broken (the parser prints why)
+ * or we're out of memory */
+VeraProgram* vera_parse(const char* source, int options);
+
+/* same as vera_parse, but reading f (source or an image, see image.h) */
+VeraProgram* vera_parse_file(FILE* f, int options);
+
+/* free a program, once none of its bags are left */
+void vera_free_program(VeraProgram* program);
+
+/* how many symbols/rules the program has. Symbols are numbered from 0 */
+int vera_symbols(const VeraProgram* program);
+int vera_rules(const VeraProgram* program);
+
+/* a symbol's name, or its number from its name (-1 if there isn't one) */
+const char* vera_symbol_name(const VeraProgram* program, int symbol);
+int vera_symbol(const VeraProgram* program, const char* name);
+
+/* a new bag holding the program's facts, NULL if out of memory */
+VeraBag* vera_new_bag(const VeraProgram* program);
+
+/* a new bag holding the same as bag (but with no callbacks), NULL if out of
+ * memory */
+VeraBag* vera_copy_bag(const VeraBag* bag);
+
+void vera_free_bag(VeraBag* bag);
+
+/* how many of symbol are in the bag */
+int vera_count(const VeraBag* bag, int symbol);
+
+/* add count (which can be negative) of symbol to the bag */
+void vera_add(VeraBag* bag, int symbol, int count);
+
+/* call callback(bag, port, count, context) whenever the output port goes
+ * from 0 to something (or NULL to stop). If it's already nonzero, that's on
+ * the next step. Returns 0 if port isn't an output port. */
+int vera_on_output(VeraBag* bag, int port, VeraPortCallback callback, void* context);
+
+/* set an input port's count, as a host answering it. Returns 0 if port
+ * isn't an input port. */
+int vera_inject(VeraBag* bag, int port, int count);
+
+/* fire the first rule that matches, returning its number, or -1 if none do.
+ * Callbacks for outputs it raised are called before it returns. */
+int vera_step(VeraBag* bag);
+
+/* step until no rule matches, or max_steps have been taken (-1 for no
+ * limit). Returns the number of steps taken, counted the way bin/run does.
+ * With any output callbacks registered this goes a vera_step at a time, so
+ * that they're called in between (and anything they inject is run). */
+int vera_eval(VeraBag* bag, int max_steps);
+
+#endif